@@ -0,0 +1,58 @@
+# PlatformIO post build step: flash and static RAM per module.
+#
+# Runs avr-size over every object file that went into the firmware and
+# prints, per module, the flash (text + data) and static RAM (data + bss)
+# it brings in, then the linked totals against the board's limits. Object
+# sizes are from before the linker drops unused sections, so they can add
+# up to more than the totals; the totals line is what is on the chip.
+#
+# Whatever RAM the totals leave is shared by the stack. On the ATtiny use
+# the EQ key to see how much of it the stack has actually used, see
+# src/memory.h.
+
+import glob
+import os
+import subprocess
+
+Import("env")
+
+
+def size(env, paths):
+    out = subprocess.check_output([env.subst("$SIZETOOL")] + paths, env=env["ENV"])
+    rows = []
+    for line in out.decode().splitlines()[1:]:
+        text, data, bss, _, _, name = line.split(None, 5)
+        rows.append((int(text), int(data), int(bss), name))
+    return rows
+
+
+def report(source, target, env):
+    build = env.subst("$BUILD_DIR")
+    objs = sorted(glob.glob(os.path.join(build, "**", "*.o"), recursive=True))
+    if not objs:
+        return
+
+    modules = {}
+    for text, data, bss, name in size(env, objs):
+        module = os.path.relpath(name, build)
+        if module.startswith("src" + os.sep):
+            module = module[4:]
+        else:
+            module = "[core] " + os.path.basename(module)
+        modules[module] = (text + data, data + bss)
+
+    print("\n%-36s %8s %8s" % ("Module (%s)" % env.subst("$PIOENV"), "flash", "RAM"))
+    for module, (flash, ram) in sorted(modules.items(), key=lambda m: (-m[1][1], -m[1][0])):
+        if flash or ram:
+            print("%-36s %8d %8d" % (module, flash, ram))
+
+    text, data, bss, _ = size(env, [str(target[0])])[0]
+    board = env.BoardConfig()
+    max_flash = int(board.get("upload.maximum_size", 0))
+    max_ram = int(board.get("upload.maximum_ram_size", 0))
+    print("%-36s %8d %8d" % ("Linked total", text + data, data + bss))
+    if max_flash and max_ram:
+        print("%-36s %8d %8d\n" % ("Left", max_flash - text - data, max_ram - data - bss))
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", report)
@@ -0,0 +1,288 @@
+// Audio input against the PWM
+//
+//   sim-audio audio [-f recording.wav] [-s seconds] [-w pwm clocks] [-i ir clocks] [-r seed]
+//
+// Needs the audio build, so it only works in the binary "make sim-audio"
+// builds. Runs setup() and loop() on the timer model on the music program
+// with the ADC free running on a recording, so the ADC ISR runs at the
+// real sample rate in among the firmware's other interrupts. -f takes a
+// PCM WAV file, 8 or 16 bit, the first channel, resampled to the ADC rate
+// and offset to the mid rail as a preamp would leave it. Without one the
+// recording is made up: a kick drum on every beat at 120bpm, a hi-hat on
+// every off beat, a quiet note held under them and a little hiss, slightly
+// off the mid rail.
+//
+// The ISRs are charged what they take on the AVR: the ADC ISR from
+// audio.h, the PWM and IR ISRs from -w and -i (the defaults are estimates,
+// take t0Max and t1Max from an INSTRUMENT build for real figures). The same
+// run without the ADC is the baseline. Checked:
+//
+//  - no PWM compare is lost that the baseline doesn't lose too, and the
+//    PWM ISR never starts more than AUDIO_ISR_BLOCKED clocks later than it
+//    does in the baseline
+//  - no ADC result is lost to a late ISR
+//  - the main loop runs as many frames as the baseline
+//  - on the made up recording, the low band level is up after each kick
+//    against just before the next, and the high band after each hi-hat
+//
+// Reported: the ADC ISR's share of the CPU, which follows from the
+// AUDIO_ISR_CYCLES it's charged (uno_audio_instrument measures it on the
+// board), and the band levels.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "lights.h"
+#include "h-bridge.h"
+#include "frame.h"
+#include "programs.h"
+#include "audio.h"
+#include "sim.h"
+#include "irwave.h"
+#include "machine.h"
+
+#ifdef HAS_AUDIO
+
+extern void setup();
+extern void loop();
+
+extern volatile int16_t systemTicks;
+
+#define SAMPLE_RATE (SYSCLOCK / (13.0 * 128))
+#define BEAT 0.5                // seconds, 120bpm
+
+struct heard {
+  double at;                    // seconds
+  uint8_t level[AUDIO_BANDS];
+};
+
+static std::vector<heard> heardLevels;
+static uint32_t loopFrames;
+static int lastTicks;
+
+/*
+ * A new loop() frame has started whenever idleFor() has started
+ * systemTicks from 0 again; audio_frame() has run by then
+ */
+static void watch(uint8_t)
+{
+  if (systemTicks < lastTicks) {
+    loopFrames++;
+    heardLevels.push_back({ simCycles / (double) SYSCLOCK, { audioLevel[0], audioLevel[1] } });
+  }
+  lastTicks = systemTicks;
+}
+
+static uint8_t to_adc(double v)
+{
+  long s = lround(128 + v);
+  return s < 0 ? 0 : s > 255 ? 255 : s;
+}
+
+static void made_up(std::vector<uint8_t> &samples, double seconds)
+{
+  long n = seconds * SAMPLE_RATE;
+  double kick = 0, note = 0, last = 0;
+
+  for (long i=0; i<n; i++) {
+    double t = i / SAMPLE_RATE;
+    double sinceKick = fmod(t, BEAT);
+    double sinceHat = fmod(t + BEAT / 2, BEAT);
+
+    // Kick: a sine falling from 150 to 50Hz, dying away over ~0.1s
+    kick += 2 * M_PI * (50 + 100 * exp(-sinceKick / 0.03)) / SAMPLE_RATE;
+    double v = 60 * exp(-sinceKick / 0.1) * sin(kick);
+
+    // Hi-hat: differenced noise, shorter still
+    double noise = uniform(-1000, 1000) / 1000.0;
+    v += 40 * exp(-sinceHat / 0.03) * (noise - last);
+    last = noise;
+
+    note += 2 * M_PI * 330 / SAMPLE_RATE;
+    v += 5 * sin(note) + uniform(-1, 1) + 6;
+
+    samples.push_back(to_adc(v));
+  }
+}
+
+static uint32_t le(const uint8_t *p, int bytes)
+{
+  uint32_t v = 0;
+  while (bytes--) {
+    v = (v << 8) | p[bytes];
+  }
+  return v;
+}
+
+static bool load_wav(const char *path, std::vector<uint8_t> &samples, double seconds)
+{
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  std::vector<uint8_t> file;
+  uint8_t buf[4096];
+  size_t got;
+  while ((got = fread(buf, 1, sizeof(buf), f)) > 0) {
+    file.insert(file.end(), buf, buf + got);
+  }
+  fclose(f);
+
+  if (file.size() < 12 || memcmp(&file[0], "RIFF", 4) || memcmp(&file[8], "WAVE", 4)) {
+    fprintf(stderr, "%s: not a WAV file\n", path);
+    return false;
+  }
+
+  uint32_t rate = 0, channels = 0, bits = 0;
+  for (size_t at=12; at + 8 <= file.size(); ) {
+    uint32_t size = le(&file[at + 4], 4);
+    const uint8_t *body = &file[at + 8];
+
+    if (memcmp(&file[at], "fmt ", 4) == 0 && size >= 16) {
+      if (le(body, 2) != 1) {
+        fprintf(stderr, "%s: only PCM WAV files\n", path);
+        return false;
+      }
+      channels = le(body + 2, 2);
+      rate = le(body + 4, 4);
+      bits = le(body + 14, 2);
+    }
+    else if (memcmp(&file[at], "data", 4) == 0 && rate && (bits == 8 || bits == 16)) {
+      uint32_t frameBytes = channels * bits / 8;
+      uint32_t frames = std::min<uint32_t>(size, file.size() - at - 8) / frameBytes;
+      long n = std::min<double>(seconds, frames / (double) rate) * SAMPLE_RATE;
+
+      for (long i=0; i<n; i++) {
+        const uint8_t *p = body + (uint32_t) (i * rate / SAMPLE_RATE) * frameBytes;
+        samples.push_back(bits == 8 ? p[0] : to_adc((int16_t) le(p, 2) / 256.0));
+      }
+      return true;
+    }
+    at += 8 + size + (size & 1);
+  }
+
+  fprintf(stderr, "%s: no 8 or 16 bit PCM data\n", path);
+  return false;
+}
+
+struct result {
+  uint32_t frames, lateMax, missed, samples, overruns;
+  double busy;
+};
+
+static result run(const std::vector<uint8_t> &samples, double seconds, bool audio)
+{
+  heardLevels.clear();
+  loopFrames = 0;
+  lastTicks = 0;
+
+  sim_reset();
+  sim_adc_input(&samples);
+  setup();
+  frame_init(numPrograms - 1);
+  if (!audio) {
+    ADCSRA = 0;
+  }
+  sim_run(loop, seconds * SYSCLOCK);
+
+  return { loopFrames, simT0LateMax, simT0Missed, simAdcSamples, simAdcOverruns,
+           (double) simAdcBusy / simCycles };
+}
+
+/*
+ * Mean level of a band over frames whose time since the last beat (plus
+ * 'offset') is in [from, to) seconds, leaving out the first second while
+ * the gain settles
+ */
+static double band_mean(int band, double offset, double from, double to)
+{
+  double sum = 0;
+  long n = 0;
+
+  for (auto &h : heardLevels) {
+    double since = fmod(h.at + offset, BEAT);
+    if (h.at >= 1 && since >= from && since < to) {
+      sum += h.level[band];
+      n++;
+    }
+  }
+  return n ? sum / n : 0;
+}
+
+int audio_main(int argc, char **argv)
+{
+  const char *wav = nullptr;
+  double seconds = 20;
+  int opt;
+
+  simT0Cycles = 70;
+  simT1Cycles = 60;
+
+  while ((opt = getopt(argc, argv, "f:s:w:i:r:")) != -1) {
+    switch (opt) {
+      case 'f': wav = optarg; break;
+      case 's': seconds = atof(optarg); break;
+      case 'w': simT0Cycles = atoi(optarg); break;
+      case 'i': simT1Cycles = atoi(optarg); break;
+      case 'r': simRng.seed(atoi(optarg)); break;
+      default:
+        fprintf(stderr, "usage: sim-audio audio [-f recording.wav] [-s seconds] [-w pwm clocks] [-i ir clocks] [-r seed]\n");
+        return 2;
+    }
+  }
+
+  std::vector<uint8_t> samples;
+  if (wav) {
+    if (!load_wav(wav, samples, seconds)) {
+      return 2;
+    }
+    seconds = samples.size() / SAMPLE_RATE;
+  }
+  else {
+    made_up(samples, seconds);
+  }
+  sim_watch_portb(watch);
+
+  result base = run(samples, seconds, false);
+  result with = run(samples, seconds, true);
+
+  printf("audio: %.1fs of %s at %.0f samples/s, PWM ISR %u clocks, IR ISR %u, ADC ISR %d\n\n",
+         seconds, wav ? wav : "made up music", SAMPLE_RATE, simT0Cycles, simT1Cycles, AUDIO_ISR_CYCLES);
+  printf("                      baseline   audio\n");
+  printf("  loop frames         %8u  %6u\n", base.frames, with.frames);
+  printf("  PWM ISR latest      %8u  %6u clocks\n", base.lateMax, with.lateMax);
+  printf("  PWM compares lost   %8u  %6u\n", base.missed, with.missed);
+  printf("\n  ADC samples %u, lost %u, ADC ISR %.1f%% of the CPU at %d clocks a sample\n",
+         with.samples, with.overruns, 100 * with.busy, AUDIO_ISR_CYCLES);
+
+  bool bad = with.missed > base.missed || with.lateMax > base.lateMax + AUDIO_ISR_BLOCKED ||
+             with.overruns || with.frames + 1 < base.frames || with.frames > base.frames + 1;
+
+  if (!wav) {
+    double lowKick = band_mean(AUDIO_LOW, 0, 0.02, 0.12), lowBefore = band_mean(AUDIO_LOW, 0, 0.38, 0.48);
+    double highHat = band_mean(AUDIO_HIGH, BEAT / 2, 0, 0.05), highBefore = band_mean(AUDIO_HIGH, BEAT / 2, 0.38, 0.48);
+
+    printf("  low band            %5.1f after a kick, %5.1f before the next\n", lowKick, lowBefore);
+    printf("  high band           %5.1f after a hi-hat, %5.1f before the next\n", highHat, highBefore);
+    bad |= lowKick < 2 * lowBefore + 16 || highHat < 2 * highBefore + 16;
+  }
+
+  return bad ? 1 : 0;
+}
+
+#else
+
+int audio_main(int, char **)
+{
+  fprintf(stderr, "audio: needs the audio build, make sim-audio\n");
+  return 2;
+}
+
+#endif /* HAS_AUDIO */
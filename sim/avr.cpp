@@ -0,0 +1,99 @@
+// Register file and Arduino core functions for the host build
+
+#include <Arduino.h>
+#include <avr/eeprom.h>
+
+#include "sim.h"
+#include "machine.h"
+
+volatile uint8_t SREG;
+volatile uint8_t MCUCR;
+volatile uint8_t MCUSR;
+volatile uint8_t PLLCSR;
+
+volatile uint8_t TCCR0A;
+volatile uint8_t TCCR0B;
+volatile uint8_t TCNT0;
+volatile uint8_t OCR0A;
+volatile uint8_t TIMSK;
+volatile uint8_t TIFR;
+volatile uint8_t TCCR1;
+volatile uint8_t TCNT1;
+
+volatile uint8_t USIDR;
+
+volatile uint8_t UDR0;
+volatile uint8_t UCSR0A;
+volatile uint8_t UCSR0B;
+volatile uint8_t UCSR0C;
+volatile uint8_t UBRR0H;
+volatile uint8_t UBRR0L;
+volatile uint8_t ADMUX;
+volatile uint8_t ADCSRA;
+volatile uint8_t ADCSRB;
+volatile uint8_t ADCH;
+volatile uint8_t DIDR0;
+SimUsicr USICR;
+
+SimPort PORTB = { 0, SIM_PORTB };
+volatile uint8_t DDRB;
+volatile uint8_t PINB;
+SimPort PORTC = { 0, SIM_PORTC };
+volatile uint8_t DDRC;
+SimPort PORTD = { 0, SIM_PORTD };
+volatile uint8_t DDRD;
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  if (mode == OUTPUT) {
+    DDRB |= _BV(pin);
+  }
+  else {
+    DDRB &= ~_BV(pin);
+  }
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+  if (value) {
+    PORTB |= _BV(pin);
+  }
+  else {
+    PORTB &= ~_BV(pin);
+  }
+}
+
+int digitalRead(uint8_t pin)
+{
+  return (PINB >> pin) & 1;
+}
+
+uint8_t simEeprom[E2END + 1];
+uint32_t simEepromWrites[E2END + 1];
+uint32_t simEepromReads;
+
+// avr-libc's eeprom_read_byte(): the call, the EEPE wait, setting EEAR and
+// the 4 clocks the CPU is halted for the read
+#define EEPROM_READ_CYCLES 20
+
+uint8_t eeprom_read_byte(const uint8_t *addr)
+{
+  simEepromReads++;
+  sim_spend(EEPROM_READ_CYCLES);
+  return simEeprom[(uintptr_t) addr];
+}
+
+void eeprom_read_block(void *dest, const void *src, size_t n)
+{
+  for (size_t i=0; i<n; i++) {
+    ((uint8_t *) dest)[i] = eeprom_read_byte((const uint8_t *) src + i);
+  }
+}
+
+void eeprom_update_byte(uint8_t *addr, uint8_t value)
+{
+  if (simEeprom[(uintptr_t) addr] != value) {
+    simEeprom[(uintptr_t) addr] = value;
+    simEepromWrites[(uintptr_t) addr]++;
+  }
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+// The EEPROM as plain memory, with a count of writes to each cell for the
+// wear check. Writes finish at once.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <avr/io.h>
+
+extern uint8_t simEeprom[E2END + 1];
+extern uint32_t simEepromWrites[E2END + 1];    // cell erase/write cycles
+extern uint32_t simEepromReads;                // bytes read
+
+extern uint8_t eeprom_read_byte(const uint8_t *addr);
+extern void eeprom_read_block(void *dest, const void *src, size_t n);
+extern void eeprom_update_byte(uint8_t *addr, uint8_t value);
+
+#define eeprom_is_ready() 1
@@ -0,0 +1,10 @@
+#pragma once
+
+// ISRs become plain functions the simulator calls. The attributes are
+// dropped, so an ISR_NOBLOCK one has to sei() itself under SIM.
+
+#define ISR(vector, ...) extern "C" void vector(void); void vector(void)
+#define ISR_NOBLOCK
+
+#define cli() (SREG &= ~0x80)
+#define sei() (SREG |= 0x80)
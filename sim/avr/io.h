@@ -0,0 +1,134 @@
+#pragma once
+
+// ATtiny85 registers used by the firmware, as plain memory
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+
+extern volatile uint8_t SREG;
+extern volatile uint8_t MCUCR;
+extern volatile uint8_t MCUSR;
+extern volatile uint8_t PLLCSR;
+
+extern volatile uint8_t TCCR0A;
+extern volatile uint8_t TCCR0B;
+extern volatile uint8_t TCNT0;
+extern volatile uint8_t OCR0A;
+extern volatile uint8_t TIMSK;
+extern volatile uint8_t TIFR;
+extern volatile uint8_t TCCR1;
+extern volatile uint8_t TCNT1;
+
+extern volatile uint8_t USIDR;
+
+#define E2END 0x1ff     // last EEPROM address, see avr/eeprom.h
+
+// The ATmega328's USART, for the stream build's host test
+extern volatile uint8_t UDR0;
+extern volatile uint8_t UCSR0A;
+extern volatile uint8_t UCSR0B;
+extern volatile uint8_t UCSR0C;
+extern volatile uint8_t UBRR0H;
+extern volatile uint8_t UBRR0L;
+
+// The ATmega328's ADC, for the audio build's host test
+extern volatile uint8_t ADMUX;
+extern volatile uint8_t ADCSRA;
+extern volatile uint8_t ADCSRB;
+extern volatile uint8_t ADCH;
+extern volatile uint8_t DIDR0;
+
+// Writes to these go through the machine model, see machine.cpp: the USI
+// control register strobes the USI clock, and every port write is seen
+// as it happens, pulses inside an ISR included. Ports C and D are the
+// ATmega328's, for the multi-bridge build's host test.
+extern void sim_usicr(uint8_t value);
+extern void sim_port(uint8_t port, uint8_t was);
+
+#define SIM_PORTB 0
+#define SIM_PORTC 1
+#define SIM_PORTD 2
+
+struct SimUsicr {
+  uint8_t value;
+  operator uint8_t() const { return value; }
+  SimUsicr &operator=(uint8_t v) { value = v; sim_usicr(v); return *this; }
+};
+
+struct SimPort {
+  volatile uint8_t value;
+  uint8_t port;
+  operator uint8_t() const { return value; }
+  SimPort &operator=(uint8_t v) { uint8_t was = value; value = v; sim_port(port, was); return *this; }
+  SimPort &operator|=(uint8_t v) { return *this = value | v; }
+  SimPort &operator&=(uint8_t v) { return *this = value & v; }
+  SimPort &operator^=(uint8_t v) { return *this = value ^ v; }
+};
+
+extern SimUsicr USICR;
+extern SimPort PORTB;
+extern volatile uint8_t DDRB;
+extern volatile uint8_t PINB;
+extern SimPort PORTC;
+extern volatile uint8_t DDRC;
+extern SimPort PORTD;
+extern volatile uint8_t DDRD;
+
+// MCUCR
+#define SM0 3
+#define SM1 4
+#define SE 5
+
+// PLLCSR
+#define PCKE 2
+
+// TCCR0A
+#define WGM01 1
+
+// TCCR0B
+#define CS00 0
+#define CS01 1
+
+// TCCR1
+#define CS10 0
+#define CS11 1
+#define CS12 2
+
+// TIFR
+#define TOV0 1
+
+// USICR
+#define USIWM0 4
+#define USICLK 1
+#define USITC 0
+
+// MCUSR
+#define PORF 0
+#define EXTRF 1
+#define BORF 2
+#define WDRF 3
+
+// UCSR0A, UCSR0B, UCSR0C
+#define U2X0 1
+#define RXEN0 4
+#define RXCIE0 7
+#define UCSZ00 1
+#define UCSZ01 2
+
+// ADMUX, ADCSRA, DIDR0
+#define REFS0 6
+#define ADLAR 5
+#define ADEN 7
+#define ADSC 6
+#define ADATE 5
+#define ADIF 4
+#define ADIE 3
+#define ADPS0 0
+#define ADPS1 1
+#define ADPS2 2
+#define ADC0D 0
+
+// TIMSK
+#define TOIE1 2
+#define OCIE0A 4
@@ -0,0 +1,15 @@
+#pragma once
+
+// Flash and RAM are the same thing on the host
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+
+#define pgm_read_byte(addr) (*(addr))
+#define pgm_read_word(addr) (*(addr))
+#define pgm_read_byte_near(addr) pgm_read_byte(addr)
+#define pgm_read_word_near(addr) pgm_read_word(addr)
+
+#define memcpy_P(dest, src, n) memcpy((dest), (src), (n))
@@ -0,0 +1,11 @@
+#pragma once
+
+#define SLEEP_MODE_IDLE 0
+
+#define set_sleep_mode(mode) (MCUCR = (MCUCR & ~(_BV(SM0) | _BV(SM1))) | (mode))
+#define sleep_enable() (MCUCR |= _BV(SE))
+#define sleep_disable() (MCUCR &= ~_BV(SE))
+
+extern void sim_sleep();
+
+#define sleep_cpu() sim_sleep()
@@ -0,0 +1,10 @@
+#pragma once
+
+// The watchdog never fires in the sim: a reset is something a test does,
+// with sim_power_cycle() and the MCUSR flags it wants
+
+#define WDTO_120MS 3
+
+#define wdt_enable(timeout)
+#define wdt_disable()
+#define wdt_reset()
@@ -0,0 +1,138 @@
+// Effect generator and modulation graph benchmarks
+//
+// Every generator is timed one step at a time so the slow paths (a
+// twinkle sparkling, a candle gusting) show up in the tail rather than
+// being averaged away. Figures are host ticks with the cost of reading the
+// clock taken off; the very top of the distribution is host scheduling
+// noise, so we stop at the 99.99th percentile. They are for spotting regressions between changes,
+// the AVR cycle estimates live in Effect.h. In ./sim-fc the periodic effects that fit play back from
+// the frame cache.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "lights.h"
+#include "Effect.h"
+#include "modgraph.h"
+#include "sim.h"
+
+static const struct {
+  const char *name;
+  uint8_t kind;
+  uint8_t param;
+  int16_t numSteps;
+} cases[] = {
+  { "sine_chase",    FX_SINE_CHASE, 0,   750 },
+  { "twinkle",       FX_TWINKLE,    4,   0 },
+  { "twinkle_dense", FX_TWINKLE,    128, 0 },
+  { "strobe",        FX_STROBE,     3,   1100 },
+  { "breathe",       FX_BREATHE,    11,  0 },
+  { "candle",        FX_CANDLE,     90,  0 },
+  { "chase",         FX_CHASE,      64,  400 },
+};
+
+static uint64_t clock_overhead()
+{
+  uint64_t best = ~0ULL;
+
+  for (int i=0; i<10000; i++) {
+    uint64_t t0 = host_ticks();
+    uint64_t t1 = host_ticks();
+    best = std::min(best, t1 - t0);
+  }
+
+  return best;
+}
+
+static void report(const char *name, std::vector<uint64_t> &t, double perSec)
+{
+  long n = t.size();
+  uint64_t sum = 0;
+
+  for (long i=0; i<n; i++) {
+    sum += t[i];
+  }
+  std::sort(t.begin(), t.end());
+
+  printf("%-14s %10.1f %10llu %10llu %12.0f\n", name,
+         (double) sum / n,
+         (unsigned long long) t[n - n / 100 - 1],
+         (unsigned long long) t[n - n / 10000 - 1],
+         perSec);
+}
+
+int bench_main(int argc, char **argv)
+{
+  long steps = (argc > 1) ? atol(argv[1]) : 1000000;
+  uint64_t overhead = clock_overhead();
+  std::vector<uint64_t> t(steps);
+  volatile uint8_t sink;
+
+  printf("%-14s %10s %10s %10s %12s   (%s per step)\n",
+         "effect", "mean", "p99", "p99.99", "steps/s", host_tick_unit);
+
+  for (auto &c : cases) {
+    Effect fx;
+
+    fx.init(c.kind, 0, c.numSteps, c.param);
+#ifdef HAS_FRAME_CACHE
+    fx.cache();
+    while (frame_cache_render()) {
+    }
+#endif
+
+    for (long i=0; i<steps; i++) {
+      uint64_t t0 = host_ticks();
+      sink = fx.step();
+      uint64_t t1 = host_ticks();
+      t[i] = (t1 - t0 > overhead) ? t1 - t0 - overhead : 0;
+    }
+
+    // Throughput without the clock in the way
+    fx.init(c.kind, 0, c.numSteps, c.param);
+#ifdef HAS_FRAME_CACHE
+    fx.cache();
+#endif
+    auto start = std::chrono::steady_clock::now();
+    for (long i=0; i<steps; i++) {
+      sink = fx.step();
+    }
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+
+    report(c.name, t, steps / secs.count());
+  }
+
+  // One evaluation of a whole patch per frame
+  printf("\n%-14s %10s %10s %10s %12s   (%s per frame)\n",
+         "patch", "mean", "p99", "p99.99", "frames/s", host_tick_unit);
+
+  for (uint8_t p=0; p<numPatches; p++) {
+    char name[16];
+
+    mod_load(p);
+    for (long i=0; i<steps; i++) {
+      uint64_t t0 = host_ticks();
+      mod_eval();
+      uint64_t t1 = host_ticks();
+      t[i] = (t1 - t0 > overhead) ? t1 - t0 - overhead : 0;
+    }
+
+    mod_load(p);
+    auto start = std::chrono::steady_clock::now();
+    for (long i=0; i<steps; i++) {
+      mod_eval();
+    }
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+
+    snprintf(name, sizeof(name), "patch %d", p);
+    report(name, t, steps / secs.count());
+  }
+
+  (void) sink;
+  return 0;
+}
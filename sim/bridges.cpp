@@ -0,0 +1,281 @@
+// H-bridge PWM ISR check and cost, against the number of bridges
+//
+//   sim-mb bridges [-n frames] [-s seed] [-p program]
+//
+// Drives the Timer 0 ISR directly, 256 ticks (one phase of each side) a
+// frame, with frames of random levels and the edge cases: 0, 126, 127,
+// MAX_LEVEL, 255, and outputs at the same level. After every tick the
+// bridge pins are read back from the ports and checked:
+//
+//  - each output is on for level + 1 ticks of its own phase, all 128 from
+//    level 127 up, and never in the other one; output n shows frame[n]
+//  - a bridge's A and B pins are never high together
+//  - with -DBRIDGES, no port is written more than once a tick
+//
+// Past 2 bridges there are more outputs than effect channels, and it
+// also steps the program's frames directly and checks each output's level
+// against an effect of its own, its channel's started as far along as its
+// place in the run puts it (see frame.h), through the same dimmer, as sr
+// does for the shift registers; with an odd number of bridges the runs
+// aren't all the same length.
+//
+// Reported: host cycles per ISR call, the port writes per phase, the most
+// in one call and a rough AVR cost of that call against the PWM_OCR + 1
+// clocks between ticks (the sim doesn't execute AVR code); and the host
+// cost of output_frame(), once a frame.
+//
+// In ./sim this is the two bridge ISR in h-bridge.cpp, for comparison.
+// "make bridges" builds ./sim-mb with BRIDGES of 1, 2, 4 and 8 and runs
+// this in each.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <algorithm>
+
+#include <Arduino.h>
+
+#include "lights.h"
+#include "h-bridge.h"
+#include "frame.h"
+#include "dimmer.h"
+#include "programs.h"
+#include "sim.h"
+#include "irwave.h"
+#include "machine.h"
+
+#ifdef HAS_HBRIDGE
+
+extern "C" void TIMER0_COMPA_vect(void);
+
+extern volatile uint8_t running;
+extern void setup();
+
+#ifdef HAS_MULTI_BRIDGE
+# define NUM_BRIDGES BRIDGES
+#else
+# define NUM_BRIDGES 2
+#endif
+#define BRIDGE_OUTPUTS (NUM_BRIDGES * 2)
+
+// Nominal ISR cost in clocks: entry, the tick and phase bookkeeping and
+// exit, then an IN, AND, OR and OUT plus the image load per port written
+#define ISR_CLOCKS 60
+#define ISR_CLOCKS_PER_WRITE 6
+
+#define SPREAD_FRAMES 3000
+
+// Each output's pin, as in the table in h-bridge.h: the bridges' A sides
+// then their B sides
+struct pin {
+  SimPort *port;
+  uint8_t mask;
+};
+
+static const pin outputPin[16] = {
+  { &PORTB, _BV(4) }, { &PORTB, _BV(2) }, { &PORTD, _BV(7) }, { &PORTD, _BV(5) },
+  { &PORTD, _BV(3) }, { &PORTC, _BV(0) }, { &PORTC, _BV(2) }, { &PORTC, _BV(4) },
+  { &PORTB, _BV(3) }, { &PORTB, _BV(1) }, { &PORTD, _BV(6) }, { &PORTD, _BV(4) },
+  { &PORTD, _BV(2) }, { &PORTC, _BV(1) }, { &PORTC, _BV(3) }, { &PORTC, _BV(5) }
+};
+
+static inline const pin &output_pin(int o)
+{
+  return o < NUM_BRIDGES ? outputPin[o] : outputPin[8 + o - NUM_BRIDGES];
+}
+
+static uint8_t random_level()
+{
+  static const uint8_t edges[] = { 0, 1, 126, 127, MAX_LEVEL, 255 };
+
+  if (uniform(0, 3) == 0) {
+    return edges[uniform(0, sizeof(edges) - 1)];
+  }
+  return uniform(0, MAX_LEVEL);
+}
+
+#if NUM_OUTPUTS > NUM_CHANNELS
+// The first output of channel c's run
+static int run_start(int c)
+{
+  return (c * NUM_OUTPUTS + NUM_CHANNELS - 1) / NUM_CHANNELS;
+}
+
+/*
+ * Program prog's frames, from its first step, against an effect per
+ * output. Returns the frames that differ; spread counts the outputs that
+ * ever showed something other than the first in their run.
+ */
+static uint32_t check_spread(int prog, int &spread)
+{
+  Effect channel[NUM_CHANNELS], output[NUM_OUTPUTS];
+  uint8_t want[NUM_OUTPUTS];
+  bool differs[NUM_OUTPUTS] = { false };
+  uint32_t wrong = 0;
+
+  frame_init(prog);
+  program_load(channel, prog);
+
+  for (int o=0; o<NUM_OUTPUTS; o++) {
+    int c = spread_channel(o, NUM_OUTPUTS, NUM_CHANNELS);
+    int k = o - run_start(c), copies = run_start(c + 1) - run_start(c);
+    int spacing = channel[(c + 1) % NUM_CHANNELS].stepsAhead(channel[c]);
+
+    output[o] = channel[c];
+    for (int a = k * spacing / copies; a; a--) {
+      output[o].step();
+    }
+  }
+
+  for (int f=0; f<SPREAD_FRAMES; f++) {
+    frame_next();
+    for (int o=0; o<NUM_OUTPUTS; o++) {
+      want[o] = output[o].step();
+    }
+    dimmer_apply(want);
+
+    if (memcmp(want, frame, NUM_OUTPUTS) && wrong++ < 5) {
+      for (int o=0; o<NUM_OUTPUTS; o++) {
+        if (want[o] != frame[o]) {
+          printf("  frame %d output %d: %d, its effect %d\n", f, o, frame[o], want[o]);
+          break;
+        }
+      }
+    }
+    for (int o=0; o<NUM_OUTPUTS; o++) {
+      int first = run_start(spread_channel(o, NUM_OUTPUTS, NUM_CHANNELS));
+      differs[o] = differs[o] || frame[o] != frame[first];
+    }
+  }
+
+  spread = std::count(differs, differs + NUM_OUTPUTS, true);
+  return wrong;
+}
+#endif
+
+int bridges_main(int argc, char **argv)
+{
+  long frames = 20000;
+  int prog = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:s:p:")) != -1) {
+    switch (opt) {
+      case 'n': frames = atol(optarg); break;
+      case 's': simRng.seed(atoi(optarg)); break;
+      case 'p': prog = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: sim bridges [-n frames] [-s seed] [-p program]\n");
+        return 2;
+    }
+  }
+
+  sim_reset();
+  init_hbridge();
+  running = 1;
+
+  uint32_t wrong = 0, shorted = 0, rewrites = 0;
+  uint64_t isrTicks = 0, frameTicks = 0, writes = 0;
+  uint32_t widestWrites = 0;
+  uint8_t levels[NUM_OUTPUTS];
+
+  for (long f=0; f<frames; f++) {
+    for (int o=0; o<NUM_OUTPUTS; o++) {
+      levels[o] = random_level();
+    }
+    if (uniform(0, 3) == 0) {
+      levels[uniform(0, NUM_OUTPUTS - 1)] = levels[0];
+    }
+
+    uint64_t t0 = host_ticks();
+    output_frame(levels);
+    frameTicks += host_ticks() - t0;
+
+    // Both phases, A sides and B sides, from this frame
+    uint16_t on[BRIDGE_OUTPUTS] = { 0 };
+    for (int t=0; t<256; t++) {
+      uint32_t before[3] = { simPortWrites[0], simPortWrites[1], simPortWrites[2] };
+
+      uint64_t i0 = host_ticks();
+      TIMER0_COMPA_vect();
+      isrTicks += host_ticks() - i0;
+
+      uint32_t n = 0;
+      for (int p=0; p<3; p++) {
+        uint32_t w = simPortWrites[p] - before[p];
+        n += w;
+        if (w > 1) {
+          rewrites++;
+        }
+      }
+      writes += n;
+      widestWrites = std::max(widestWrites, n);
+
+      for (int o=0; o<BRIDGE_OUTPUTS; o++) {
+        const pin &p = output_pin(o);
+        if (*p.port & p.mask) {
+          on[o]++;
+        }
+      }
+      for (int b=0; b<NUM_BRIDGES; b++) {
+        const pin &a = output_pin(b), &z = output_pin(b + NUM_BRIDGES);
+        if ((*a.port & a.mask) && (*z.port & z.mask) && shorted++ < 5) {
+          printf("  frame %ld tick %d: bridge %d has A and B high\n", f, t, b + 1);
+        }
+      }
+    }
+
+    for (int o=0; o<BRIDGE_OUTPUTS; o++) {
+      uint8_t level = levels[o];
+      uint16_t want = level >= 127 ? 128 : level + 1;
+      if (on[o] != want && wrong++ < 5) {
+        printf("  frame %ld output %d: on %u ticks, level %d wants %u\n", f, o, on[o], level, want);
+      }
+    }
+  }
+
+  uint64_t isrs = frames * 256ULL;
+  uint32_t avr = ISR_CLOCKS + widestWrites * ISR_CLOCKS_PER_WRITE;
+
+  printf("bridges: %d bridges, %d outputs, %ld frames\n\n", NUM_BRIDGES, BRIDGE_OUTPUTS, frames);
+  printf("  outputs off level  %u\n", wrong);
+  printf("  A and B both high  %u\n", shorted);
+#ifdef HAS_MULTI_BRIDGE
+  printf("  ports written twice %u\n", rewrites);
+#endif
+  printf("  ISR                %.1f %s a call\n", (double) isrTicks / isrs, host_tick_unit);
+  printf("  port writes        %.1f a phase, %u in one call\n", writes / (frames * 2.0), widestWrites);
+  printf("  ISR estimate       %u clocks widest, %d between ticks\n", avr, PWM_OCR + 1);
+  printf("  output_frame()     %.1f %s a call\n", (double) frameTicks / frames, host_tick_unit);
+
+  bool bad = wrong || shorted || avr > PWM_OCR + 1;
+#if NUM_OUTPUTS > NUM_CHANNELS
+  int spread;
+  sim_reset();
+  setup();
+  uint32_t unspread = check_spread(prog, spread);
+
+  printf("  off their effect   %u frames of %d, program %d\n", unspread, SPREAD_FRAMES, prog);
+  printf("  spread             %d of %d outputs away from the first in their run\n",
+         spread, NUM_OUTPUTS - NUM_CHANNELS);
+  bad = bad || unspread;
+#else
+  (void) prog;
+#endif
+#ifdef HAS_MULTI_BRIDGE
+  bad = bad || rewrites;
+#endif
+  printf("\n%s\n", bad ? "FAILED" : "ok");
+  return bad ? 1 : 0;
+}
+
+#else
+
+int bridges_main(int, char **)
+{
+  fprintf(stderr, "bridges: this build has no H-bridges\n");
+  return 2;
+}
+
+#endif /* HAS_HBRIDGE */
@@ -0,0 +1,77 @@
+// Frame cache against the generators
+//
+//   sim cache [-n frames] [-s seed]
+//
+// Runs the frame pipeline (effects, modulation graph, crossfades) for n
+// frames, changing program at random every 50 to 2000 frames, so some
+// changes land in the middle of a crossfade and some load a program whose
+// cycle takes the cache from the one fading out. Prints a hash of every
+// frame's levels, and the host time per frame.
+//
+// "make cache" runs it in ./sim, which runs the generators every step, and
+// in ./sim-fc, built with -DFRAME_CACHE, and checks the two hashes are the
+// same: the cache must never show a level the generators wouldn't have.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <Arduino.h>
+
+#include "lights.h"
+#include "frame.h"
+#include "dimmer.h"
+#include "programs.h"
+#include "sim.h"
+#include "irwave.h"
+
+int cache_main(int argc, char **argv)
+{
+  long frames = 200000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+    switch (opt) {
+      case 'n': frames = atol(optarg); break;
+      case 's': simRng.seed(atoi(optarg)); break;
+      default:
+        fprintf(stderr, "usage: sim cache [-n frames] [-s seed]\n");
+        return 2;
+    }
+  }
+
+  frame_init(0);
+  dimmer_init();
+
+  uint32_t hash = 2166136261u;    // FNV-1a
+  uint64_t ticks = 0;
+  long next = uniform(50, 2000);
+  int changes = 0;
+
+  for (long f=0; f<frames; f++) {
+    if (f == next) {
+      frame_select(uniform(0, numPrograms - 1));
+      next += uniform(50, 2000);
+      changes++;
+    }
+
+    uint64_t t0 = host_ticks();
+    frame_next();
+    ticks += host_ticks() - t0;
+
+    for (uint8_t i=0; i<NUM_CHANNELS; i++) {
+      hash = (hash ^ frame[i]) * 16777619u;
+    }
+  }
+
+#ifdef HAS_FRAME_CACHE
+  const char *build = "frame cache";
+#else
+  const char *build = "generators";
+#endif
+  printf("cache: %08x\n", hash);
+  printf("  %ld frames, %d program changes, %s, %.1f %s per frame\n", frames, changes, build,
+         (double) ticks / frames, host_tick_unit);
+
+  return 0;
+}
@@ -0,0 +1,244 @@
+// End to end IR latency: remote waveform in, PORTB out
+//
+//   sim e2e [-p nec|rc5|sony] [-n presses] [-r repeats] [-l lag] [-j jitter]
+//           [-g glitches] [-d dropout%] [-i isr latency] [-m max drop%] [-s seed]
+//
+// Runs the real setup() and loop() on the timer model in machine.cpp, with
+// IR_PIN driven by remote frames put through the receiver model. The
+// Timer 1 ISR samples the pin, loop() decodes and dispatches, and the PWM
+// ISR drives PORTB, all at their true timings.
+//
+// First OFF and ON are pressed alternately, at random offsets to the frame
+// loop. Latency is from the first edge the remote sends to the change on
+// the channel pins: for ON the first PWM edge, for OFF the last one (so to
+// within one PWM tick if the pins happened to be low already). Then UP is
+// held for a frame and a stream of repeats, and every frame decode() didn't
+// return as NEC counts as dropped, as does any the ISR threw away as noise.
+// The glitches its filter took out are counted too.
+//
+// The firmware only decodes NEC, so with -p rc5 or -p sony everything
+// should be missed. That is the check that other remotes in the room do
+// nothing.
+//
+// With -m it's a pass or fail check too: it fails if more than that
+// percentage of the held key's frames were dropped.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "lights.h"
+#include "remote.h"
+#include "sim.h"
+#include "irwave.h"
+#include "machine.h"
+
+extern void setup();
+extern void loop();
+
+#define CHANNEL_MASK (CHANNEL1_PIN_A_MASK | CHANNEL1_PIN_B_MASK | CHANNEL2_PIN_A_MASK | CHANNEL2_PIN_B_MASK)
+
+#define USEC(us) ((uint64_t) (us) * SIM_CYCLES_PER_USEC)
+#define MSEC(ms) USEC((ms) * 1000ULL)
+
+struct protocol {
+  const char *name;
+  void (*frame)(std::vector<int> &p, uint32_t value);
+  bool necRepeats;      // held keys send repeat codes rather than the frame
+  long period;          // us between frames while a key is held
+  uint32_t on, off, up;
+};
+
+static const protocol protocols[] = {
+  { "nec", nec_bits, true, NEC_REPEAT_PERIOD, BTN_ON, BTN_OFF, BTN_UP },
+  // RC5 address 0, power/channel/volume commands, toggle bit clear
+  { "rc5", rc5_bits, false, 113778, 0x3000 | 32, 0x3000 | 33, 0x3000 | 16 },
+  // Sony 12 bit, TV: command in the low 7 bits, address 1 above it
+  { "sony", sony_bits, false, 45000, 0x80 | 21, 0x80 | 46, 0x80 | 18 },
+};
+
+struct press {
+  uint64_t at;          // first edge from the remote
+  bool on;
+};
+
+static std::vector<uint64_t> edges;
+static std::vector<std::pair<uint64_t, uint8_t>> changes;
+
+static void record(uint8_t portb)
+{
+  uint8_t pins = portb & CHANNEL_MASK;
+  if (changes.empty() || changes.back().second != pins) {
+    changes.push_back({ simCycles, pins });
+  }
+}
+
+static void send(const std::vector<int> &pulses, const receiver &rx, uint64_t at)
+{
+  std::vector<long> us = ir_edges(pulses, rx, 0);
+  for (long e : us) {
+    edges.push_back(at + USEC(e));
+  }
+}
+
+struct latency {
+  int n = 0;
+  int missed = 0;
+  double sum = 0, lo = 1e9, hi = 0;
+
+  void add(double ms)
+  {
+    n++;
+    sum += ms;
+    lo = std::min(lo, ms);
+    hi = std::max(hi, ms);
+  }
+
+  void print(const char *label)
+  {
+    if (n) {
+      printf("  %-4s %5d %6d  %7.2f %7.2f %7.2f\n", label, n + missed, missed, lo, sum / n, hi);
+    }
+    else {
+      printf("  %-4s %5d %6d        -       -       -\n", label, missed, missed);
+    }
+  }
+};
+
+int e2e_main(int argc, char **argv)
+{
+  const protocol *proto = &protocols[0];
+  int presses = 20;
+  int repeats = 50;
+  receiver rx = { 60, 40, 0, 0 };
+  double maxDrop = -1;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "p:n:r:l:j:g:d:i:m:s:")) != -1) {
+    switch (opt) {
+      case 'p':
+        proto = nullptr;
+        for (auto &p : protocols) {
+          if (strcmp(optarg, p.name) == 0) {
+            proto = &p;
+          }
+        }
+        if (!proto) {
+          fprintf(stderr, "e2e: unknown protocol %s\n", optarg);
+          return 2;
+        }
+        break;
+      case 'n': presses = atoi(optarg); break;
+      case 'r': repeats = atoi(optarg); break;
+      case 'l': rx.lag = atoi(optarg); break;
+      case 'j': rx.jitter = atoi(optarg); break;
+      case 'g': rx.glitches = atoi(optarg); break;
+      case 'd': rx.dropout = atoi(optarg); break;
+      case 'i': simIsrLatency = atoi(optarg); break;
+      case 'm': maxDrop = atof(optarg); break;
+      case 's': simRng.seed(atoi(optarg)); break;
+      default:
+        fprintf(stderr, "usage: sim e2e [-p nec|rc5|sony] [-n presses] [-r repeats] [-l lag] "
+                        "[-j jitter] [-g glitches] [-d dropout%%] [-i isr latency] [-m max drop%%] [-s seed]\n");
+        return 2;
+    }
+  }
+
+  // The script: alternate OFF and ON (the lights start on), then hold UP
+  std::vector<press> script;
+  std::vector<int> p;
+  uint64_t t = MSEC(200);
+
+  for (int i=0; i<presses; i++) {
+    bool on = i & 1;
+    p.clear();
+    proto->frame(p, on ? proto->on : proto->off);
+    send(p, rx, t);
+    script.push_back({ t, on });
+    t += MSEC(400) + USEC(uniform(0, 100000));
+  }
+
+  const uint64_t holdAt = t;
+  p.clear();
+  proto->frame(p, proto->up);
+  send(p, rx, t);
+  for (int i=0; i<repeats; i++) {
+    t += USEC(proto->period);
+    if (proto->necRepeats) {
+      p.clear();
+      nec_repeat(p);
+    }
+    send(p, rx, t);
+  }
+  const uint64_t end = t + MSEC(300);
+
+  // Run the firmware over it
+  sim_reset();
+  setup();
+  sim_ir_input(&edges);
+  sim_watch_portb(record);
+
+  if (!sim_run(loop, holdAt)) {
+    fprintf(stderr, "e2e: firmware asleep with no wake up source at %.3fs\n", simCycles / 1e6 / SIM_CYCLES_PER_USEC);
+    return 1;
+  }
+  irstats_t before = irstats;
+  uint16_t glitchesBefore = irparams.glitches, noiseBefore = irparams.noise;
+  sim_run(loop, end);
+
+  // Key to PORTB latency
+  latency on, off;
+  for (size_t i=0; i<script.size(); i++) {
+    const uint64_t from = script[i].at;
+    const uint64_t to = (i + 1 < script.size()) ? script[i + 1].at : holdAt;
+    auto first = std::lower_bound(changes.begin(), changes.end(), std::make_pair(from, (uint8_t) 0));
+    auto last = std::lower_bound(changes.begin(), changes.end(), std::make_pair(to, (uint8_t) 0));
+
+    if (script[i].on) {
+      // Only counts if the lights were off, not still running from a
+      // missed OFF
+      bool wasOff = first == changes.begin() || (first - 1)->first + MSEC(50) < from;
+      if (wasOff && first != last) {
+        on.add((first->first - from) / 1e3 / SIM_CYCLES_PER_USEC);
+      }
+      else {
+        on.missed++;
+      }
+    }
+    else {
+      // Off means the pins went low and stayed low for the rest of the window
+      auto stop = last - 1;
+      if (first != last && stop->second == 0 && stop->first + MSEC(50) < to) {
+        off.add((stop->first - from) / 1e3 / SIM_CYCLES_PER_USEC);
+      }
+      else {
+        off.missed++;
+      }
+    }
+  }
+
+  printf("e2e: %s, lag %dus, jitter %dus, %d glitches, %d%% dropouts, ISR latency %d cycles\n\n",
+         proto->name, rx.lag, rx.jitter, rx.glitches, rx.dropout, simIsrLatency);
+  printf("  key to PORTB  missed      min    mean     max (ms)\n");
+  off.print("OFF");
+  on.print("ON");
+
+  int sent = repeats + 1;
+  int decoded = (uint16_t) (irstats.decoded - before.decoded);
+  int failed = (uint16_t) (irstats.failed - before.failed);
+  int noise = (uint16_t) (irparams.noise - noiseBefore);
+  printf("\n  held UP: %d frames sent, %d decoded, %d failed, %d thrown away as noise, %d not seen, drop rate %.1f%%\n",
+         sent, decoded, failed, noise, std::max(0, sent - decoded - failed - noise), 100.0 * (sent - decoded) / sent);
+  printf("  glitches filtered: %u\n", (uint16_t) (irparams.glitches - glitchesBefore));
+
+  if (maxDrop >= 0 && 100.0 * (sent - decoded) / sent > maxDrop) {
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,377 @@
+// IR decoder regression and benchmarks
+//
+//   sim ir [-n count] [-c corpus.txt]
+//       Replays a corpus of rawbuf captures through decode() for a range of
+//       TOLERANCE and MARK_EXCESS settings and reports how many decode as
+//       expected, then times decode() per frame at the firmware defaults.
+//       Fails if a frame whose header mark is too long for a byte of
+//       rawbuf, 13 to 30ms, decodes at the firmware defaults: it's stored
+//       as IR_RAW_LONG, which no window may take.
+//
+//   sim irfuzz [iterations]
+//       Feeds random interval streams to decodeNEC() and random pin levels
+//       to the Timer 1 ISR. Build with "make fuzz" so AddressSanitizer
+//       catches any read past the end of the capture.
+//
+// The built in corpus is synthetic: frames from several remote protocols,
+// put through a model of the receiver (sensor lag, edge jitter, short
+// glitches), then through the firmware's ir_sample() tick by tick, and what
+// it leaves in rawbuf is what decode() gets. A change to irsample.h shows
+// up here. There are no hardware captures in the tree; ones taken on a
+// board (the raw data dump_ir() prints, with the gap first) can be added
+// with -c, one per line, and go straight to decode():
+//
+//   <label> <expected: NEC value in hex, REPEAT or NONE> <ticks...>
+//
+// With TOLERANCE a variable, the host decode times include the floating
+// point range checks the AVR build folds into constants.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "lights.h"
+#include "remote.h"
+#include "sim.h"
+#include "irwave.h"
+#include "irsample.h"
+
+extern long decodeNEC(decode_results_t *results);
+
+int irTolerance = TOLERANCE_DEFAULT;
+int irMarkExcess = MARK_EXCESS_DEFAULT;
+
+#define EXPECT_NONE 0x100000000LL
+#define EXPECT_REPEAT ((long long) REPEAT)
+
+struct capture {
+  std::string label;      // category, for the report
+  long long expect;       // NEC value, EXPECT_REPEAT or EXPECT_NONE
+  std::vector<unsigned int> ticks;
+};
+
+/*
+ * Turn a pulse train into what the ISR records: the receiver's edges on
+ * IR_PIN, and ir_sample() run on them every USEC_PER_TICK from a random
+ * phase, until it stops on the gap after the frame. Its glitch filter and
+ * noise rejection are the firmware's own, so a frame it throws away comes
+ * out empty and decodes as nothing.
+ */
+static std::vector<unsigned int> sample(const std::vector<int> &pulses, const receiver &rx)
+{
+  std::vector<long> edges = ir_edges(pulses, rx, 20000 + uniform(0, 50000));
+  std::vector<unsigned int> out;
+
+  // Idle, after a gap longer than any frame
+  irparams.rcvstate = STATE_IDLE;
+  irparams.rawlen = 0;
+  irparams.timer = 0xffff;
+  irparams.level = SPACE;
+  irparams.pending = 0;
+  PINB |= _BV(IR_PIN);
+
+  const long end = edges.back() + 2 * _GAP;
+  size_t next = 0;
+  for (double t = uniform(0, 999) * USEC_PER_TICK / 1000; t < end; t += USEC_PER_TICK) {
+    while (next < edges.size() && edges[next] <= t) {
+      next++;
+    }
+    // Even edges start a mark, and the detector is active low
+    if (next & 1) {
+      PINB &= ~_BV(IR_PIN);
+    }
+    else {
+      PINB |= _BV(IR_PIN);
+    }
+
+    ir_sample();
+
+    if (irparams.rcvstate == STATE_STOP) {
+      if (irparams.rawlen >= IR_MIN_RAWLEN) {
+        out.assign(irparams.rawbuf, irparams.rawbuf + irparams.rawlen);
+      }
+      break;
+    }
+  }
+
+  irparams.rcvstate = STATE_IDLE;
+  irparams.rawlen = 0;
+  return out;
+}
+
+static void build_corpus(std::vector<capture> &corpus, int count)
+{
+  static const uint32_t necCodes[] = {
+    BTN_ON, BTN_OFF, BTN_UP, BTN_DOWN, BTN_NEXT, BTN_0, BTN_4, BTN_ON_ALT, BTN_OFF_ALT
+  };
+  const receiver clean = { 60, 10, 0, 0 };
+  const receiver jittered = { 60, 70, 0, 0 };
+  const receiver laggy = { 160, 40, 0, 0 };
+  const receiver noisy = { 60, 10, 2, 0 };
+
+  for (int n=0; n<count; n++) {
+    uint32_t code = necCodes[n % (sizeof(necCodes) / sizeof(necCodes[0]))];
+    std::vector<int> p;
+
+    nec_bits(p, code);
+    corpus.push_back({ "nec clean", code, sample(p, clean) });
+    corpus.push_back({ "nec jitter", code, sample(p, jittered) });
+    corpus.push_back({ "nec lag", code, sample(p, laggy) });
+    corpus.push_back({ "nec noisy", code, sample(p, noisy) });
+
+    capture cut = { "nec truncated", EXPECT_NONE, sample(p, clean) };
+    if (cut.ticks.size() > 2) {
+      cut.ticks.resize(uniform(2, cut.ticks.size() - 1));
+    }
+    corpus.push_back(cut);
+
+    p[0] = uniform(13000, 30000);
+    corpus.push_back({ "nec long hdr", EXPECT_NONE, sample(p, clean) });
+
+    p.clear();
+    nec_repeat(p);
+    corpus.push_back({ "nec repeat", EXPECT_REPEAT, sample(p, jittered) });
+
+    uint32_t other = simRng();
+    p.clear();
+    samsung_bits(p, other);
+    corpus.push_back({ "samsung", EXPECT_NONE, sample(p, jittered) });
+    p.clear();
+    sony_bits(p, other & 0xfff);
+    corpus.push_back({ "sony", EXPECT_NONE, sample(p, jittered) });
+    p.clear();
+    rc5_bits(p, 0x3000 | (other & 0x7ff));
+    corpus.push_back({ "rc5", EXPECT_NONE, sample(p, jittered) });
+  }
+}
+
+static bool load_corpus(std::vector<capture> &corpus, const char *path)
+{
+  FILE *f = fopen(path, "r");
+  char line[2048];
+
+  if (!f) {
+    perror(path);
+    return false;
+  }
+
+  while (fgets(line, sizeof(line), f)) {
+    char *label = strtok(line, " \t\n");
+    char *expect = strtok(nullptr, " \t\n");
+    if (!label || label[0] == '#' || !expect) {
+      continue;
+    }
+
+    capture c;
+    c.label = std::string("file ") + label;
+    if (strcmp(expect, "REPEAT") == 0) {
+      c.expect = EXPECT_REPEAT;
+    }
+    else if (strcmp(expect, "NONE") == 0) {
+      c.expect = EXPECT_NONE;
+    }
+    else {
+      c.expect = strtoll(expect, nullptr, 16);
+    }
+    for (char *v; (v = strtok(nullptr, " \t\n,")) && c.ticks.size() < RAWBUF; ) {
+      c.ticks.push_back(atoi(v));
+    }
+    corpus.push_back(c);
+  }
+
+  fclose(f);
+  return true;
+}
+
+/*
+ * Run one capture through decode() the way loop() does. Returns the NEC
+ * value, EXPECT_REPEAT, or EXPECT_NONE if it didn't decode as NEC.
+ */
+static long long replay(const capture &c)
+{
+  decode_results_t results;
+  long long got = EXPECT_NONE;
+
+  for (size_t i=0; i<c.ticks.size(); i++) {
+    irparams.rawbuf[i] = ir_raw_pack(c.ticks[i]);
+  }
+  irparams.rawlen = c.ticks.size();
+  irparams.rcvstate = STATE_STOP;
+
+  if (decode(&results) == DECODED && results.decode_type == NEC) {
+    got = (results.value == REPEAT) ? EXPECT_REPEAT : (long long) results.value;
+  }
+
+  irparams.rcvstate = STATE_IDLE;
+  irparams.rawlen = 0;
+  return got;
+}
+
+int ir_main(int argc, char **argv)
+{
+  int count = 200;
+  std::vector<capture> corpus;
+  std::vector<std::string> labels;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:c:")) != -1) {
+    switch (opt) {
+      case 'n': count = atoi(optarg); break;
+      case 'c':
+        if (!load_corpus(corpus, optarg)) {
+          return 1;
+        }
+        break;
+      default:
+        fprintf(stderr, "usage: sim ir [-n count] [-c corpus.txt]\n");
+        return 2;
+    }
+  }
+
+  build_corpus(corpus, count);
+  for (auto &c : corpus) {
+    if (std::find(labels.begin(), labels.end(), c.label) == labels.end()) {
+      labels.push_back(c.label);
+    }
+  }
+
+  printf("%zu captures. %% decoded as expected (wrong NEC values in brackets)\n\n", corpus.size());
+  printf("tol excess ");
+  for (auto &l : labels) {
+    printf(" %16s", l.c_str());
+  }
+  printf("\n");
+
+  static const int excesses[] = { 0, 50, 100 };
+  for (int tol = 10; tol <= 60; tol += 10) {
+    for (int excess : excesses) {
+      irTolerance = tol;
+      irMarkExcess = excess;
+      printf("%3d %6d ", tol, excess);
+
+      for (auto &l : labels) {
+        int total = 0, good = 0, wrong = 0;
+        for (auto &c : corpus) {
+          if (c.label != l) {
+            continue;
+          }
+          long long got = replay(c);
+          total++;
+          if (got == c.expect) {
+            good++;
+          }
+          else if (got != EXPECT_NONE) {
+            wrong++;
+          }
+        }
+        printf("     %5.1f%% (%3d)", 100.0 * good / total, wrong);
+      }
+      printf("%s\n", (tol == TOLERANCE_DEFAULT && excess == MARK_EXCESS_DEFAULT) ? "  <- firmware" : "");
+    }
+  }
+
+  // Decode cost per frame at the firmware settings
+  irTolerance = TOLERANCE_DEFAULT;
+  irMarkExcess = MARK_EXCESS_DEFAULT;
+
+  int longHeaders = 0, longDecoded = 0;
+  for (auto &c : corpus) {
+    if (c.label == "nec long hdr") {
+      longHeaders++;
+      longDecoded += replay(c) != EXPECT_NONE;
+    }
+  }
+  printf("\ndecode() time per frame, %s\n", host_tick_unit);
+  for (auto &l : labels) {
+    uint64_t sum = 0, worst = 0;
+    int n = 0;
+    for (int pass=0; pass<20; pass++) {
+      for (auto &c : corpus) {
+        if (c.label != l) {
+          continue;
+        }
+        uint64_t t0 = host_ticks();
+        replay(c);
+        uint64_t t = host_ticks() - t0;
+        sum += t;
+        worst = std::max(worst, t);
+        n++;
+      }
+    }
+    printf("  %-16s mean %8.1f  max %8llu\n", l.c_str(), (double) sum / n, (unsigned long long) worst);
+  }
+
+  printf("\nheader marks of 13 to 30ms decoded: %d of %d\n", longDecoded, longHeaders);
+  if (longDecoded) {
+    printf("FAILED\n");
+    return 1;
+  }
+  return 0;
+}
+
+int irfuzz_main(int argc, char **argv)
+{
+  long iterations = (argc > 1) ? atol(argv[1]) : 100000;
+  static const unsigned int plausible[] = { 1, 10, 11, 12, 32, 34, 45, 90, 180, 200, 255, 1000 };
+
+  // decodeNEC() on captures held in exactly sized heap buffers
+  for (long it=0; it<iterations; it++) {
+    int len = uniform(0, RAWBUF);
+    uint8_t *buf = (uint8_t *) malloc(len ? len : 1);
+    decode_results_t results;
+
+    for (int i=0; i<len; i++) {
+      buf[i] = ir_raw_pack(uniform(0, 3) ? plausible[uniform(0, 11)] + uniform(-2, 2) : simRng());
+    }
+    // Mostly well formed headers, so the bit loop gets exercised
+    if (len > 2 && uniform(0, 1)) {
+      buf[1] = 180;
+      buf[2] = uniform(0, 1) ? 90 : 45;
+    }
+
+    results.rawbuf = buf;
+    results.rawlen = len;
+    irparams.rawlen = len;
+    decodeNEC(&results);
+    free(buf);
+  }
+
+  // The ISR's sampling against random pin levels, checking it never
+  // overruns rawbuf
+  irparams.rcvstate = STATE_IDLE;
+  irparams.rawlen = 0;
+  irparams.timer = 0;
+  PINB |= _BV(IR_PIN);
+  long frames = 0;
+  int run = 0;
+  for (long it=0; it<iterations * 10; it++) {
+    if (--run <= 0) {
+      // Runs of plausible lengths, with the odd gap long enough to stop
+      PINB ^= _BV(IR_PIN);
+      run = uniform(0, 15) ? plausible[uniform(0, 9)] + uniform(-2, 2) : uniform(100, 400);
+    }
+    ir_sample();
+
+    if (irparams.rawlen > RAWBUF) {
+      fprintf(stderr, "irfuzz: rawlen %d after %ld ticks\n", irparams.rawlen, it);
+      return 1;
+    }
+    if (irparams.rcvstate == STATE_STOP) {
+      decode_results_t results;
+      decode(&results);
+      irparams.rcvstate = STATE_IDLE;
+      irparams.rawlen = 0;
+      frames++;
+    }
+  }
+
+  printf("irfuzz: %ld decodeNEC() calls, %ld ISR ticks, %ld frames, no faults\n",
+         iterations, iterations * 10, frames);
+  return 0;
+}
@@ -0,0 +1,133 @@
+// IR remote waveforms and receiver model, see irwave.h
+
+#include <algorithm>
+
+#include <Arduino.h>
+
+#include "lights.h"
+#include "irwave.h"
+
+std::mt19937 simRng(1234);
+
+int uniform(int lo, int hi)
+{
+  return std::uniform_int_distribution<int>(lo, hi)(simRng);
+}
+
+void nec_bits(std::vector<int> &p, uint32_t value)
+{
+  p.push_back(NEC_HDR_MARK);
+  p.push_back(NEC_HDR_SPACE);
+  for (int bit = 31; bit >= 0; bit--) {
+    p.push_back(NEC_BIT_MARK);
+    p.push_back((value >> bit) & 1 ? NEC_ONE_SPACE : NEC_ZERO_SPACE);
+  }
+  p.push_back(NEC_BIT_MARK);
+}
+
+void nec_repeat(std::vector<int> &p)
+{
+  p.push_back(NEC_HDR_MARK);
+  p.push_back(NEC_RPT_SPACE);
+  p.push_back(NEC_BIT_MARK);
+}
+
+void samsung_bits(std::vector<int> &p, uint32_t value)
+{
+  p.push_back(4500);
+  p.push_back(4500);
+  for (int bit = 31; bit >= 0; bit--) {
+    p.push_back(560);
+    p.push_back((value >> bit) & 1 ? 1690 : 560);
+  }
+  p.push_back(560);
+}
+
+void sony_bits(std::vector<int> &p, uint32_t value)
+{
+  // Header mark, then a 600us space before each bit's mark
+  p.push_back(2400);
+  for (int bit = 0; bit < 12; bit++) {
+    p.push_back(600);
+    p.push_back((value >> bit) & 1 ? 1200 : 600);
+  }
+}
+
+void rc5_bits(std::vector<int> &p, uint32_t value)
+{
+  // Manchester coded, 889us half bits. A 1 is space then mark.
+  std::vector<int> half;
+  for (int bit = 13; bit >= 0; bit--) {
+    int one = (value >> bit) & 1;
+    half.push_back(!one);
+    half.push_back(one);
+  }
+
+  // Drop the leading space and merge equal neighbours
+  size_t i = 0;
+  while (i < half.size() && half[i] == 0) {
+    i++;
+  }
+  int level = 1;
+  int len = 0;
+  for (; i < half.size(); i++) {
+    if (half[i] == level) {
+      len += 889;
+    }
+    else {
+      p.push_back(len);
+      level = half[i];
+      len = 889;
+    }
+  }
+  if (level == 1) {
+    p.push_back(len);
+  }
+}
+
+/*
+ * Insert a short inverted pulse at 'at', trimmed so it stays inside the
+ * pulse it lands in
+ */
+static void invert(std::vector<long> &edges, long at, long width)
+{
+  auto pos = std::upper_bound(edges.begin(), edges.end(), at);
+  if (pos == edges.end()) {
+    return;
+  }
+  if (at + width >= *pos) {
+    width = *pos - at - 1;
+  }
+  if (width <= 0) {
+    return;
+  }
+  pos = edges.insert(pos, at);
+  edges.insert(pos + 1, at + width);
+}
+
+std::vector<long> ir_edges(const std::vector<int> &pulses, const receiver &rx, long start)
+{
+  std::vector<long> edges;
+  long t = start;
+  for (size_t i=0; i<pulses.size(); i++) {
+    edges.push_back(t + ((i & 1) ? rx.lag : 0) + uniform(-rx.jitter, rx.jitter));
+    t += pulses[i];
+  }
+  edges.push_back(t + rx.lag + uniform(-rx.jitter, rx.jitter));
+
+  // Carrier dropouts: the receiver's output goes back to SPACE for a few
+  // hundred us in the middle of a mark. Only long marks are hit, the AGC
+  // rides through the short ones.
+  std::vector<long> marks(edges);
+  for (size_t i=0; i + 1<marks.size(); i += 2) {
+    if (rx.dropout && marks[i + 1] - marks[i] > 1000 && uniform(0, 99) < rx.dropout) {
+      invert(edges, uniform(marks[i] + 200, marks[i + 1] - 600), uniform(100, 400));
+    }
+  }
+
+  for (int g=0; g<rx.glitches; g++) {
+    invert(edges, uniform(edges.front() + 10, edges.back() - 100), uniform(10, 80));
+  }
+
+  return edges;
+}
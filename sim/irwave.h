@@ -0,0 +1,36 @@
+#pragma once
+
+// IR remote waveforms for the host sim: pulse trains for several remote
+// protocols, and a model of the receiver module that turns them into the
+// edge times the firmware sees on IR_PIN.
+
+#include <stdint.h>
+#include <random>
+#include <vector>
+
+extern std::mt19937 simRng;
+extern int uniform(int lo, int hi);
+
+// Pulse trains in microseconds, mark first, alternating mark and space
+extern void nec_bits(std::vector<int> &p, uint32_t value);
+extern void nec_repeat(std::vector<int> &p);
+extern void samsung_bits(std::vector<int> &p, uint32_t value);
+extern void sony_bits(std::vector<int> &p, uint32_t value);
+extern void rc5_bits(std::vector<int> &p, uint32_t value);
+
+// NEC repeat codes follow the frame every 108ms while a key is held
+#define NEC_REPEAT_PERIOD 108000
+
+struct receiver {
+  int lag;        // marks this much longer, spaces shorter
+  int jitter;     // +/- on every edge
+  int glitches;   // short inverted pulses dropped in at random
+  int dropout;    // percent of marks broken by a carrier dropout
+};
+
+/*
+ * Edge times in us for a pulse train starting at 'start', as the receiver
+ * outputs them. Even edges start a mark, odd ones a space; the last edge
+ * ends the final mark.
+ */
+extern std::vector<long> ir_edges(const std::vector<int> &pulses, const receiver &rx, long start);
@@ -0,0 +1,443 @@
+// Timer and interrupt model, see machine.h
+
+#include <Arduino.h>
+#include <avr/eeprom.h>
+
+#include "lights.h"
+#include "shiftreg.h"
+#include "machine.h"
+
+extern "C" void TIMER0_COMPA_vect(void);
+extern "C" void TIM1_OVF_vect(void) __attribute__((weak));  // not with ONE_TIMER
+extern "C" void USART_RX_vect(void) __attribute__((weak));   // stream builds only
+extern "C" void ADC_vect(void) __attribute__((weak));         // audio builds only
+
+// Interrupt sources, highest priority first
+#define IRQ_NONE 0
+#define IRQ_T1 1
+#define IRQ_T0 2
+#define IRQ_RX 3
+#define IRQ_ADC 4
+
+uint64_t simCycles;
+int simIsrLatency = 24;   // 4 to wake and vector, plus the ISR prologue
+
+uint32_t simT0Cycles, simT1Cycles;
+uint32_t simT0LateMax, simT0Missed;
+uint64_t simT0First;
+uint32_t simAdcSamples, simAdcOverruns;
+uint64_t simAdcBusy;
+
+static uint64_t stopAt;
+static bool inIsr;
+static uint64_t nested;         // cycles spent in ISRs that interrupted another
+static uint64_t t0Due, t1Due;
+static bool t0Armed, t1Armed;
+
+static const std::vector<uint64_t> *irEdges;
+static size_t irNext;
+
+static const std::vector<std::pair<uint64_t, uint8_t>> *rxBytes;
+static size_t rxNext;
+
+static const std::vector<uint8_t> *adcSamples;
+static size_t adcNext;
+static uint64_t adcDue;
+static bool adcArmed;
+
+static void (*portbWatch)(uint8_t);
+uint32_t simPortWrites[3];
+
+uint32_t simUsiWrites;
+static uint8_t usck;
+static uint32_t srChain;
+static void (*srWatch)(uint32_t);
+
+struct sim_stop {
+  bool stuck;
+};
+
+// Timer 0 clock select CS02:0 to prescale, 0 when stopped
+static uint32_t t0_prescale()
+{
+  static const uint32_t div[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+  return div[TCCR0B & 7];
+}
+
+// Timer 1 on the ATtiny85 has CS13:0, each step doubling the prescale
+static uint32_t t1_prescale()
+{
+  uint8_t cs = TCCR1 & 0x0f;
+  return cs ? 1UL << (cs - 1) : 0;
+}
+
+// Clocks per ADC conversion, free running: 13 ADC clocks at ADPS2:0
+static uint32_t adc_period()
+{
+  uint8_t ps = ADCSRA & 7;
+  return 13UL << (ps ? ps : 1);
+}
+
+static void t0_arm(uint64_t from)
+{
+  uint32_t prescale = t0_prescale();
+  t0Armed = prescale != 0;
+  t0Due = from + (uint64_t) (((OCR0A - TCNT0) & 0xff) + 1) * prescale;
+}
+
+static void t1_arm(uint64_t from)
+{
+  uint32_t prescale = t1_prescale();
+  t1Armed = prescale != 0;
+  t1Due = from + (uint64_t) (256 - TCNT1) * prescale;
+}
+
+void sim_reset()
+{
+  sim_power_cycle();
+
+  memset(simEeprom, 0xff, sizeof(simEeprom));
+  memset(simEepromWrites, 0, sizeof(simEepromWrites));
+}
+
+void sim_power_cycle()
+{
+  SREG = 0;
+  MCUCR = 0;
+  MCUSR = _BV(PORF);
+  PLLCSR = 0;
+  TCCR0A = 0;
+  TCCR0B = 0;
+  TCNT0 = 0;
+  OCR0A = 0;
+  TIMSK = 0;
+  TIFR = 0;
+  TCCR1 = 0;
+  TCNT1 = 0;
+  USICR = 0;
+  USIDR = 0;
+  PORTB = 0;
+  DDRB = 0;
+  PORTC = 0;
+  DDRC = 0;
+  PORTD = 0;
+  DDRD = 0;
+  PINB = _BV(IR_PIN);
+
+  simCycles = 0;
+  t0Armed = t1Armed = false;
+  irEdges = nullptr;
+  irNext = 0;
+  rxBytes = nullptr;
+  rxNext = 0;
+  UCSR0B = 0;
+  ADMUX = 0;
+  ADCSRA = 0;
+  ADCSRB = 0;
+  ADCH = 0;
+  adcSamples = nullptr;
+  adcNext = 0;
+  adcArmed = false;
+  simT0LateMax = simT0Missed = 0;
+  simT0First = 0;
+  simAdcSamples = simAdcOverruns = 0;
+  simAdcBusy = 0;
+  simUsiWrites = 0;
+  memset(simPortWrites, 0, sizeof(simPortWrites));
+  usck = 0;
+  srChain = 0;
+}
+
+void sim_ir_input(const std::vector<uint64_t> *edges)
+{
+  irEdges = edges;
+  irNext = 0;
+  while (irNext < irEdges->size() && (*irEdges)[irNext] <= simCycles) {
+    irNext++;
+  }
+  PINB = (irNext & 1) ? PINB & ~_BV(IR_PIN) : PINB | _BV(IR_PIN);
+}
+
+void sim_serial_input(const std::vector<std::pair<uint64_t, uint8_t>> *bytes)
+{
+  rxBytes = bytes;
+  rxNext = 0;
+  while (rxNext < rxBytes->size() && (*rxBytes)[rxNext].first <= simCycles) {
+    rxNext++;
+  }
+}
+
+void sim_adc_input(const std::vector<uint8_t> *samples)
+{
+  adcSamples = samples;
+  adcNext = 0;
+}
+
+void sim_watch_portb(void (*watch)(uint8_t portb))
+{
+  portbWatch = watch;
+}
+
+void sim_watch_sr(void (*watch)(uint32_t outputs))
+{
+  srWatch = watch;
+}
+
+void sim_port(uint8_t port, uint8_t was)
+{
+  simPortWrites[port]++;
+  if (port != SIM_PORTB) {
+    return;
+  }
+
+  uint8_t now = PORTB;
+
+  if (now == was) {
+    return;
+  }
+  if (portbWatch) {
+    portbWatch(now);
+  }
+
+#ifdef HAS_SHIFTREG
+  // RCLK copies the whole chain to the outputs on its rising edge
+  if ((now & ~was & SR_LATCH_MASK) && srWatch) {
+    srWatch(srChain);
+  }
+#endif
+}
+
+/*
+ * A USI software strobe. USITC toggles USCK, and on its rising edge every
+ * 74HC595 in the chain moves along a bit, taking DO (USIDR bit 7) into the
+ * first one. USICLK shifts USIDR.
+ */
+void sim_usicr(uint8_t value)
+{
+  simUsiWrites++;
+
+  if (value & _BV(USITC)) {
+    usck ^= 1;
+    if (usck && (value & _BV(USIWM0))) {
+      srChain = (srChain << 1) | (USIDR >> 7);
+    }
+  }
+  if (value & _BV(USICLK)) {
+    USIDR <<= 1;
+  }
+}
+
+static void update_pins()
+{
+  if (!irEdges) {
+    return;
+  }
+  while (irNext < irEdges->size() && (*irEdges)[irNext] <= simCycles) {
+    PINB ^= _BV(IR_PIN);
+    irNext++;
+  }
+}
+
+/*
+ * The next interrupt that can fire, IRQ_NONE if none is enabled
+ */
+static int next_irq(uint64_t &due)
+{
+  // The counters keep whatever the firmware last wrote, so arm lazily
+  if (!t0Armed) {
+    t0_arm(simCycles);
+  }
+  if (!t1Armed) {
+    t1_arm(simCycles);
+  }
+
+  bool t0On = (SREG & 0x80) && (TIMSK & _BV(OCIE0A)) && t0Armed;
+  bool t1On = (SREG & 0x80) && (TIMSK & _BV(TOIE1)) && t1Armed && TIM1_OVF_vect;
+
+  bool rxOn = (SREG & 0x80) && (UCSR0B & _BV(RXCIE0)) && rxBytes && rxNext < rxBytes->size() && USART_RX_vect;
+
+  // A free running ADC: the first conversion takes 25 ADC clocks, the
+  // rest 13, one after another from when ADSC was set
+  const uint8_t adcRun = _BV(ADEN) | _BV(ADSC) | _BV(ADATE);
+  if ((ADCSRA & adcRun) != adcRun) {
+    adcArmed = false;
+  }
+  else if (!adcArmed) {
+    adcArmed = true;
+    adcDue = simCycles + adc_period() * 25 / 13;
+  }
+  bool adcOn = (SREG & 0x80) && (ADCSRA & _BV(ADIE)) && adcArmed && ADC_vect;
+
+  // Timer 1 overflow has the higher priority (lower vector) on the ATtiny85,
+  // the USART is below both on the ATmega328
+  int irq = IRQ_NONE;
+  if (t1On) {
+    irq = IRQ_T1;
+    due = t1Due;
+  }
+  if (t0On && (irq == IRQ_NONE || t0Due < due)) {
+    irq = IRQ_T0;
+    due = t0Due;
+  }
+  if (rxOn && (irq == IRQ_NONE || (*rxBytes)[rxNext].first < due)) {
+    irq = IRQ_RX;
+    due = (*rxBytes)[rxNext].first;
+  }
+  if (adcOn && (irq == IRQ_NONE || adcDue < due)) {
+    irq = IRQ_ADC;
+    due = adcDue;
+  }
+  return irq;
+}
+
+/*
+ * Run an ISR that became due at 'due'. If the CPU was busy it starts late,
+ * and the counter shows it: if Timer 0 ran right round, TOV0 is set.
+ * Interrupts are off while it runs, as the hardware does, unless the ISR
+ * turns them back on.
+ */
+static void dispatch(int irq, uint64_t due)
+{
+  if (simCycles < due) {
+    simCycles = due;
+  }
+  update_pins();
+
+  const uint64_t entry = simCycles;
+  const uint64_t late = entry - due;
+  const uint64_t nestedBefore = nested;
+  const bool wasInIsr = inIsr;
+  inIsr = true;
+  SREG &= ~0x80;
+
+  if (irq == IRQ_T0 && !simT0First) {
+    simT0First = entry;
+  }
+
+  if (irq == IRQ_RX) {
+    UDR0 = (*rxBytes)[rxNext++].second;
+    USART_RX_vect();
+  }
+  else if (irq == IRQ_ADC) {
+    // Conversions carry on while the ISR is late; any it missed are lost
+    const uint32_t period = adc_period();
+    const uint64_t missed = late / period;
+    adcNext += missed;
+    simAdcOverruns += missed;
+    simAdcSamples += missed + 1;
+    ADCH = (adcSamples && adcNext < adcSamples->size()) ? (*adcSamples)[adcNext] : 0x80;
+    adcNext++;
+    adcDue = due + (missed + 1) * period;
+    ADC_vect();
+    simAdcBusy += simCycles - entry - (nested - nestedBefore);
+  }
+  else if (irq == IRQ_T1) {
+    uint8_t count = late / t1_prescale();
+    TCNT1 = count;
+    TIM1_OVF_vect();
+    simCycles += simT1Cycles;
+    if (TCNT1 != count) {
+      t1_arm(entry + simIsrLatency);
+    }
+    else {
+      t1Due = due + 256 * t1_prescale();
+    }
+  }
+  else if (TCCR0A & _BV(WGM01)) {
+    // CTC: the compare cleared the counter, which then counts up to the
+    // OCR0A the ISR leaves, right round first if it's already past it
+    TCNT0 = late / t0_prescale();
+    TIMER0_COMPA_vect();
+    simCycles += simT0Cycles;
+    uint64_t count = (simCycles - due) / t0_prescale();
+    t0Due = due + (OCR0A + 1 + (count > OCR0A ? 256 : 0)) * (uint64_t) t0_prescale();
+  }
+  else {
+    uint32_t count = OCR0A + late / t0_prescale();
+    if (late > simT0LateMax) {
+      simT0LateMax = late;
+    }
+    if (count > 0xff) {
+      TIFR |= _BV(TOV0);
+    }
+    if (count >= 0x100 + OCR0A) {
+      // Round to the compare again with the first still pending
+      simT0Missed++;
+    }
+    TCNT0 = count;
+    TIMER0_COMPA_vect();
+    simCycles += simT0Cycles;
+    if (TCNT0 != (uint8_t) count) {
+      t0_arm(entry + simIsrLatency);
+    }
+    else {
+      t0Due = due + 256 * t0_prescale();
+    }
+  }
+
+  // RETI
+  SREG |= 0x80;
+  inIsr = wasInIsr;
+  if (inIsr) {
+    nested += simCycles - entry;
+  }
+}
+
+/*
+ * The firmware went to sleep: wake on the next enabled interrupt and run it
+ */
+void sim_sleep()
+{
+  uint64_t due;
+  int irq = next_irq(due);
+
+  if (irq == IRQ_NONE) {
+    throw sim_stop { true };
+  }
+  if (due >= stopAt) {
+    simCycles = stopAt;
+    throw sim_stop { false };
+  }
+
+  dispatch(irq, due);
+}
+
+void sim_spend(uint32_t cycles)
+{
+  uint64_t due;
+  int irq;
+
+  if (inIsr && !(SREG & 0x80)) {
+    simCycles += cycles;
+    return;
+  }
+
+  // Main line code, or an ISR that turned interrupts back on, which the
+  // ISRs interrupt. One in an ISR runs on past the end of the run, so the
+  // interrupted one gets to finish.
+  while ((irq = next_irq(due)) != IRQ_NONE && due < simCycles + cycles) {
+    if (due >= stopAt && !inIsr) {
+      simCycles = stopAt;
+      throw sim_stop { false };
+    }
+    if (due > simCycles) {
+      cycles -= due - simCycles;
+    }
+    dispatch(irq, due);
+  }
+  simCycles += cycles;
+}
+
+bool sim_run(void (*body)(), uint64_t until)
+{
+  stopAt = until;
+
+  try {
+    body();
+  }
+  catch (sim_stop &s) {
+    return !s.stuck;
+  }
+
+  return true;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+// Cycle level model of the ATtiny85 as the firmware uses it, so setup()
+// and loop() run unmodified on the host.
+//
+// Code takes no time unless it says otherwise with sim_spend(), which the
+// trace markers do. sleep_cpu() advances the clock to the next enabled
+// timer interrupt and runs its ISR, the way the real part wakes from idle. Timer 0 (compare A) and Timer 1 (overflow) are
+// modelled with their prescalers; an ISR that reloads its counter does
+// so simIsrLatency cycles after the interrupt fired. For the stream build
+// there's also the ATmega328's USART receiver, fed a byte at a time, and
+// for the audio build its ADC, free running on a list of samples.
+//
+// ISRs run with interrupts off, as on the AVR. One that turns them back
+// on (ISR_NOBLOCK) is interrupted by the others from there on.
+
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#define SIM_CYCLES_PER_USEC (SYSCLOCK / 1000000)
+
+extern uint64_t simCycles;      // CPU clock cycles since sim_reset()
+extern int simIsrLatency;
+
+// What the Timer 0 and Timer 1 ISRs are charged each time they run, on
+// top of any sim_spend() of their own. 0 unless a check sets them.
+extern uint32_t simT0Cycles, simT1Cycles;
+
+// Kept from the last power cycle: the latest the Timer 0 ISR started after
+// its compare, in cycles, and the compares lost altogether (it was 256 or
+// more late, so the counter came round to the compare again; normal mode
+// only)
+extern uint32_t simT0LateMax, simT0Missed;
+
+// The cycle the first Timer 0 ISR since the power cycle started at, 0
+// until it has run
+extern uint64_t simT0First;
+
+// ADC conversions, those lost because the ISR hadn't read the last one,
+// and the cycles spent in the ADC ISR less any that interrupted it
+extern uint32_t simAdcSamples, simAdcOverruns;
+extern uint64_t simAdcBusy;
+
+/*
+ * Clear the registers and clock, and erase the EEPROM. The firmware's own
+ * state is left alone, setup() initialises what it needs.
+ */
+extern void sim_reset();
+
+/*
+ * The same, but the EEPROM keeps what was written to it. MCUSR says it was
+ * a power on reset; set it to something else for a warm start.
+ */
+extern void sim_power_cycle();
+
+/*
+ * Drive IR_PIN from a list of cycle times at which it toggles, starting
+ * from SPACE (the receiver output idles high). The list must outlive the
+ * run.
+ */
+extern void sim_ir_input(const std::vector<uint64_t> *edges);
+
+/*
+ * Feed the USART receiver (stream builds): each byte is received, and the
+ * RX ISR runs, at its cycle time. The list must outlive the run.
+ */
+extern void sim_serial_input(const std::vector<std::pair<uint64_t, uint8_t>> *bytes);
+
+/*
+ * Samples for the ADC (audio builds), one per conversion from when the
+ * firmware starts it free running, then mid scale. ADCH reads the sample
+ * as is, so they're the left adjusted 8 bit result. The list must outlive
+ * the run.
+ */
+extern void sim_adc_input(const std::vector<uint8_t> *samples);
+
+/*
+ * Called with the new PORTB value whenever a write changes it, so pulses
+ * inside an ISR are seen too.
+ */
+extern void sim_watch_portb(void (*watch)(uint8_t portb));
+extern uint32_t simPortWrites[3];   // writes to each port, SIM_PORTB etc.
+
+/*
+ * With the shift register backend, called with the 74HC595 chain's outputs
+ * each time PB3 latches them. Bit n is output n, QA of the first register
+ * (nearest DO) is bit 0.
+ */
+extern void sim_watch_sr(void (*watch)(uint32_t outputs));
+extern uint32_t simUsiWrites;   // USICR writes, a USI clock edge each
+
+/*
+ * Account for code that takes 'cycles' to run. In main line code any
+ * interrupt that falls due meanwhile runs first; in an ISR the clock just
+ * moves on, so the next interrupt is late.
+ */
+extern void sim_spend(uint32_t cycles);
+
+/*
+ * Run body() (normally loop()) until the clock reaches 'until' cycles.
+ * Returns false if the firmware went to sleep with no interrupt that
+ * could wake it.
+ */
+extern bool sim_run(void (*body)(), uint64_t until);
@@ -0,0 +1,244 @@
+// Settings saved over power cuts
+//
+//   sim persist [-n power cycles] [-d changes a day] [-s seed]
+//
+// Runs setup() and loop() on the timer model through a string of power
+// cycles, with the EEPROM kept in between. While the board is on the
+// settings change as they would from the remote (ON/OFF, program, master
+// and trims), with gaps both shorter and longer than PERSIST_QUIET, and
+// then the power goes: at a random moment, or while a record is being
+// written. After each power up it checks that:
+//
+//  - the settings restored are ones the board really had
+//  - if the last settings had been left alone for twice PERSIST_QUIET
+//    before the cut, they are the ones restored
+//  - finding them took at most 2 + log2(PERSIST_SLOTS) record reads
+//
+// At the end it reports the most writes to any one cell against the
+// records saved, and how long the EEPROM lasts at -d changes a day. That
+// counts the slots rewritten after a record was cut short, so it's on the
+// low side.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include <Arduino.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+
+#include "lights.h"
+#include "h-bridge.h"
+#include "shiftreg.h"
+#include "frame.h"
+#include "dimmer.h"
+#include "programs.h"
+#include "persist.h"
+#include "sim.h"
+#include "irwave.h"
+#include "machine.h"
+
+#ifdef HAS_PERSIST
+
+extern void setup();
+extern void loop();
+
+extern volatile uint8_t running;
+extern uint8_t masterLevel;
+extern uint8_t channelTrim[NUM_CHANNELS];
+
+#if defined(HAS_HBRIDGE)
+# define FRAME_USEC (1e6 * FRAME_MS * TICKS_PER_MS * (PWM_OCR + 1) / SYSCLOCK)
+#else
+# define FRAME_USEC (FRAME_MS * TICKS_PER_MS * BAM_UNIT_USEC)
+#endif
+
+#define QUIET_USEC (PERSIST_QUIET * FRAME_USEC)
+#define USEC(us) ((uint64_t) ((us) * SIM_CYCLES_PER_USEC))
+
+// EEPROM rated erase/write cycles
+#define ENDURANCE 100000
+
+struct settings {
+  uint8_t running, program, master;
+  uint8_t trim[NUM_CHANNELS];
+
+  bool operator==(const settings &o) const
+  {
+    return running == o.running && program == o.program && master == o.master &&
+           memcmp(trim, o.trim, NUM_CHANNELS) == 0;
+  }
+};
+
+static settings current()
+{
+  settings s = { running, program, masterLevel };
+  memcpy(s.trim, channelTrim, NUM_CHANNELS);
+  return s;
+}
+
+static void change()
+{
+  switch (uniform(0, 3)) {
+    case 0: running = !running; break;
+    case 1: frame_select(uniform(0, numPrograms - 1)); break;
+    case 2: dimmer_set(DIM_MASTER, uniform(0, 255)); break;
+    case 3: dimmer_set(uniform(0, NUM_CHANNELS - 1), uniform(0, 255)); break;
+  }
+}
+
+static uint32_t cell_writes()
+{
+  uint32_t n = 0;
+  for (uint32_t w : simEepromWrites) {
+    n += w;
+  }
+  return n;
+}
+
+/*
+ * The newest sequence number in the log, found the slow way
+ */
+static long newest_seq()
+{
+  long newest = -1;
+
+  for (int i=0; i<PERSIST_SLOTS; i++) {
+    persistrec_t r;
+    uint8_t crc = PERSIST_MAGIC;
+
+    memcpy(&r, simEeprom + i * sizeof(r), sizeof(r));
+    for (size_t b=0; b<sizeof(r); b++) {
+      if (b != offsetof(persistrec_t, crc)) {
+        crc = _crc8_ccitt_update(crc, ((uint8_t *) &r)[b]);
+      }
+    }
+    if (crc == r.crc && (newest < 0 || (int16_t) (r.seq - newest) > 0)) {
+      newest = r.seq;
+    }
+  }
+
+  return newest;
+}
+
+int persist_main(int argc, char **argv)
+{
+  int cycles = 200;
+  int perDay = 50;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:d:s:")) != -1) {
+    switch (opt) {
+      case 'n': cycles = atoi(optarg); break;
+      case 'd': perDay = atoi(optarg); break;
+      case 's': simRng.seed(atoi(optarg)); break;
+      default:
+        fprintf(stderr, "usage: sim persist [-n power cycles] [-d changes a day] [-s seed]\n");
+        return 2;
+    }
+  }
+  if (cycles < 1 || perDay < 1) {
+    fprintf(stderr, "persist: at least one power cycle and one change a day\n");
+    return 2;
+  }
+
+  const uint32_t maxReads = (2 + ceil(log2(PERSIST_SLOTS))) * sizeof(persistrec_t);
+  std::vector<settings> had;
+  settings last;
+  bool sure = false;
+  uint32_t wrong = 0, lost = 0, midWrite = 0, worstReads = 0, changes = 0;
+  double onFor = 0;
+
+  sim_reset();
+
+  for (int c=0; c<=cycles; c++) {
+    // Power up, with the firmware's RAM as the C runtime leaves it
+    sim_power_cycle();
+    running = 1;
+    masterLevel = 255;
+    uint32_t reads = simEepromReads;
+    setup();
+    reads = simEepromReads - reads;
+    worstReads = std::max(worstReads, reads);
+
+    settings now = current();
+    if (c > 0) {
+      if (std::find(had.begin(), had.end(), now) == had.end()) {
+        if (wrong++ < 5) {
+          printf("  power up %d: restored settings the board never had\n", c);
+        }
+      }
+      else if (sure && !(now == last)) {
+        if (lost++ < 5) {
+          printf("  power up %d: settings left alone for %.1fs before the cut weren't restored\n",
+                 c, 2 * QUIET_USEC / 1e6);
+        }
+      }
+    }
+    if (c == cycles) {
+      break;
+    }
+
+    had.assign(1, now);
+    uint64_t changedAt = 0;
+
+    for (int n=uniform(1, 4); n; n--) {
+      sim_run(loop, simCycles + USEC(uniform(0, 1500) * QUIET_USEC / 1000));
+      change();
+      changes++;
+      had.push_back(current());
+      changedAt = simCycles;
+    }
+
+    if (uniform(0, 2) == 0) {
+      // Wait for a record to start going out, then cut it short
+      uint32_t before = cell_writes();
+      uint64_t until = simCycles + USEC(2 * QUIET_USEC);
+      while (cell_writes() == before && simCycles < until) {
+        sim_run(loop, simCycles + USEC(FRAME_USEC));
+      }
+      sim_run(loop, simCycles + USEC(uniform(0, sizeof(persistrec_t)) * FRAME_USEC));
+      if (cell_writes() != before) {
+        midWrite++;
+      }
+    }
+    else {
+      sim_run(loop, simCycles + USEC(uniform(0, 3000) * QUIET_USEC / 1000));
+    }
+
+    last = current();
+    sure = simCycles - changedAt >= USEC(2 * QUIET_USEC);
+    onFor += simCycles / (double) SYSCLOCK;
+  }
+
+  long records = newest_seq() + 1;
+  uint32_t worstCell = *std::max_element(simEepromWrites, simEepromWrites + E2END + 1);
+  double saves = records ? (double) ENDURANCE * records / worstCell : 0;
+
+  printf("persist: %d power cycles over %.0fs on, %u changes, %d slots of %d bytes\n\n",
+         cycles, onFor, changes, PERSIST_SLOTS, (int) sizeof(persistrec_t));
+  printf("  cut while writing   %u\n", midWrite);
+  printf("  wrong settings      %u\n", wrong);
+  printf("  lost settings       %u\n", lost);
+  printf("  restore reads       %u bytes worst, limit %u\n", worstReads, maxReads);
+  printf("  records saved       %ld, %.1f times round the log, %u writes to the busiest cell\n",
+         records, records / (double) PERSIST_SLOTS, worstCell);
+  printf("  lifetime            %.0f saves, %.0f years at %d changes a day\n",
+         saves, saves / perDay / 365, perDay);
+
+  return (wrong || lost || worstReads > maxReads) ? 1 : 0;
+}
+
+#else
+
+int persist_main(int, char **)
+{
+  fprintf(stderr, "persist: this build has no EEPROM settings\n");
+  return 2;
+}
+
+#endif /* HAS_PERSIST */
@@ -0,0 +1,188 @@
+// Power limit accuracy
+//
+//   sim-pw power [-n frames] [-s seed]
+//
+// power_limit() against the exact proportional scaling, worked out in
+// doubles: every frame of levels in steps of 4 from 0 to MAX_LEVEL, then n
+// random frames with levels up to 255. A frame whose levels add up to no
+// more than POWER_BUDGET must come out as it went in. One over it must add
+// up to POWER_BUDGET or less, with no channel above its exact share, which
+// is level * POWER_BUDGET / total, and none more than POWER_ERROR below it.
+// Reported: the worst and mean shortfall per channel, in levels, and the
+// lowest total a limited frame came out with.
+//
+// Then every program through the frame pipeline for a few thousand frames,
+// with the dimmer at full, checking no frame's total is over the budget.
+//
+// "make power" builds ./sim-pw with -DPOWER_BUDGET=$(POWER_BUDGET) and runs
+// this, and sim warm on it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <Arduino.h>
+
+#include "lights.h"
+#include "frame.h"
+#include "dimmer.h"
+#include "power.h"
+#include "programs.h"
+#include "sim.h"
+#include "irwave.h"
+
+#ifdef HAS_POWER_LIMIT
+
+// Levels a channel may come out under its exact share: one for scale8()
+// rounding down, and 5% for the 7 bit total and the gain rounding down
+#define POWER_ERROR(exact) (1 + (exact) * 0.05)
+
+struct accuracy {
+  uint32_t frames, limited, bad;
+  uint64_t ticks;
+  double worst, sum;            // levels under the exact share
+  uint32_t channels;
+  uint16_t lowest;              // total of a limited frame
+};
+
+static void check(accuracy &a, const uint8_t *in)
+{
+  uint8_t out[NUM_CHANNELS];
+  uint16_t total = 0, after = 0;
+
+  memcpy(out, in, NUM_CHANNELS);
+  for (int i=0; i<NUM_CHANNELS; i++) {
+    total += in[i] < MAX_LEVEL ? in[i] : MAX_LEVEL;
+  }
+
+  uint64_t t0 = host_ticks();
+  power_limit(out);
+  a.ticks += host_ticks() - t0;
+  a.frames++;
+
+  for (int i=0; i<NUM_CHANNELS; i++) {
+    after += out[i];
+  }
+
+  bool ok = true;
+  if (total <= POWER_BUDGET) {
+    ok = !memcmp(in, out, NUM_CHANNELS);
+  }
+  else {
+    a.limited++;
+    ok = after <= POWER_BUDGET;
+    if (after < a.lowest) {
+      a.lowest = after;
+    }
+
+    for (int i=0; i<NUM_CHANNELS; i++) {
+      double exact = (double) (in[i] < MAX_LEVEL ? in[i] : MAX_LEVEL) * POWER_BUDGET / total;
+      double under = exact - out[i];
+
+      if (under < 0 || under > POWER_ERROR(exact)) {
+        ok = false;
+      }
+      if (under > a.worst) {
+        a.worst = under;
+      }
+      a.sum += under;
+      a.channels++;
+    }
+  }
+
+  if (!ok && a.bad++ < 5) {
+    printf("  %d %d %d %d (total %u) came out as %d %d %d %d (total %u)\n", in[0], in[1], in[2], in[3], total,
+           out[0], out[1], out[2], out[3], after);
+  }
+}
+
+static void report(const accuracy &a, const char *what)
+{
+  printf("%s: %u frames, %u limited, %u wrong\n", what, a.frames, a.limited, a.bad);
+  if (a.limited) {
+    printf("  under the exact share: worst %.2f levels, mean %.2f; lowest limited total %u (%.1f%% of the budget)\n",
+           a.worst, a.sum / a.channels, a.lowest, 100.0 * a.lowest / POWER_BUDGET);
+  }
+  printf("  %.1f %s per call\n", (double) a.ticks / a.frames, host_tick_unit);
+}
+
+int power_main(int argc, char **argv)
+{
+  long frames = 1000000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+    switch (opt) {
+      case 'n': frames = atol(optarg); break;
+      case 's': simRng.seed(atoi(optarg)); break;
+      default:
+        fprintf(stderr, "usage: sim power [-n frames] [-s seed]\n");
+        return 2;
+    }
+  }
+
+  printf("power: a budget of %d, of %d full on\n\n", POWER_BUDGET, NUM_CHANNELS * MAX_LEVEL);
+
+  accuracy grid = {}, random = {};
+  grid.lowest = random.lowest = 0xffff;
+  uint8_t in[NUM_CHANNELS];
+
+  for (int a=0; a<=MAX_LEVEL; a+=4) {
+    for (int b=0; b<=MAX_LEVEL; b+=4) {
+      for (int c=0; c<=MAX_LEVEL; c+=4) {
+        for (int d=0; d<=MAX_LEVEL; d+=4) {
+          in[0] = a; in[1] = b; in[2] = c; in[3] = d;
+          check(grid, in);
+        }
+      }
+    }
+  }
+  report(grid, "every level in steps of 4");
+
+  for (long f=0; f<frames; f++) {
+    for (int i=0; i<NUM_CHANNELS; i++) {
+      in[i] = uniform(0, 255);
+    }
+    check(random, in);
+  }
+  report(random, "random levels up to 255");
+
+  // The pipeline, dimmer at full
+  uint32_t over = 0, total = 0;
+  uint16_t highest = 0;
+
+  dimmer_init();
+  for (uint8_t p=0; p<numPrograms; p++) {
+    frame_init(p);
+    for (int f=0; f<5000; f++, total++) {
+      frame_next();
+
+      uint16_t sum = 0;
+      for (int i=0; i<NUM_CHANNELS; i++) {
+        sum += frame[i] < MAX_LEVEL ? frame[i] : MAX_LEVEL;
+      }
+      if (sum > POWER_BUDGET && over++ < 5) {
+        printf("  program %u frame %d adds up to %u\n", p, f, sum);
+      }
+      if (sum > highest) {
+        highest = sum;
+      }
+    }
+  }
+  printf("every program: %u frames, the highest total %u, %u over the budget\n", total, highest, over);
+
+  bool bad = grid.bad || random.bad || over;
+  printf("\n%s\n", bad ? "FAILED" : "ok");
+  return bad ? 1 : 0;
+}
+
+#else
+
+int power_main(int, char **)
+{
+  fprintf(stderr, "power: this build has no power limit, see make power\n");
+  return 2;
+}
+
+#endif /* HAS_POWER_LIMIT */
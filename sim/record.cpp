@@ -0,0 +1,232 @@
+// Flight recorder
+//
+//   sim-rec record [-s seed]
+//
+// Needs the recorder, which the ATtiny only has with -DRECORDER, so it
+// only works in the binary "make sim-rec" builds. Runs setup() and loop()
+// on the timer model and does the things the recorder should catch, then
+// checks its entries against a list of what was done:
+//
+//  - a cold start: the start, then on, program 0 and the master level
+//  - OFF, ON and NEXT pressed, DOWN held for a frame and ten repeats
+//  - a burst of 200us pulses the ISR throws away as noise, 60us glitches
+//    for its filter, then an RC5 frame that doesn't decode
+//  - a watchdog reset, NEXT again, then a power on reset
+//
+// With RECORDER_ENTRIES less than that list, the last of it must be
+// there, the entries from before the watchdog reset among them. After the
+// power on, only the start. Frames must count up, and on through the warm
+// start.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "lights.h"
+#include "remote.h"
+#include "frame.h"
+#include "recorder.h"
+#include "sim.h"
+#include "irwave.h"
+#include "machine.h"
+
+#ifdef HAS_RECORDER
+
+extern void setup();
+extern void loop();
+
+extern volatile uint8_t running;
+extern uint8_t masterLevel;
+
+#define USEC(us) ((uint64_t) (us) * SIM_CYCLES_PER_USEC)
+#define MSEC(ms) USEC((ms) * 1000ULL)
+
+struct expect {
+  uint8_t kind;
+  uint8_t arg;
+  uint32_t value;
+  bool anyValue;
+};
+
+static const char *kindNames[] = {
+  "", "start", "key", "beacon", "failed", "noise", "on", "program", "master"
+};
+
+static const receiver rx = { 60, 40, 0, 0 };
+
+static void send(std::vector<uint64_t> &edges, const std::vector<int> &pulses, uint64_t at)
+{
+  for (long e : ir_edges(pulses, rx, 0)) {
+    edges.push_back(at + USEC(e));
+  }
+}
+
+static void key(std::vector<uint64_t> &edges, uint32_t code, uint64_t at, int repeats = 0)
+{
+  std::vector<int> p;
+
+  nec_bits(p, code);
+  send(edges, p, at);
+  for (int i=0; i<repeats; i++) {
+    p.clear();
+    nec_repeat(p);
+    send(edges, p, at += USEC(NEC_REPEAT_PERIOD));
+  }
+}
+
+static void print(const char *what, uint8_t kind, uint8_t arg, uint32_t value)
+{
+  printf("  %-9s %-8s %3d 0x%08x\n", what, kindNames[kind < 9 ? kind : 0], arg, value);
+}
+
+/*
+ * The recorder's entries against the end of the list, and the frames in
+ * order. Returns the number of mismatches.
+ */
+static int check(const std::vector<expect> &list, const char *when)
+{
+  uint8_t count = recorder_count();
+  size_t want = std::min<size_t>(list.size(), RECORDER_ENTRIES);
+  int bad = 0;
+
+  printf("%s: %u entries\n", when, count);
+  if (count != want) {
+    printf("  should have %zu\n", want);
+    bad++;
+  }
+
+  for (uint8_t n=0; n<count && n<want; n++) {
+    const recentry_t *e = recorder_entry(n);
+    const expect &x = list[list.size() - want + n];
+    bool ok = e->kind == x.kind && e->arg == x.arg && (x.anyValue || e->value == x.value);
+
+    if (n && e->frame < recorder_entry(n - 1)->frame) {
+      printf("  frame %u is before the entry above's\n", e->frame);
+      bad++;
+    }
+    print(ok ? "" : "wrong", e->kind, e->arg, e->value);
+    if (!ok) {
+      print("should be", x.kind, x.arg, x.value);
+      bad++;
+    }
+  }
+
+  return bad;
+}
+
+int record_main(int argc, char **argv)
+{
+  int opt;
+
+  while ((opt = getopt(argc, argv, "s:")) != -1) {
+    switch (opt) {
+      case 's': simRng.seed(atoi(optarg)); break;
+      default:
+        fprintf(stderr, "usage: sim-rec record [-s seed]\n");
+        return 2;
+    }
+  }
+
+  std::vector<expect> list;
+  std::vector<uint64_t> edges;
+  std::vector<int> p;
+
+  // Cold start, then the keys
+  key(edges, BTN_OFF, MSEC(300));
+  key(edges, BTN_ON, MSEC(700));
+  key(edges, BTN_NEXT, MSEC(1100));
+  key(edges, BTN_DOWN, MSEC(1500), 10);
+
+  // Noise frames, glitches, and a remote we don't decode
+  const int noise = 20, glitches = 5;
+  uint64_t t = MSEC(3000);
+  for (int i=0; i<noise; i++, t += MSEC(10)) {
+    edges.push_back(t);
+    edges.push_back(t + USEC(200));
+  }
+  for (int i=0; i<glitches; i++, t += MSEC(10)) {
+    edges.push_back(t);
+    edges.push_back(t + USEC(60));
+  }
+  rc5_bits(p, 0x3000 | 32);
+  send(edges, p, t + MSEC(100));
+
+  sim_reset();
+  setup();
+  sim_ir_input(&edges);
+  sim_run(loop, MSEC(4000));
+
+  list.push_back({ REC_START, 0, _BV(PORF) });
+  list.push_back({ REC_ON, 1, 0 });
+  list.push_back({ REC_PROGRAM, 0, 0 });
+  list.push_back({ REC_MASTER, 255, 0 });
+  list.push_back({ REC_KEY, 0, BTN_OFF });
+  list.push_back({ REC_ON, 0, 0 });
+  list.push_back({ REC_KEY, 0, BTN_ON });
+  list.push_back({ REC_ON, 1, 0 });
+  list.push_back({ REC_KEY, 0, BTN_NEXT });
+  list.push_back({ REC_PROGRAM, 1, 0 });
+  list.push_back({ REC_KEY, 10, BTN_DOWN });
+  list.push_back({ REC_MASTER, masterLevel, 0 });
+  list.push_back({ REC_NOISE, noise, 0, true });
+  list.push_back({ REC_FAILED, 1, 0, true });
+
+  int bad = check(list, "record: before the watchdog reset");
+  const recentry_t *failed = recorder_entry(recorder_count() - 1);
+  if (failed->glitches != glitches) {
+    printf("  %d glitches before the failed frame, the entry says %u\n", glitches, failed->glitches);
+    bad++;
+  }
+  uint32_t lastFrame = failed->frame;
+
+  // Watchdog reset, warm start
+  edges.clear();
+  key(edges, BTN_NEXT, MSEC(300));
+  sim_power_cycle();
+  MCUSR = _BV(WDRF);
+  setup();
+  sim_ir_input(&edges);
+  sim_run(loop, MSEC(800));
+
+  list.push_back({ REC_START, 1, _BV(WDRF) });
+  list.push_back({ REC_KEY, 0, BTN_NEXT });
+  list.push_back({ REC_PROGRAM, 2, 0 });
+
+  bad += check(list, "\nafter a watchdog reset");
+  if (recorder_count() >= 3 && recorder_entry(recorder_count() - 3)->frame < lastFrame) {
+    printf("  frames started again at the warm start\n");
+    bad++;
+  }
+
+  // Power on, the log starts again
+  edges.clear();
+  sim_power_cycle();
+  setup();
+  sim_ir_input(&edges);
+  sim_run(loop, MSEC(100));
+
+  list.clear();
+  list.push_back({ REC_START, 0, _BV(PORF) });
+  // As the settings saved in the EEPROM left them
+  list.push_back({ REC_ON, running, 0 });
+  list.push_back({ REC_PROGRAM, program, 0 });
+  list.push_back({ REC_MASTER, masterLevel, 0 });
+
+  bad += check(list, "\nafter a power on reset");
+
+  printf("\n%s\n", bad ? "FAILED" : "ok");
+  return bad ? 1 : 0;
+}
+
+#else
+
+int record_main(int, char **)
+{
+  fprintf(stderr, "record: needs the flight recorder, make sim-rec\n");
+  return 2;
+}
+
+#endif /* HAS_RECORDER */
@@ -0,0 +1,153 @@
+// Offline renderer: runs the real frame pipeline (effects, modulation
+// graph, crossfade, dimmer) and writes the PWM levels it produces.
+//
+//   sim render [-p program] [-s seconds] [-x program@seconds] [-m master]
+//              [-f fadeframes] [-o levels.csv] [-v levels.vcd]
+//
+// Time advances by one true frame period per frame: FRAME_MS * TICKS_PER_MS
+// PWM ticks of PWM_OCR + 1 clocks each, ignoring ISR entry latency and
+// the time the loop spends producing the frame.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <chrono>
+
+#include <Arduino.h>
+
+#include "lights.h"
+#include "h-bridge.h"
+#include "frame.h"
+#include "dimmer.h"
+#include "programs.h"
+#include "sim.h"
+#include "vcd.h"
+
+#if defined(HAS_HBRIDGE) && !defined(HAS_MULTI_BRIDGE)
+
+extern volatile uint8_t level1;
+extern volatile uint8_t level2;
+extern volatile uint8_t level3;
+extern volatile uint8_t level4;
+
+const double frame_usec = 1e6 * FRAME_MS * TICKS_PER_MS * (PWM_OCR + 1) / SYSCLOCK;
+
+int render_main(int argc, char **argv)
+{
+  int prog = 0;
+  double seconds = 10;
+  int next = -1;
+  double nextAt = 0;
+  int master = 255;
+  const char *csvPath = nullptr;
+  const char *vcdPath = nullptr;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "p:s:x:m:f:o:v:")) != -1) {
+    switch (opt) {
+      case 'p': prog = atoi(optarg); break;
+      case 's': seconds = atof(optarg); break;
+      case 'x':
+        if (sscanf(optarg, "%d@%lf", &next, &nextAt) != 2) {
+          fprintf(stderr, "render: -x wants program@seconds\n");
+          return 2;
+        }
+        break;
+      case 'm': master = atoi(optarg); break;
+      case 'f': fadeFrames = atoi(optarg); break;
+      case 'o': csvPath = optarg; break;
+      case 'v': vcdPath = optarg; break;
+      default:
+        fprintf(stderr, "usage: sim render [-p program] [-s seconds] [-x program@seconds] "
+                        "[-m master] [-f fadeframes] [-o levels.csv] [-v levels.vcd]\n");
+        return 2;
+    }
+  }
+
+  if (prog < 0 || prog >= numPrograms || next >= numPrograms) {
+    fprintf(stderr, "render: there are %d programs\n", numPrograms);
+    return 2;
+  }
+
+  long frames = seconds * 1e6 / frame_usec;
+  long switchFrame = (next >= 0) ? (long) (nextAt * 1e6 / frame_usec) : -1;
+
+  FILE *csv = nullptr;
+  if (csvPath) {
+    csv = fopen(csvPath, "w");
+    if (!csv) {
+      perror(csvPath);
+      return 1;
+    }
+    fprintf(csv, "usec,level1,level2,level3,level4\n");
+  }
+
+  Vcd vcd;
+  int wire[NUM_CHANNELS];
+  if (vcdPath) {
+    if (!vcd.open(vcdPath)) {
+      perror(vcdPath);
+      return 1;
+    }
+    for (int i=0; i<NUM_CHANNELS; i++) {
+      char name[sizeof("level") + 3];
+      snprintf(name, sizeof(name), "level%u", (uint8_t) (i + 1));
+      wire[i] = vcd.add(name, 8);
+    }
+  }
+
+  frame_init(prog);
+  dimmer_init();
+  dimmer_set(DIM_MASTER, master);
+
+  for (long f=0; f<frames; f++) {
+    if (f == switchFrame) {
+      frame_select(next);
+    }
+    frame_next();
+
+    uint64_t usec = f * frame_usec;
+    uint8_t level[NUM_CHANNELS] = { level1, level2, level3, level4 };
+
+    if (csv) {
+      fprintf(csv, "%llu,%d,%d,%d,%d\n", (unsigned long long) usec,
+              level[0], level[1], level[2], level[3]);
+    }
+    for (int i=0; i<NUM_CHANNELS && vcdPath; i++) {
+      vcd.change(usec, wire[i], level[i]);
+    }
+  }
+
+  if (csv) {
+    fclose(csv);
+  }
+  vcd.close();
+
+  // Same frames again flat out, for a throughput figure
+  frame_init(prog);
+  auto start = std::chrono::steady_clock::now();
+  for (long f=0; f<frames; f++) {
+    if (f == switchFrame) {
+      frame_select(next);
+    }
+    frame_next();
+  }
+  std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+
+  printf("program %d, %ld frames of %.1f us (%.1f fps)\n", prog, frames, frame_usec, 1e6 / frame_usec);
+  printf("%.0f frames/s, %.0f effect steps/s, %.0fx real time\n",
+         frames / secs.count(), frames * NUM_CHANNELS / secs.count(),
+         frames * frame_usec / 1e6 / secs.count());
+
+  return 0;
+}
+
+#else
+
+int render_main(int, char **)
+{
+  fprintf(stderr, "render: renders the two H-bridges' levels, use ./sim\n");
+  return 2;
+}
+
+#endif /* HAS_HBRIDGE && !HAS_MULTI_BRIDGE */
@@ -0,0 +1,91 @@
+// Host side simulation and benchmarks for the firmware
+//
+//   sim bench [steps]     time every effect generator and graph patch
+//   sim render ...        render channel levels to CSV or VCD
+//   sim ir ...            IR decoder accuracy against tolerance settings
+//   sim irfuzz [n]        random input for the IR ISR and decoder
+//   sim e2e ...           remote key press to PORTB, through setup() and loop()
+//   sim sync ...          effect phase sync between boards, over hours
+//   sim persist ...       EEPROM settings through power cuts, and wear
+//   sim warm ...          warm and cold starts after each kind of reset
+//   sim cache ...         hash of the frames, to compare with sim-fc cache
+//   sim soak ...          days of IR traffic, for the counters that wrap
+//   sim bridges ...       H-bridge PWM ISR on-times and cost
+//   sim-trace trace ...   trace markers to VCD (needs make sim-trace)
+//   sim-sr sr ...         shift register outputs against the frames (needs make sim-sr)
+//   sim-stream stream ... serial frames loopback (needs make sim-stream)
+//   sim-audio audio ...   ADC ISR cost against the PWM (needs make sim-audio)
+//   sim-fc cache ...      the frame cache against the generators (needs make sim-fc)
+//   sim-pw power ...      power limit against exact scaling (needs make sim-pw)
+//   sim-mb bridges ...    up to 8 bridges on the ATmega328 ports (needs make sim-mb)
+//   sim-1t e2e, ir ...    IR sampled from the PWM ISR (needs make sim-1t, see make onetimer)
+//   sim-rec record ...    flight recorder entries against what was done (needs make sim-rec)
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "sim.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+const char *host_tick_unit = "cycles";
+
+uint64_t host_ticks()
+{
+  return __rdtsc();
+}
+#else
+const char *host_tick_unit = "ns";
+
+uint64_t host_ticks()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+static const struct {
+  const char *name;
+  int (*run)(int argc, char **argv);
+  const char *help;
+} commands[] = {
+  { "bench", bench_main, "[steps]  time every effect generator and graph patch" },
+  { "render", render_main, "[-p program] [-s seconds] ...  render levels to CSV/VCD" },
+  { "ir", ir_main, "[-n count] [-c corpus.txt]  IR decode accuracy and cost" },
+  { "irfuzz", irfuzz_main, "[iterations]  random input for the IR ISR and decoder" },
+  { "trace", trace_main, "[-p program] [-s seconds] [-k key@seconds] [-o vcd]  markers to VCD" },
+  { "sr", sr_main, "[-p program] [-s seconds]  shift register BAM against the frames" },
+  { "e2e", e2e_main, "[-p nec|rc5|sony] [-l lag] [-j jitter] ...  key press to PORTB latency" },
+  { "sync", sync_main, "[-n followers] [-H hours] [-c spread %] [-l loss %] [-j minutes]  phase sync over hours" },
+  { "persist", persist_main, "[-n power cycles] [-d changes a day]  EEPROM settings through power cuts" },
+  { "warm", warm_main, "[-n resets] [-p program]  warm and cold starts after each kind of reset" },
+  { "stream", stream_main, "[-f frames/s] [-s seconds] [-e corrupt %]  serial frames loopback" },
+  { "audio", audio_main, "[-f recording.wav] [-s seconds] [-w pwm clocks]  ADC ISR against the PWM" },
+  { "cache", cache_main, "[-n frames] [-s seed]  hash of the frames through random program changes" },
+  { "record", record_main, "[-s seed]  flight recorder entries against what was done" },
+  { "power", power_main, "[-n frames] [-s seed]  power limit against exact scaling (needs make sim-pw)" },
+  { "soak", soak_main, "[-d days] [-p program] [-g gap] [-b budget]  days of IR traffic, for counter wraps" },
+  { "bridges", bridges_main, "[-n frames] [-s seed]  H-bridge PWM ISR on-times and cost (make bridges)" },
+};
+
+int main(int argc, char **argv)
+{
+  if (argc > 1) {
+    for (auto &c : commands) {
+      if (strcmp(argv[1], c.name) == 0) {
+        return c.run(argc - 1, argv + 1);
+      }
+    }
+  }
+
+  fprintf(stderr, "usage: %s <command> [args]\n", argv[0]);
+  for (auto &c : commands) {
+    fprintf(stderr, "  %-8s %s\n", c.name, c.help);
+  }
+
+  return 2;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+// Host side simulation and benchmarks for the firmware
+
+#include <stdint.h>
+
+// Sub-commands, see sim.cpp
+extern int bench_main(int argc, char **argv);
+extern int render_main(int argc, char **argv);
+extern int ir_main(int argc, char **argv);
+extern int irfuzz_main(int argc, char **argv);
+extern int e2e_main(int argc, char **argv);
+extern int trace_main(int argc, char **argv);
+extern int sr_main(int argc, char **argv);
+extern int sync_main(int argc, char **argv);
+extern int stream_main(int argc, char **argv);
+extern int persist_main(int argc, char **argv);
+extern int warm_main(int argc, char **argv);
+extern int audio_main(int argc, char **argv);
+extern int cache_main(int argc, char **argv);
+extern int record_main(int argc, char **argv);
+extern int soak_main(int argc, char **argv);
+extern int power_main(int argc, char **argv);
+extern int bridges_main(int argc, char **argv);
+
+// Monotonic host clock for benchmarks. Uses the TSC where there is one, so
+// "ticks" are host CPU cycles on x86 and nanoseconds elsewhere.
+extern uint64_t host_ticks();
+extern const char *host_tick_unit;
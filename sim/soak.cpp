@@ -0,0 +1,361 @@
+// Soak: days of running, for the counters that wrap
+//
+//   sim soak [-d days] [-p program] [-g mean gap s] [-b budget s/day] [-s seed]
+//
+// Runs setup() and loop() on the timer model for days of simulated time,
+// with IR traffic at random gaps of up to twice the mean: keys that leave
+// the show as it is (ON while on, 0, a held ON sending repeats), codes from
+// another NEC remote, RC5 and Sony frames, bursts of pulses the ISR throws
+// away as noise and glitches for its filter. Many of the gaps are longer
+// than the 3.3s irparams.timer takes to count through 16 bits.
+//
+// The counters this is after, and what each would show if it went wrong:
+//
+//  - systemTicks, a 16 bit int on the AVR, and so in this build: frames
+//    late or missing
+//  - irparams.timer, counting through every gap: a key lost after one
+//  - syncState.phase, round every 2 minutes or so (the whole cycles that
+//    fit in 16 bits), and each effect's stepNum,
+//    round every cycle: a level out of place, or a channel slipping
+//    against the others
+//
+// The program's first cycle is kept as the reference. From then on every
+// frame must show exactly the levels the reference has for its place in
+// the cycle, and the steps between frames must be one. Each hour the
+// channels' offsets against channel 1, found from the last cycle, must be
+// the ones the first cycle had; the frames must come at the rate they did
+// in the first hour, never more than two frame times apart; and every NEC frame and repeat
+// sent must have been decoded, every other remote's frame failed and every
+// pulse of noise thrown away.
+//
+// The host time is checked too: a simulated day must take no more than the
+// budget, so a soak of several days stays something to run before a
+// release.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "lights.h"
+#include "remote.h"
+#include "ir.h"
+#include "frame.h"
+#include "sync.h"
+#include "programs.h"
+#include "sim.h"
+#include "irwave.h"
+#include "machine.h"
+
+#if defined(HAS_IR) && defined(HAS_FRAMES)
+
+extern void setup();
+extern void loop();
+
+extern volatile irparams_t irparams;
+extern irstats_t irstats;
+
+#define USEC(us) ((uint64_t) (us) * SIM_CYCLES_PER_USEC)
+#define MSEC(ms) USEC((ms) * 1000ULL)
+#define HOUR USEC(3600000000ULL)
+
+// What was sent in an hour, and what the firmware should have made of it
+struct traffic {
+  uint32_t nec, other, noise, glitches;
+};
+
+static const receiver rx = { 60, 40, 0, 0 };
+
+static int period;                      // steps in the program's cycle
+static std::vector<uint8_t> reference;  // its first cycle, period frames of NUM_CHANNELS
+static std::vector<uint8_t> last;       // the last cycle shown, by place in it
+
+static uint16_t lastPhase;
+static uint64_t steps;                  // since frame_init()
+static uint64_t lastAt, longest;        // cycles, of a frame and between two
+static uint32_t frames, skips, mismatches;
+
+/*
+ * Each PORTB write comes from an ISR while loop() sleeps, so frame[] and
+ * the phase it was made at go together
+ */
+static void watch(uint8_t)
+{
+  uint16_t p = syncState.phase;
+
+  if (p == lastPhase) {
+    return;
+  }
+
+  uint16_t moved = p - lastPhase;
+  if (p < lastPhase) {
+    moved += syncState.wrap;
+  }
+  if (moved != 1 && skips++ < 5) {
+    printf("  %.3fs: %u steps in one frame\n", simCycles / (double) SYSCLOCK, moved);
+  }
+  lastPhase = p;
+  steps += moved;
+
+  if (lastAt && simCycles - lastAt > longest) {
+    longest = simCycles - lastAt;
+  }
+  lastAt = simCycles;
+  frames++;
+
+  uint8_t *shown = &last[(steps % period) * NUM_CHANNELS];
+  memcpy(shown, frame, NUM_CHANNELS);
+
+  uint8_t *want = &reference[(steps % period) * NUM_CHANNELS];
+  if (steps <= (uint64_t) period) {
+    memcpy(want, frame, NUM_CHANNELS);
+    return;
+  }
+
+  if (memcmp(want, frame, NUM_CHANNELS) && mismatches++ < 5) {
+    printf("  %.3fs: step %u of the cycle shows %d %d %d %d, the first cycle %d %d %d %d\n",
+           simCycles / (double) SYSCLOCK, (unsigned) (steps % period), frame[0], frame[1], frame[2], frame[3],
+           want[0], want[1], want[2], want[3]);
+  }
+}
+
+/*
+ * Each channel's offset against channel 1 in a cycle of levels: the first
+ * that makes the two the same all the way round, -1 if none does
+ */
+static void offsets(const std::vector<uint8_t> &cycle, int *off)
+{
+  for (int c=0; c<NUM_CHANNELS; c++) {
+    off[c] = -1;
+    for (int d=0; d<period && off[c] < 0; d++) {
+      int s;
+      for (s=0; s<period; s++) {
+        if (cycle[s * NUM_CHANNELS + c] != cycle[((s + d) % period) * NUM_CHANNELS]) {
+          break;
+        }
+      }
+      if (s == period) {
+        off[c] = d;
+      }
+    }
+  }
+}
+
+static void send(std::vector<uint64_t> &edges, const std::vector<int> &pulses, uint64_t at)
+{
+  for (long e : ir_edges(pulses, rx, 0)) {
+    edges.push_back(at + USEC(e));
+  }
+}
+
+/*
+ * An hour of traffic from 'start', ending at least a second before the
+ * hour does so the pin is back at SPACE for the next
+ */
+static traffic make_hour(std::vector<uint64_t> &edges, uint64_t start, double gap)
+{
+  traffic sent = { 0, 0, 0, 0 };
+  std::vector<int> p;
+  uint64_t t = start + MSEC(uniform(0, gap * 2000));
+
+  edges.clear();
+  while (t < start + HOUR - MSEC(1000)) {
+    p.clear();
+    switch (uniform(0, 6)) {
+      case 0:
+        nec_bits(p, BTN_ON);
+        send(edges, p, t);
+        sent.nec++;
+        break;
+
+      case 1:
+        nec_bits(p, BTN_0);
+        send(edges, p, t);
+        sent.nec++;
+        break;
+
+      case 2: {
+        // ON held, repeats every 108ms
+        int repeats = uniform(1, 5);
+        nec_bits(p, BTN_ON);
+        send(edges, p, t);
+        for (int r=0; r<repeats; r++) {
+          p.clear();
+          nec_repeat(p);
+          send(edges, p, t += USEC(NEC_REPEAT_PERIOD));
+        }
+        sent.nec += 1 + repeats;
+        break;
+      }
+
+      case 3: {
+        // Another NEC remote, address 0x20
+        uint8_t cmd = uniform(0, 255);
+        nec_bits(p, 0x20DF0000UL | (cmd << 8) | (uint8_t) ~cmd);
+        send(edges, p, t);
+        sent.nec++;
+        break;
+      }
+
+      case 4:
+        if (uniform(0, 1)) {
+          rc5_bits(p, 0x3000 | uniform(0, 63));
+        }
+        else {
+          sony_bits(p, 0x80 | uniform(0, 127));
+        }
+        send(edges, p, t);
+        sent.other++;
+        break;
+
+      case 5: {
+        int n = uniform(1, 10);
+        for (int i=0; i<n; i++, t += MSEC(10)) {
+          edges.push_back(t);
+          edges.push_back(t + USEC(200));
+        }
+        sent.noise += n;
+        break;
+      }
+
+      case 6: {
+        int n = uniform(1, 10);
+        for (int i=0; i<n; i++, t += MSEC(10)) {
+          edges.push_back(t);
+          edges.push_back(t + USEC(60));
+        }
+        sent.glitches += n;
+        break;
+      }
+    }
+
+    t += MSEC(200 + uniform(0, gap * 2000));
+  }
+
+  return sent;
+}
+
+int soak_main(int argc, char **argv)
+{
+  double days = 1, gap = 20, budget = 600;
+  int prog = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:p:g:b:s:")) != -1) {
+    switch (opt) {
+      case 'd': days = atof(optarg); break;
+      case 'p': prog = atoi(optarg); break;
+      case 'g': gap = atof(optarg); break;
+      case 'b': budget = atof(optarg); break;
+      case 's': simRng.seed(atoi(optarg)); break;
+      default:
+        fprintf(stderr, "usage: sim soak [-d days] [-p program] [-g mean gap s] [-b budget s/day] [-s seed]\n");
+        return 2;
+    }
+  }
+  if (prog < 0 || prog >= numPrograms) {
+    fprintf(stderr, "soak: no program %d\n", prog);
+    return 2;
+  }
+
+  // The cycle: every channel's, if they all have one
+  Effect bank[NUM_CHANNELS];
+  program_load(bank, prog);
+  period = 1;
+  for (int c=0; c<NUM_CHANNELS; c++) {
+    int n = bank[c].getNumSteps();
+    if (n <= 0) {
+      fprintf(stderr, "soak: program %d has no cycle to check against\n", prog);
+      return 2;
+    }
+    int a = period, b = n;
+    while (b) {
+      int r = a % b;
+      a = b;
+      b = r;
+    }
+    period = period / a * n;
+  }
+  reference.assign(period * NUM_CHANNELS, 0);
+  last.assign(period * NUM_CHANNELS, 0);
+
+  sim_reset();
+  sim_watch_portb(watch);
+  setup();
+  frame_init(prog);
+  lastPhase = syncState.phase;
+
+  int hours = days * 24 + 0.5;
+  int start[NUM_CHANNELS], now[NUM_CHANNELS];
+  std::vector<uint64_t> edges;
+  uint32_t wrong = 0, rate = 0;
+  double hostSecs = 0;
+
+  printf("soak: program %d, a %d step cycle, %d hours, traffic every %.0fs on average\n", prog, period, hours, gap);
+
+  for (int h=0; h<hours; h++) {
+    uint64_t from = simCycles;
+    traffic sent = make_hour(edges, from, gap);
+    uint16_t decoded = irstats.decoded, failed = irstats.failed;
+    uint16_t noise = irparams.noise, glitches = irparams.glitches;
+    uint32_t framesBefore = frames;
+
+    sim_ir_input(&edges);
+    auto t0 = std::chrono::steady_clock::now();
+    sim_run(loop, from + HOUR);
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - t0;
+    hostSecs += secs.count();
+
+    if (h == 0) {
+      offsets(reference, start);
+    }
+    offsets(last, now);
+
+    uint16_t gotDecoded = irstats.decoded - decoded, gotFailed = irstats.failed - failed;
+    uint16_t gotNoise = irparams.noise - noise, gotGlitches = irparams.glitches - glitches;
+    uint32_t shown = frames - framesBefore;
+    if (h == 0) {
+      rate = shown;
+    }
+    bool ok = !memcmp(start, now, sizeof(start)) && gotDecoded == sent.nec && gotFailed == sent.other &&
+              gotNoise == sent.noise && gotGlitches == sent.glitches && shown > rate * 0.999 &&
+              shown < rate * 1.001;
+
+    if (!ok || (h + 1) % 6 == 0) {
+      printf("%3dh: %u frames, offsets %d %d %d, NEC %u/%u, other %u/%u, noise %u/%u, glitches %u/%u, %.1fs%s\n",
+             h + 1, shown, now[1], now[2], now[3], gotDecoded, sent.nec, gotFailed, sent.other, gotNoise,
+             sent.noise, gotGlitches, sent.glitches, hostSecs, ok ? "" : "  WRONG");
+    }
+    if (!ok) {
+      wrong++;
+    }
+  }
+
+  double longestMs = longest / (double) SYSCLOCK * 1000;
+  double frameMs = rate ? 3600e3 / rate : 0;
+  double perDay = hours ? hostSecs * 24 / hours : 0;
+  bool late = longestMs > 2 * frameMs;
+  bool slow = perDay > budget;
+
+  printf("\n%u frames, %.3fms apart, the longest %.2fms; first cycle offsets %d %d %d, %u frames not as it, "
+         "%u skips\n", frames, frameMs, longestMs, start[1], start[2], start[3], mismatches, skips);
+  printf("%.1fs of host time a simulated day, budget %.0fs%s\n", perDay, budget, slow ? "  OVER" : "");
+
+  bool bad = wrong || mismatches || skips || late || slow || start[1] < 0 || start[2] < 0 || start[3] < 0;
+  printf("\n%s\n", bad ? "FAILED" : "ok");
+  return bad ? 1 : 0;
+}
+
+#else
+
+int soak_main(int, char **)
+{
+  fprintf(stderr, "soak: this build has no IR or no frames\n");
+  return 2;
+}
+
+#endif
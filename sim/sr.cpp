@@ -0,0 +1,245 @@
+// Shift register backend check
+//
+//   sim-sr sr [-p program] [-s seconds]
+//
+// Needs the shift register backend compiled in, so it only works in the
+// binary "make sim-sr" builds. First steps the program's frames directly
+// and checks each output's level against an effect of its own, a copy of
+// its channel's started as far along as its place in the run puts it (see
+// frame.h), through the same dimmer. Then runs setup() and loop() on the
+// timer model with the USI and a chain of 74HC595s modelled in
+// machine.cpp, and checks what the latched outputs actually show:
+//
+//  - every BAM cycle, each output is on for BAM_UNIT timer ticks per unit
+//    of its level in frame[], to the clock, from a single frame (no
+//    tearing between planes of the old and new frame)
+//  - frames come at the H-bridge PWM's period, to within 5%
+//
+// It also reports the interrupt and USI write rates, and a rough ISR length
+// (the sim doesn't execute AVR code) against the shortest BAM slot.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "lights.h"
+#include "shiftreg.h"
+#include "frame.h"
+#include "dimmer.h"
+#include "programs.h"
+#include "sync.h"
+#include "sim.h"
+#include "machine.h"
+
+#ifdef HAS_SHIFTREG
+
+extern void setup();
+extern void loop();
+
+// Nominal ISR cost in clocks: entry, latch, slot bookkeeping and exit, then
+// the unrolled shift, an OUT per USICR write and a load per register
+#define ISR_CLOCKS 48
+#define ISR_CLOCKS_PER_BYTE 3
+
+#define SLOT_CLOCKS (BAM_UNIT * 64)
+
+static struct {
+  uint64_t at;
+  uint32_t outputs;
+} latches[BAM_SLOTS + 1];
+
+// Frames the spread is checked for, two of the longest chase cycle
+#define SPREAD_FRAMES 3000
+
+// The frame period the H-bridge build runs at on the same timer model
+#define HBRIDGE_FRAME_MS 2.08
+
+static uint8_t shows[SR_OUTPUTS];   // frame[] when the cycle was swapped in
+static uint8_t next[SR_OUTPUTS];
+static int slot;
+
+static uint32_t cycles, bad, isrs;
+static uint64_t worstError;
+static uint64_t busy;
+static uint32_t widest;
+static uint32_t lastWrites;
+
+static uint32_t bam(uint8_t level)
+{
+  return level >= MAX_LEVEL ? 255 : level << 1;
+}
+
+static void check_cycle()
+{
+  uint32_t on[SR_OUTPUTS] = { 0 };
+
+  for (int s=0; s<BAM_SLOTS; s++) {
+    uint64_t width = latches[s + 1].at - latches[s].at;
+    for (int o=0; o<SR_OUTPUTS; o++) {
+      if (latches[s].outputs & (1UL << o)) {
+        on[o] += width;
+      }
+    }
+  }
+
+  for (int o=0; o<SR_OUTPUTS; o++) {
+    uint64_t want = bam(shows[o]) * SLOT_CLOCKS;
+    uint64_t error = on[o] > want ? on[o] - want : want - on[o];
+    if (error) {
+      if (bad++ < 5) {
+        printf("  cycle %u output %d: on %u clocks, level %d wants %lu\n",
+               cycles, o, on[o], shows[o], (unsigned long) want);
+      }
+      worstError = std::max(worstError, error);
+    }
+  }
+  cycles++;
+}
+
+/*
+ * Each latch starts a slot; the ISR that latches slot BAM_SLOTS - 1 is the
+ * one that swaps in the next frame, so frame[] is what the next cycle shows
+ */
+static void latched(uint32_t outputs)
+{
+  // What the previous ISR cost, from the USI writes it made
+  if (isrs) {
+    uint32_t writes = simUsiWrites - lastWrites;
+    uint32_t clocks = ISR_CLOCKS + writes + writes / 16 * ISR_CLOCKS_PER_BYTE;
+    busy += clocks;
+    widest = std::max(widest, clocks);
+  }
+  lastWrites = simUsiWrites;
+  isrs++;
+
+  slot++;
+  latches[slot] = { simCycles, outputs };
+  if (slot == BAM_SLOTS) {
+    check_cycle();
+    std::copy(next, next + SR_OUTPUTS, shows);
+    latches[0] = latches[slot];
+    slot = 0;
+  }
+  if (slot == BAM_SLOTS - 1) {
+    std::copy(frame, frame + SR_OUTPUTS, next);
+  }
+}
+
+/*
+ * Program prog's frames, from its first step, against an effect per
+ * output. Returns the frames that differ; spread counts the outputs that
+ * ever showed something other than the first in their run.
+ */
+static uint32_t check_spread(int prog, int &spread)
+{
+  const int copies = SR_OUTPUTS / NUM_CHANNELS;
+  Effect channel[NUM_CHANNELS], output[SR_OUTPUTS];
+  uint8_t want[SR_OUTPUTS];
+  bool differs[SR_OUTPUTS] = { false };
+  uint32_t wrong = 0;
+
+  frame_init(prog);
+  program_load(channel, prog);
+
+  for (int o=0; o<SR_OUTPUTS; o++) {
+    int c = o / copies, k = o % copies;
+    int spacing = channel[(c + 1) % NUM_CHANNELS].stepsAhead(channel[c]);
+
+    output[o] = channel[c];
+    for (int a = k * spacing / copies; a; a--) {
+      output[o].step();
+    }
+  }
+
+  for (int f=0; f<SPREAD_FRAMES; f++) {
+    frame_next();
+    for (int o=0; o<SR_OUTPUTS; o++) {
+      want[o] = output[o].step();
+    }
+    dimmer_apply(want);
+
+    if (memcmp(want, frame, SR_OUTPUTS) && wrong++ < 5) {
+      for (int o=0; o<SR_OUTPUTS; o++) {
+        if (want[o] != frame[o]) {
+          printf("  frame %d output %d: %d, its effect %d\n", f, o, frame[o], want[o]);
+          break;
+        }
+      }
+    }
+    for (int o=0; o<SR_OUTPUTS; o++) {
+      differs[o] = differs[o] || frame[o] != frame[o - o % copies];
+    }
+  }
+
+  spread = std::count(differs, differs + SR_OUTPUTS, true);
+  return wrong;
+}
+
+int sr_main(int argc, char **argv)
+{
+  int prog = 0;
+  double seconds = 2;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "p:s:")) != -1) {
+    switch (opt) {
+      case 'p': prog = atoi(optarg); break;
+      case 's': seconds = atof(optarg); break;
+      default:
+        fprintf(stderr, "usage: sim-sr sr [-p program] [-s seconds]\n");
+        return 2;
+    }
+  }
+
+  sim_reset();
+  setup();
+
+  int spread;
+  uint32_t unspread = check_spread(prog, spread);
+
+  frame_init(prog);
+  uint16_t phase = syncState.phase;
+
+  // The first latch from the ISR starts slot 0 of the first cycle, which
+  // still shows the zeros from init_shiftreg()
+  slot = -1;
+  sim_watch_sr(latched);
+
+  if (!sim_run(loop, seconds * 1e6 * SIM_CYCLES_PER_USEC)) {
+    printf("sr: the firmware went to sleep with nothing to wake it\n");
+    return 1;
+  }
+
+  double secs = simCycles / (double) SYSCLOCK;
+  double frameMs = secs * 1000 / (uint16_t) (syncState.phase - phase);
+  bool offPeriod = frameMs > HBRIDGE_FRAME_MS * 1.05 || frameMs < HBRIDGE_FRAME_MS * 0.95;
+
+  printf("sr: %.1fs of program %d, %d outputs, %u BAM cycles of %.2fms\n\n",
+         secs, prog, SR_OUTPUTS, cycles, BAM_CYCLE_USEC / 1000.0);
+  printf("  outputs off level  %u, worst by %lu clocks\n", bad, (unsigned long) worstError);
+  printf("  off their effect   %u frames of %d\n", unspread, SPREAD_FRAMES);
+  printf("  spread             %d of %d outputs away from the first in their run\n",
+         spread, SR_OUTPUTS - NUM_CHANNELS);
+  printf("  frame period       %.2fms, the H-bridge's %.2fms\n", frameMs, HBRIDGE_FRAME_MS);
+  printf("  interrupts         %.0f/s\n", isrs / secs);
+  printf("  USICR writes       %.0f/s\n", simUsiWrites / secs);
+  printf("  ISR estimate       %u clocks widest, shortest slot %d, %.1f%% of the CPU\n",
+         widest, SLOT_CLOCKS, 100.0 * busy / simCycles);
+
+  return (bad || unspread || offPeriod || widest > SLOT_CLOCKS) ? 1 : 0;
+}
+
+#else
+
+int sr_main(int, char **)
+{
+  fprintf(stderr, "sr: the shift register backend isn't compiled in, use ./sim-sr from \"make sim-sr\"\n");
+  return 2;
+}
+
+#endif /* HAS_SHIFTREG */
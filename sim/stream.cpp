@@ -0,0 +1,235 @@
+// Serial streaming loopback
+//
+//   sim-stream stream [-f frames/s] [-s seconds] [-e corrupt %] [-r seed]
+//
+// Needs the stream build, so it only works in the binary "make sim-stream"
+// builds. Runs setup() and loop() on the timer model with frames encoded
+// the way a PC would send them fed into the USART at the real byte timing
+// (from the baud rate setup() chose), so the RX ISR parses them byte by
+// byte between the firmware's own interrupts. A share of the frames have a
+// bit flipped on the way. Halfway through the PC goes quiet.
+//
+// Each frame has its own levels, so which one the outputs show says which
+// frame got through. Checked:
+//
+//  - no corrupted frame, or anything other than a frame that was sent, is
+//    ever shown while streaming, and every corruption is counted
+//  - every good frame is either shown or counted as dropped
+//  - after the stream stops the effects take over within STREAM_TIMEOUT
+//    frames, give or take one
+//
+// Reported: frames per second achieved against sent, the latency from the
+// CRC byte arriving to the PWM picking up the new levels, and the fallback time.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include <Arduino.h>
+#include <util/crc16.h>
+
+#include "lights.h"
+#include "h-bridge.h"
+#include "frame.h"
+#include "dimmer.h"
+#include "stream.h"
+#include "sim.h"
+#include "irwave.h"
+#include "machine.h"
+
+#ifdef HAS_STREAM
+
+extern void setup();
+extern void loop();
+
+extern volatile uint8_t level1, level2, level3, level4;
+extern volatile int16_t systemTicks;
+
+struct sent {
+  uint8_t shows[NUM_CHANNELS];  // the levels after the dimmer
+  uint64_t done;                // CRC byte received
+  bool corrupt;
+};
+
+static std::vector<sent> frames;
+static size_t nextShown;        // frames before this one can't show again
+static uint64_t stopAt;         // the PC goes quiet
+static uint64_t fallbackAt;     // the effects were back
+
+static uint32_t shown, unexpected;
+static uint32_t loopFrames, lastShownFrame, fallbackFrame;
+static int lastTicks;
+static uint64_t latencySum, latencyMax;
+static uint8_t last[NUM_CHANNELS];
+
+static void encode(std::vector<uint8_t> &wire, const uint8_t *levels)
+{
+  uint8_t crc = 0;
+
+  wire.push_back(STREAM_SYNC);
+  for (int i=0; i<NUM_CHANNELS; i++) {
+    wire.push_back(levels[i]);
+    crc = _crc8_ccitt_update(crc, levels[i]);
+  }
+  wire.push_back(crc);
+}
+
+/*
+ * What loop() has left for the PWM, looked at every time it writes PORTB
+ */
+static void watch(uint8_t)
+{
+  // loop() never returns, but idleFor() starts systemTicks from 0 each frame
+  if (systemTicks < lastTicks) {
+    loopFrames++;
+  }
+  lastTicks = systemTicks;
+
+  uint8_t now[NUM_CHANNELS] = { level1, level2, level3, level4 };
+  if (memcmp(now, last, NUM_CHANNELS) == 0) {
+    return;
+  }
+  memcpy(last, now, NUM_CHANNELS);
+
+  // The effects, until the first frame is in
+  if (simCycles < frames[0].done) {
+    return;
+  }
+  if (fallbackAt) {
+    return;
+  }
+
+  // Frames can be skipped (dropped) but never shown out of order
+  for (size_t n=nextShown; n<frames.size() && frames[n].done <= simCycles; n++) {
+    if (!frames[n].corrupt && memcmp(frames[n].shows, now, NUM_CHANNELS) == 0) {
+      uint64_t latency = simCycles - frames[n].done;
+      latencySum += latency;
+      latencyMax = std::max(latencyMax, latency);
+      shown++;
+      lastShownFrame = loopFrames;
+      nextShown = n + 1;
+      return;
+    }
+  }
+
+  // Anything else after the last frame is the effects taking over
+  if (simCycles >= stopAt) {
+    fallbackAt = simCycles;
+    fallbackFrame = loopFrames;
+    return;
+  }
+  if (unexpected++ < 5) {
+    printf("  %.3fms: levels %d %d %d %d weren't a good frame\n", simCycles / (SIM_CYCLES_PER_USEC * 1000.0),
+           now[0], now[1], now[2], now[3]);
+  }
+}
+
+int stream_main(int argc, char **argv)
+{
+  double fps = 200;
+  double seconds = 2;
+  int corrupt = 5;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "f:s:e:r:")) != -1) {
+    switch (opt) {
+      case 'f': fps = atof(optarg); break;
+      case 's': seconds = atof(optarg); break;
+      case 'e': corrupt = atoi(optarg); break;
+      case 'r': simRng.seed(atoi(optarg)); break;
+      default:
+        fprintf(stderr, "usage: sim-stream stream [-f frames/s] [-s seconds] [-e corrupt %%] [-r seed]\n");
+        return 2;
+    }
+  }
+  if (fps <= 0 || seconds <= 0) {
+    fprintf(stderr, "stream: some frames a second, for some seconds\n");
+    return 2;
+  }
+
+  sim_reset();
+  setup();
+
+  // 10 bits a byte at the rate UBRR0 gives with U2X0
+  const uint64_t byteCycles = 10 * 8 * (UBRR0L + 1);
+  const uint64_t frameCycles = std::max((uint64_t) (SYSCLOCK / fps), STREAM_FRAME * byteCycles);
+  const uint64_t start = simCycles + 1000;
+  stopAt = start + seconds / 2 * SYSCLOCK;
+
+  std::vector<std::pair<uint64_t, uint8_t>> bytes;
+  uint32_t corrupted = 0;
+
+  for (uint64_t at=start; at + STREAM_FRAME * byteCycles < stopAt; at += frameCycles) {
+    sent f;
+    std::vector<uint8_t> wire;
+    uint8_t levels[NUM_CHANNELS];
+    size_t n = frames.size();
+
+    for (int i=0; i<NUM_CHANNELS; i++) {
+      levels[i] = (n * 7 + i * 31) % (MAX_LEVEL + 1);
+    }
+    encode(wire, levels);
+
+    // One bit of a level or the CRC, never into the sync byte's 0xff.
+    // CRC-8 catches every single bit error.
+    f.corrupt = uniform(0, 99) < corrupt;
+    if (f.corrupt) {
+      corrupted++;
+      wire[uniform(1, NUM_CHANNELS + 1)] ^= 1 << uniform(0, 6);
+    }
+
+    for (uint8_t c : wire) {
+      at += byteCycles;
+      bytes.push_back({ at, c });
+    }
+    f.done = at;
+    at -= STREAM_FRAME * byteCycles;
+
+    memcpy(f.shows, levels, NUM_CHANNELS);
+    dimmer_apply(f.shows);
+    frames.push_back(f);
+  }
+  sim_serial_input(&bytes);
+  sim_watch_portb(watch);
+
+  if (!sim_run(loop, start + seconds * SYSCLOCK)) {
+    printf("stream: the firmware went to sleep with nothing to wake it\n");
+    return 1;
+  }
+
+  const double streamed = (stopAt - start) / (double) SYSCLOCK;
+  const double frameUsec = (simCycles - start) / (double) SIM_CYCLES_PER_USEC / loopFrames;
+  const uint32_t fallbackFrames = fallbackFrame - lastShownFrame;
+  uint32_t good = streamStats.frames;
+  uint32_t dropped = streamStats.dropped;
+
+  printf("stream: %.1fs streamed at %.0f frames/s (the link takes %.0f), %lu bytes, main loop %.2fms a frame\n\n",
+         streamed, fps, SYSCLOCK / (double) (STREAM_FRAME * byteCycles), (unsigned long) bytes.size(), frameUsec / 1000);
+  printf("  frames sent         %lu, %u corrupted\n", (unsigned long) frames.size(), corrupted);
+  printf("  bad CRC             %u\n", streamStats.badCrc);
+  printf("  received            %u, %u dropped before they were shown\n", good + dropped, dropped);
+  printf("  shown               %u, %.1f frames/s\n", shown, shown / streamed);
+  printf("  not a good frame    %u\n", unexpected);
+  printf("  latency             %.2fms mean, %.2fms worst\n",
+         shown ? latencySum / (shown * SIM_CYCLES_PER_USEC * 1000.0) : 0, latencyMax / (SIM_CYCLES_PER_USEC * 1000.0));
+  printf("  effects back after  %u frames (timeout %d), %.0fms\n", fallbackFrames, STREAM_TIMEOUT,
+         fallbackAt ? (fallbackAt - frames.back().done) / (SIM_CYCLES_PER_USEC * 1000.0) : 0);
+
+  bool ok = !unexpected && streamStats.badCrc == corrupted &&
+            good + dropped == frames.size() - corrupted && shown == good &&
+            fallbackAt && fallbackFrames >= STREAM_TIMEOUT && fallbackFrames <= STREAM_TIMEOUT + 2;
+  return ok ? 0 : 1;
+}
+
+#else
+
+int stream_main(int, char **)
+{
+  fprintf(stderr, "stream: streaming isn't compiled in, use ./sim-stream from \"make sim-stream\"\n");
+  return 2;
+}
+
+#endif /* HAS_STREAM */
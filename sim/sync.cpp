@@ -0,0 +1,378 @@
+// Effect phase sync across boards, over hours
+//
+//   sim sync [-n followers] [-H hours] [-c clock spread %] [-w wander ppm/h]
+//            [-l beacon loss %] [-j late joiner minutes] [-s seed]
+//
+// First one beacon goes through the real thing: setup() and loop() on the
+// timer model, the NEC waveform on IR_PIN, the IR ISR stamping the phase
+// and decode() handing it to sync_beacon(), to check the error it comes up
+// with.
+//
+// Then a leader and several followers run side by side at the frame level,
+// through the real sync_steps() and sync_beacon() (each node's sync state
+// is swapped in for its turn). Every board has its own clock error, which
+// wanders, and they power up within a second of each other, except one
+// more follower that powers up minutes later (-j), into the program the
+// leader is running, as persist would bring it back. Beacons take
+// their true time on air plus the IR gap before they decode, a share of
+// them are lost, and while one is coming in the follower doesn't nudge, as
+// on the board. Halfway through the leader moves to the next program and
+// one follower misses the key press.
+//
+// Reported per hour: the worst and mean phase error of the followers
+// against the leader once locked, in ms, next to how far apart the worst
+// pair would have drifted free running. The late joiner has to lock
+// within the time it takes to make up half the cycle, plus three beacon
+// periods for the first and any lost, and a second between samples.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "lights.h"
+#include "h-bridge.h"
+#include "shiftreg.h"
+#include "ir.h"
+#include "frame.h"
+#include "programs.h"
+#include "sync.h"
+#include "sim.h"
+#include "irwave.h"
+#include "machine.h"
+
+extern void setup();
+extern void loop();
+
+#if defined(HAS_HBRIDGE)
+# define FRAME_USEC (1e6 * FRAME_MS * TICKS_PER_MS * (PWM_OCR + 1) / SYSCLOCK)
+#else
+# define FRAME_USEC (FRAME_MS * TICKS_PER_MS * BAM_UNIT_USEC)
+#endif
+
+// Receiver lag before the header mark shows, and the gap decode() waits
+// for after the last mark
+#define RX_LAG 60
+#define DECODE_GAP (GAP_TICKS * USEC_PER_TICK)
+
+// Locked is within this many steps of the leader, plus what the two clocks
+// drift apart between beacons: a follower with a fast clock is only ever
+// that close just after a correction
+#define LOCKED_STEPS 2
+
+// node::rx
+#define RX_NONE 0
+#define RX_WAITING 1
+#define RX_STAMPED 2
+
+struct node {
+  double clock;         // frequency error, parts per unit
+  double prev, next;    // us, last and next frame
+  syncstate_t sync;
+  uint8_t program;
+  uint16_t stamp;
+  uint8_t rx;           // where it's got to with the beacon in flight
+  bool hears;           // it, or loses it
+  bool deaf;            // misses the program change
+  bool locked;
+  double drift;         // us ahead of the leader, free running
+  double since;         // when it last lost lock, or powered up
+};
+
+static std::vector<node> nodes;
+
+static void swap_in(node &n)
+{
+  syncState = n.sync;
+  program = n.program;
+  syncStamp = n.stamp;
+}
+
+static void swap_out(node &n)
+{
+  n.sync = syncState;
+  n.program = program;
+}
+
+/*
+ * Steps a is ahead of b, on the same program: the short way round its
+ * cycle, if it has one
+ */
+static int phase_diff(const syncstate_t &a, const syncstate_t &b)
+{
+  int d = (int) a.phase - b.phase;
+
+  if (a.cycle == 0) {
+    return (int16_t) d;
+  }
+  d %= a.cycle;
+  if (d > a.cycle / 2) {
+    d -= a.cycle;
+  }
+  else if (d < -(a.cycle / 2)) {
+    d += a.cycle;
+  }
+  return d;
+}
+
+static double gauss()
+{
+  static std::normal_distribution<double> d(0, 1);
+  return d(simRng);
+}
+
+/*
+ * One beacon through setup(), loop() and the IR ISR, 'ahead' steps ahead
+ * of this board. Returns false if it didn't come out as that error.
+ */
+static bool check_firmware()
+{
+  const uint16_t ahead = 40;
+  const double at = 0.5e6;
+
+  sim_reset();
+  setup();
+  frame_init(0);
+  sim_run(loop, at * SIM_CYCLES_PER_USEC);
+  uint16_t before = syncState.phase;
+
+  std::vector<int> p;
+  nec_bits(p, ((uint32_t) SYNC_ADDR << 24) | (uint16_t) (before + ahead));
+  std::vector<uint64_t> edges;
+  const receiver clean = { RX_LAG, 10, 0, 0 };
+  for (long e : ir_edges(p, clean, at + 1000)) {
+    edges.push_back(e * SIM_CYCLES_PER_USEC);
+  }
+  sim_ir_input(&edges);
+
+  const double after = 150000;
+  sim_run(loop, (at + after) * SIM_CYCLES_PER_USEC);
+
+  // Stamped as the header mark came in, a frame or so after 'before'
+  int16_t stamped = syncStamp - before;
+  int16_t error = (uint16_t) (before + ahead) - syncStamp;
+  int16_t nudges = error - syncState.owed;
+  bool ok = syncState.beacons == 1 && stamped >= 0 && stamped <= 1 &&
+            nudges >= 0 && nudges <= after / FRAME_USEC / SYNC_SLEW;
+
+  printf("firmware: beacon %d steps ahead, stamped %d step(s) on, error %d, %d nudged so far: %s\n",
+         ahead, stamped, error, nudges, ok ? "ok" : "WRONG");
+  return ok;
+}
+
+int sync_main(int argc, char **argv)
+{
+  int followers = 4;
+  double hours = 3;
+  double spread = 1.0;
+  double wander = 200;
+  int loss = 10;
+  double join = 5;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:H:c:w:l:j:s:")) != -1) {
+    switch (opt) {
+      case 'n': followers = atoi(optarg); break;
+      case 'H': hours = atof(optarg); break;
+      case 'c': spread = atof(optarg); break;
+      case 'w': wander = atof(optarg); break;
+      case 'l': loss = atoi(optarg); break;
+      case 'j': join = atof(optarg); break;
+      case 's': simRng.seed(atoi(optarg)); break;
+      default:
+        fprintf(stderr, "usage: sim sync [-n followers] [-H hours] [-c clock spread %%] "
+                        "[-w wander ppm/h] [-l beacon loss %%] [-j late joiner minutes] [-s seed]\n");
+        return 2;
+    }
+  }
+  if (followers < 1 || followers > 32 || hours <= 0 || join <= 0 || join * 60 >= hours * 1800) {
+    fprintf(stderr, "sync: 1 to 32 followers, some hours, and a late joiner before the program change\n");
+    return 2;
+  }
+
+  bool ok = check_firmware();
+
+  // Node 0 is the leader, the last follower but one misses the program
+  // change, the last powers up late
+  nodes.assign(followers + 2, node());
+  frame_init(0);
+  for (auto &n : nodes) {
+    n.clock = uniform(-1000, 1000) * spread / 100000.0;
+    n.next = uniform(0, 1000000);
+    n.prev = n.next - FRAME_USEC;
+    n.sync = syncState;
+  }
+  nodes[followers].deaf = true;
+
+  node &late = nodes.back();
+  const double joinAt = join * 60e6;
+  late.next = late.since = joinAt;
+  late.prev = late.next - FRAME_USEC;
+  const double lateBound = (nodes[0].sync.cycle / 2 * SYNC_SLEW + 3 * SYNC_PERIOD) * FRAME_USEC + 1e6;
+  double lateLock = -1;
+
+  const double end = hours * 3600e6;
+  const double change = end / 2;
+  bool changed = false;
+
+  uint32_t value = 0;
+  double decodeAt = 0, stampAt = 0;
+  uint16_t untilBeacon = SYNC_PERIOD;
+
+  double hourMax = 0, hourSum = 0, worst = 0, lastRecovery = 0;
+  long hourSamples = 0, hourNudges = 0;
+  double sampleAt = 1e6;
+  int hour = 0;
+
+  printf("sync: leader and %d followers, %.1fh, clocks within %.1f%% wandering %.0fppm/h, %d%% of beacons lost\n\n",
+         followers, hours, spread, wander, loss);
+  printf("  hour  worst (ms)  mean (ms)  nudges   free running (s)\n");
+
+  for (;;) {
+    node *n = &nodes[0];
+    for (auto &m : nodes) {
+      if (m.next < n->next) {
+        n = &m;
+      }
+    }
+    double t = n->next;
+
+    // Once a second: error samples and clock wander
+    while (sampleAt <= t) {
+      node &lead = nodes[0];
+      double leadPhase = lead.sync.phase + (sampleAt - lead.prev) / (lead.next - lead.prev);
+
+      for (size_t i=1; i<nodes.size(); i++) {
+        node &f = nodes[i];
+        double phase = f.sync.phase + (sampleAt - f.prev) / (f.next - f.prev);
+        double steps = phase_diff(f.sync, lead.sync) + (phase - f.sync.phase) - (leadPhase - lead.sync.phase);
+
+        if (f.program != lead.program || sampleAt < f.since) {
+          f.locked = false;
+          continue;
+        }
+        if (!f.locked && fabs(steps) <= LOCKED_STEPS + fabs(f.clock - lead.clock) * SYNC_PERIOD) {
+          f.locked = true;
+          lastRecovery = std::max(lastRecovery, sampleAt - f.since);
+          if (&f == &late && lateLock < 0) {
+            lateLock = sampleAt - f.since;
+          }
+        }
+        if (f.locked) {
+          double ms = fabs(steps) * FRAME_USEC / 1000;
+          hourMax = std::max(hourMax, ms);
+          worst = std::max(worst, ms);
+          hourSum += ms;
+          hourSamples++;
+        }
+      }
+
+      double leadClock = lead.clock;
+      double freeWorst = 0;
+      for (auto &m : nodes) {
+        m.clock += wander * 1e-6 * gauss() / 60;
+        m.drift += (m.clock - leadClock) * 1e6;
+        for (auto &o : nodes) {
+          freeWorst = std::max(freeWorst, fabs(m.drift - o.drift));
+        }
+      }
+
+      sampleAt += 1e6;
+      if (sampleAt >= std::min((hour + 1) * 3600e6, end) && hour < ceil(hours)) {
+        printf("  %4d  %10.2f  %9.2f  %6ld   %16.1f\n", hour + 1, hourMax,
+               hourSamples ? hourSum / hourSamples : 0, hourNudges, freeWorst / 1e6);
+        hour++;
+        hourMax = hourSum = 0;
+        hourSamples = hourNudges = 0;
+      }
+    }
+    if (t > end) {
+      break;
+    }
+
+    // NEXT on the remote, which the deaf follower doesn't see. It's an IR
+    // frame itself, so not while a beacon is coming in.
+    bool quiet = true;
+    for (auto &m : nodes) {
+      quiet = quiet && m.rx == RX_NONE;
+    }
+    if (!changed && t >= change && quiet) {
+      changed = true;
+      for (auto &m : nodes) {
+        if (!m.deaf) {
+          swap_in(m);
+          frame_select(program + 1 < numPrograms ? program + 1 : 0);
+          swap_out(m);
+        }
+        else {
+          m.locked = false;
+        }
+        m.since = t;
+      }
+    }
+
+    if (n->rx == RX_WAITING && t > stampAt) {
+      n->stamp = n->sync.phase;
+      n->rx = RX_STAMPED;
+    }
+
+    // An IR frame coming in holds off nudges until it's decoded
+    irparams.rcvstate = (n->rx == RX_STAMPED) ? STATE_MARK : STATE_IDLE;
+
+    swap_in(*n);
+    uint8_t steps = sync_steps();
+    if (steps != 1) {
+      hourNudges++;
+    }
+    if (n->rx == RX_STAMPED && t >= decodeAt) {
+      n->rx = RX_NONE;
+      if (n->hears) {
+        syncStamp = n->stamp;
+        sync_beacon(value);
+      }
+    }
+    swap_out(*n);
+
+    if (n == &nodes[0] && --untilBeacon == 0) {
+      untilBeacon = SYNC_PERIOD;
+
+      // A new beacon, the last one long since decoded everywhere
+      value = ((uint32_t) SYNC_ADDR << 24) | ((uint32_t) n->program << 16) | n->sync.phase;
+      std::vector<int> p;
+      nec_bits(p, value);
+      long air = 0;
+      for (int us : p) {
+        air += us;
+      }
+      stampAt = t + RX_LAG;
+      decodeAt = t + air + DECODE_GAP;
+      for (size_t i=1; i<nodes.size(); i++) {
+        nodes[i].rx = t >= nodes[i].since ? RX_WAITING : RX_NONE;
+        nodes[i].hears = uniform(0, 99) >= loss;
+      }
+    }
+    n->prev = t;
+    n->next = t + FRAME_USEC / (1 + n->clock);
+  }
+
+  irparams.rcvstate = STATE_IDLE;
+
+  bool locked = true;
+  for (size_t i=1; i<nodes.size(); i++) {
+    locked = locked && nodes[i].locked;
+  }
+
+  bool lateOk = lateLock >= 0 && lateLock <= lateBound;
+
+  printf("\n  worst error once locked %.2fms (%.1f frames), slowest to lock after power up or\n"
+         "  the missed key %.1fs, %s\n", worst, worst * 1000 / FRAME_USEC, lastRecovery / 1e6,
+         locked ? "all locked at the end" : "NOT ALL LOCKED at the end");
+  printf("  late joiner, powered up %.1f minutes in, locked in %.1fs (%.1fs allowed)%s\n",
+         join, lateLock / 1e6, lateBound / 1e6, lateOk ? "" : ", TOO SLOW");
+
+  return ok && locked && lateOk ? 0 : 1;
+}
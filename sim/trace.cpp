@@ -0,0 +1,219 @@
+// Logic analyser view of the firmware
+//
+//   sim-trace trace [-p program] [-s seconds] [-k key@seconds ...] [-o trace.vcd]
+//
+// Needs the markers compiled in, so it only works in the binary "make
+// sim-trace" builds. Runs setup() and loop() on the timer model with the
+// markers from src/trace.h as VCD signals, next to the channel pins and
+// IR_PIN, so the file lines up with a capture of the UNO's pins 2 to 7 or
+// the ATtiny's PB5. Keys (on, off, up, down, next, prev, 0-4) are sent as
+// clean NEC frames.
+//
+// The sim doesn't execute AVR code, so each marker charges a nominal cost
+// in clocks as it ends, from traceCost below. Treat the widths as
+// estimates; what the trace does model is the ordering, ISRs preempting
+// the main loop, and the lateness that follows from that.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "lights.h"
+#include "remote.h"
+#include "frame.h"
+#include "trace.h"
+#include "sim.h"
+#include "vcd.h"
+#include "irwave.h"
+#include "machine.h"
+
+#ifdef TRACE
+
+extern void setup();
+extern void loop();
+
+// Rough AVR clocks per marked region, excluding anything nested in it
+static const uint16_t traceCost[NUM_TRACE] = {
+  70,     // TRACE_PWM
+#ifdef HAS_IR_ON_PWM
+  50,     // TRACE_IR, ir_sample() inside the PWM ISR
+#else
+  110,    // TRACE_IR, the Timer 1 ISR's entry, reload and exit, and ir_sample()
+#endif
+  14,     // TRACE_PHASE
+  2500,   // TRACE_DECODE, a full NEC frame
+  160,    // TRACE_STEP, a mid priced effect
+  900,    // TRACE_FRAME, modulation graph, crossfade and dimmer
+};
+
+static const char *traceName[NUM_TRACE] = { "pwm_isr", "ir_isr", "phase", "decode", "step", "frame" };
+
+// VCD times are in 100ps, so a 16MHz clock is a whole 625
+#define VCD_SCALE "100ps"
+#define VCD_PER_CYCLE (10000000 / (SYSCLOCK / 1000000) / 1000)
+
+static bool tracing;
+static Vcd vcd;
+static int traceSignal[NUM_TRACE];
+static int pinSignal[5];
+
+static std::vector<uint64_t> irEdges;
+static size_t irNext;
+
+/*
+ * VCD times have to go forwards, so IR edges (known in advance) are
+ * written as the run catches up with them
+ */
+static void emit(int signal, uint32_t value)
+{
+  while (irNext < irEdges.size() && irEdges[irNext] <= simCycles) {
+    vcd.change(irEdges[irNext] * VCD_PER_CYCLE, pinSignal[4], irNext & 1);
+    irNext++;
+  }
+  vcd.change(simCycles * VCD_PER_CYCLE, signal, value);
+}
+
+static struct {
+  uint32_t count;
+  uint64_t since;
+  uint64_t busy;
+  uint64_t widest;
+} traceStats[NUM_TRACE];
+
+void sim_trace(uint8_t marker, uint8_t level)
+{
+  if (!tracing) {
+    return;
+  }
+
+  if (level) {
+    traceStats[marker].since = simCycles;
+  }
+  else {
+    sim_spend(traceCost[marker]);
+    uint64_t width = simCycles - traceStats[marker].since;
+    traceStats[marker].count++;
+    traceStats[marker].busy += width;
+    traceStats[marker].widest = std::max(traceStats[marker].widest, width);
+  }
+  emit(traceSignal[marker], level);
+}
+
+static void pins(uint8_t portb)
+{
+  static const uint8_t mask[4] = {
+    CHANNEL1_PIN_A_MASK, CHANNEL1_PIN_B_MASK, CHANNEL2_PIN_A_MASK, CHANNEL2_PIN_B_MASK
+  };
+
+  for (int i=0; i<4; i++) {
+    emit(pinSignal[i], (portb & mask[i]) != 0);
+  }
+}
+
+static const struct {
+  const char *name;
+  uint32_t code;
+} keys[] = {
+  { "on", BTN_ON }, { "off", BTN_OFF }, { "up", BTN_UP }, { "down", BTN_DOWN },
+  { "next", BTN_NEXT }, { "prev", BTN_PREV }, { "0", BTN_0 }, { "1", BTN_1 },
+  { "2", BTN_2 }, { "3", BTN_3 }, { "4", BTN_4 },
+};
+
+int trace_main(int argc, char **argv)
+{
+  int prog = 0;
+  double seconds = 0.2;
+  const char *path = "trace.vcd";
+  std::vector<std::pair<double, uint32_t>> presses;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "p:s:k:o:")) != -1) {
+    switch (opt) {
+      case 'p': prog = atoi(optarg); break;
+      case 's': seconds = atof(optarg); break;
+      case 'o': path = optarg; break;
+      case 'k': {
+        char name[8];
+        double at;
+        bool found = false;
+        if (sscanf(optarg, "%7[^@]@%lf", name, &at) == 2) {
+          for (auto &k : keys) {
+            if (strcmp(name, k.name) == 0) {
+              presses.push_back({ at, k.code });
+              found = true;
+            }
+          }
+        }
+        if (!found) {
+          fprintf(stderr, "trace: -k wants key@seconds, keys on off up down next prev 0-4\n");
+          return 2;
+        }
+        break;
+      }
+      default:
+        fprintf(stderr, "usage: sim-trace trace [-p program] [-s seconds] [-k key@seconds ...] [-o trace.vcd]\n");
+        return 2;
+    }
+  }
+
+  // IR input
+  std::vector<uint64_t> &edges = irEdges;
+  const receiver clean = { 60, 10, 0, 0 };
+  std::sort(presses.begin(), presses.end());
+  for (auto &k : presses) {
+    std::vector<int> p;
+    nec_bits(p, k.second);
+    for (long e : ir_edges(p, clean, k.first * 1e6)) {
+      edges.push_back(e * SIM_CYCLES_PER_USEC);
+    }
+  }
+
+  if (!vcd.open(path, VCD_SCALE)) {
+    perror(path);
+    return 1;
+  }
+  for (int m=0; m<NUM_TRACE; m++) {
+    traceSignal[m] = vcd.add(traceName[m], 1);
+  }
+  pinSignal[0] = vcd.add("ch1_a", 1);
+  pinSignal[1] = vcd.add("ch1_b", 1);
+  pinSignal[2] = vcd.add("ch2_a", 1);
+  pinSignal[3] = vcd.add("ch2_b", 1);
+  pinSignal[4] = vcd.add("ir", 1);
+
+  sim_reset();
+  tracing = true;
+  setup();
+  frame_init(prog);
+  sim_ir_input(&edges);
+  sim_watch_portb(pins);
+
+  emit(pinSignal[4], 1);
+  sim_run(loop, seconds * 1e6 * SIM_CYCLES_PER_USEC);
+  tracing = false;
+  vcd.close();
+
+  printf("trace: %.3fs of program %d to %s\n\n", seconds, prog, path);
+  printf("  marker      count    busy   widest (us)\n");
+  for (int m=0; m<NUM_TRACE; m++) {
+    printf("  %-8s %8u  %5.1f%%  %7.1f\n", traceName[m], traceStats[m].count,
+           100.0 * traceStats[m].busy / simCycles, traceStats[m].widest / (double) SIM_CYCLES_PER_USEC);
+  }
+
+  return 0;
+}
+
+#else
+
+int trace_main(int, char **)
+{
+  fprintf(stderr, "trace: the markers aren't compiled in, use ./sim-trace from \"make sim-trace\"\n");
+  return 2;
+}
+
+#endif /* TRACE */
@@ -0,0 +1,78 @@
+#include "vcd.h"
+
+Vcd::~Vcd()
+{
+  close();
+}
+
+/*
+ * Times passed to change() are in units of 'scale', "1us" unless given
+ */
+bool Vcd::open(const char *path, const char *scale)
+{
+  timescale = scale;
+  out = fopen(path, "w");
+  return out != nullptr;
+}
+
+/*
+ * Declare a signal, before the first change
+ */
+int Vcd::add(const char *name, int width)
+{
+  Signal s = { name, width, (char) ('!' + signals.size()), 0, false };
+
+  signals.push_back(s);
+  return signals.size() - 1;
+}
+
+void Vcd::start()
+{
+  fprintf(out, "$timescale %s $end\n$scope module lights $end\n", timescale);
+  for (auto &s : signals) {
+    fprintf(out, "$var wire %d %c %s $end\n", s.width, s.id, s.name.c_str());
+  }
+  fprintf(out, "$upscope $end\n$enddefinitions $end\n");
+  started = true;
+}
+
+/*
+ * Record a value, only written out if it differs from the last one
+ */
+void Vcd::change(uint64_t t, int signal, uint32_t value)
+{
+  Signal &s = signals[signal];
+
+  if (!out || (s.known && s.value == value)) {
+    return;
+  }
+  if (!started) {
+    start();
+  }
+  if ((int64_t) t != now) {
+    fprintf(out, "#%llu\n", (unsigned long long) t);
+    now = t;
+  }
+
+  if (s.width == 1) {
+    fprintf(out, "%u%c\n", value & 1, s.id);
+  }
+  else {
+    fprintf(out, "b");
+    for (int bit = s.width - 1; bit >= 0; bit--) {
+      fputc((value >> bit) & 1 ? '1' : '0', out);
+    }
+    fprintf(out, " %c\n", s.id);
+  }
+
+  s.value = value;
+  s.known = true;
+}
+
+void Vcd::close()
+{
+  if (out) {
+    fclose(out);
+    out = nullptr;
+  }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+// Minimal value change dump writer, for viewing in GTKWave or PulseView
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+class Vcd {
+  private:
+    FILE *out = nullptr;
+    bool started = false;
+    const char *timescale = "1us";
+    int64_t now = -1;
+
+    struct Signal {
+      std::string name;
+      int width;
+      char id;
+      uint32_t value;
+      bool known;
+    };
+    std::vector<Signal> signals;
+
+    void start();
+
+  public:
+    ~Vcd();
+    bool open(const char *path, const char *scale = "1us");
+    int add(const char *name, int width);
+    void change(uint64_t t, int signal, uint32_t value);
+    void close();
+};
@@ -0,0 +1,284 @@
+// Warm start after a reset
+//
+//   sim warm [-n resets] [-p program] [-s seed]
+//
+// Runs setup() and loop() on the timer model and resets the board every
+// second or two: sim_power_cycle() with MCUSR set for the kind of reset,
+// then setup() and loop() again. The firmware's other statics aren't reset
+// the way the C runtime would, so this checks what survives in the WARM
+// block, not that the rest starts clean; the frame cache, which a warm
+// start must render again, is filled with noise.
+//
+// Every frame's levels are checked against a reference run that never
+// reset, by the frame's sync phase (one step a frame, there are no
+// beacons here). After a warm start they must carry on exactly from the
+// frame they were at; after a cold start the program starts again from
+// step 0 and must match the reference from there. Which one happens is
+// checked too:
+//
+//  - watchdog and brown-out: warm
+//  - watchdog with a byte of the block changed, as a reset in the middle
+//    of a frame would leave it: cold
+//  - power on, with the block full of noise, and the reset pin: cold
+//  - a burst of watchdog resets: warm WARM_RETRIES times, then cold
+//
+// And how long a warm start keeps the lights waiting: the cycles from the
+// reset to the first Timer 0 compare, when the PWM is showing the old
+// levels again. setup() is charged for what it does that takes time, the
+// block's checksum, the EEPROM reads and CRCs in persist_init(), and the C
+// runtime before it for clearing the rest of RAM. The worst must be under
+// RESUME_USEC.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include <Arduino.h>
+#include <avr/sleep.h>
+
+#include "lights.h"
+#include "h-bridge.h"
+#include "shiftreg.h"
+#include "frame.h"
+#include "sync.h"
+#include "warm.h"
+#include "programs.h"
+#include "sim.h"
+#include "irwave.h"
+#include "machine.h"
+
+#ifdef HAS_WARM
+
+extern void setup();
+extern void loop();
+
+extern uint8_t __start_warm[], __stop_warm[];
+
+#if defined(HAS_HBRIDGE)
+# define FRAME_USEC (1e6 * FRAME_MS * TICKS_PER_MS * (PWM_OCR + 1) / SYSCLOCK)
+#else
+# define FRAME_USEC (FRAME_MS * TICKS_PER_MS * BAM_UNIT_USEC)
+#endif
+
+// The C runtime's .bss clear and .data copy, at most the ATtiny85's RAM
+// outside the block at 6 clocks a byte
+#define RAM_BYTES 512
+#define CRT_BYTE_CYCLES 6
+
+#define RESUME_USEC 500
+
+struct shown {
+  uint8_t level[NUM_OUTPUTS];
+};
+
+static std::vector<shown> reference;
+static std::vector<bool> seen;
+static bool recording, resetting;
+static uint16_t lastPhase;
+static uint32_t frames, mismatches;
+
+/*
+ * Each PORTB write comes from an ISR while loop() sleeps, so frame[] and
+ * the phase it was made at go together
+ */
+static void watch(uint8_t)
+{
+  uint16_t p = syncState.phase;
+
+  // Not while the block is being scribbled on, or during setup()
+  if (resetting || p == lastPhase) {
+    return;
+  }
+  lastPhase = p;
+
+  shown s;
+  memcpy(s.level, frame, NUM_OUTPUTS);
+
+  if (recording) {
+    if (p >= reference.size()) {
+      reference.resize(p + 1);
+      seen.resize(p + 1);
+    }
+    reference[p] = s;
+    seen[p] = true;
+    return;
+  }
+
+  if (p < reference.size() && seen[p]) {
+    frames++;
+    if (memcmp(reference[p].level, s.level, NUM_OUTPUTS) && mismatches++ < 5) {
+      printf("  %.3fs: phase %u shows %d %d %d %d, the reference %d %d %d %d\n", simCycles / (double) SYSCLOCK, p,
+             s.level[0], s.level[1], s.level[2], s.level[3], reference[p].level[0], reference[p].level[1],
+             reference[p].level[2], reference[p].level[3]);
+    }
+  }
+}
+
+/*
+ * The start every run makes: cold, program prog from step 0
+ */
+static void cold_start(int prog)
+{
+  sim_power_cycle();
+  setup();
+  frame_init(prog);
+  lastPhase = 0xffff;
+}
+
+/*
+ * Asleep until the first Timer 0 ISR since the reset, as loop() would be
+ */
+static void first_compare()
+{
+  while (!simT0First) {
+    sleep_cpu();
+  }
+}
+
+#define RESET_WDT 0
+#define RESET_BOD 1
+#define RESET_TORN 2
+#define RESET_POWER 3
+#define RESET_PIN 4
+#define RESET_BURST 5
+
+static const char *resetNames[] = { "watchdog", "brown-out", "watchdog mid-frame", "power on", "reset pin", "burst" };
+
+int warm_main(int argc, char **argv)
+{
+  int resets = 60;
+  int prog = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:p:s:")) != -1) {
+    switch (opt) {
+      case 'n': resets = atoi(optarg); break;
+      case 'p': prog = atoi(optarg); break;
+      case 's': simRng.seed(atoi(optarg)); break;
+      default:
+        fprintf(stderr, "usage: sim warm [-n resets] [-p program] [-s seed]\n");
+        return 2;
+    }
+  }
+
+  // Resets far enough apart for the retries to settle, and a reference long
+  // enough for any run between cold starts but inside the 16 bit phase
+  const double between = 2 * WARM_SETTLE * FRAME_USEC / 1e6, longest = 30;
+
+  sim_reset();
+  sim_watch_portb(watch);
+  recording = true;
+  cold_start(prog);
+  sim_run(loop, longest * SYSCLOCK);
+  recording = false;
+
+  uint32_t wrong[6] = { 0 }, count[6] = { 0 };
+  uint32_t warmStarts = 0;
+  uint64_t resumeSum = 0, resumeMax = 0;
+  const uint32_t crtCycles = (RAM_BYTES - (__stop_warm - __start_warm)) * CRT_BYTE_CYCLES;
+
+  cold_start(prog);
+  double sinceCold = 0;
+
+  for (int r=0; r<resets; r++) {
+    int kind = uniform(0, 5);
+    int burst = kind == RESET_BURST ? WARM_RETRIES + 1 : 1;
+    double on = between * uniform(700, 1300) / 1000;
+
+    // Cold starts often enough that the phase stays inside the reference
+    if (sinceCold + on > longest - 2 * between) {
+      kind = RESET_POWER;
+      burst = 1;
+    }
+
+    sim_run(loop, simCycles + on * SYSCLOCK);
+    sinceCold += on;
+    count[kind]++;
+
+    for (int b=0; b<burst; b++) {
+      uint16_t before = syncState.phase;
+      bool expectWarm = kind == RESET_WDT || kind == RESET_BOD || (kind == RESET_BURST && b < WARM_RETRIES);
+
+      resetting = true;
+      if (kind == RESET_TORN) {
+        // Some of the block whose owners we know, the control fields
+        // aren't summed
+        uint8_t *p = uniform(0, 1) ? frame + uniform(0, NUM_OUTPUTS - 1) :
+                                     (uint8_t *) &syncState + uniform(0, sizeof(syncState) - 1);
+        *p ^= 1 << uniform(0, 7);
+      }
+      if (kind == RESET_POWER) {
+        for (uint8_t *p = __start_warm; p < __stop_warm; p++) {
+          *p = uniform(0, 255);
+        }
+      }
+
+      sim_power_cycle();
+#ifdef HAS_FRAME_CACHE
+      for (int i=0; i<FRAME_CACHE_STEPS; i++) {
+        frameCache[i] = uniform(0, 255);
+      }
+#endif
+      switch (kind) {
+        case RESET_WDT: case RESET_TORN: case RESET_BURST: MCUSR = _BV(WDRF); break;
+        case RESET_BOD: MCUSR = _BV(BORF); break;
+        case RESET_PIN: MCUSR = _BV(EXTRF); break;
+      }
+      sim_spend(crtCycles);
+      setup();
+      resetting = false;
+
+      bool warm = syncState.phase == before && before != 0;
+      if (warm) {
+        sim_run(first_compare, simCycles + FRAME_USEC * SIM_CYCLES_PER_USEC);
+        warmStarts++;
+        resumeSum += simT0First;
+        resumeMax = std::max(resumeMax, simT0First);
+      }
+      if (warm != expectWarm) {
+        if (wrong[kind]++ < 3) {
+          printf("  %s reset at phase %u: %s start, should have been %s\n", resetNames[kind], before,
+                 warm ? "warm" : "cold", expectWarm ? "warm" : "cold");
+        }
+      }
+      if (!warm) {
+        frame_init(prog);
+        sinceCold = 0;
+      }
+
+      // A few frames before the next of a burst, not enough to settle
+      if (b + 1 < burst) {
+        sim_run(loop, simCycles + 0.05 * SYSCLOCK);
+      }
+    }
+  }
+
+  printf("warm: %d resets of program %d, %u frames checked against the reference\n\n", resets, prog, frames);
+  printf("  reset               times  wrong start\n");
+  uint32_t bad = 0;
+  for (int k=0; k<6; k++) {
+    printf("  %-19s %5u  %5u\n", resetNames[k], count[k], wrong[k]);
+    bad += wrong[k];
+  }
+  printf("\n  frames that didn't match the reference %u\n", mismatches);
+
+  const double perUsec = SIM_CYCLES_PER_USEC;
+  bool slow = resumeMax > RESUME_USEC * perUsec;
+  printf("  reset to PWM after a warm start       %.0fus mean, %.0fus worst of %d allowed%s\n",
+         warmStarts ? resumeSum / perUsec / warmStarts : 0.0, resumeMax / perUsec, RESUME_USEC, slow ? ", TOO SLOW" : "");
+
+  return (bad || mismatches || slow) ? 1 : 0;
+}
+
+#else
+
+int warm_main(int, char **)
+{
+  fprintf(stderr, "warm: this build has no warm start\n");
+  return 2;
+}
+
+#endif /* HAS_WARM */
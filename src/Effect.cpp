@@ -1,6 +1,11 @@
 #include <Arduino.h>
 
+#include "lights.h"
+#include "fixed.h"
 #include "Effect.h"
+#include "modgraph.h"
+#include "trace.h"
+#include "warm.h"
 
 const static PROGMEM int sineTable[] = {
   0, 2, 4, 7, 9, 11, 13, 16, 18, 20,
@@ -14,38 +19,332 @@ const static PROGMEM int sineTable[] = {
   126, 126, 127, 127, 127, 128, 128, 128, 128, 128
 };
 
-Effect::Effect(volatile uint8_t *channelData, int firstStep, int nSteps) {
-  level = channelData;
+// Strobe flashes are STROBE_ON steps long, one every STROBE_PERIOD steps
+#define STROBE_PERIOD 32
+#define STROBE_ON 4
+
+#ifdef HAS_FRAME_CACHE
+// What the cache holds. The levels are rendered again after a warm start,
+// so only this is kept.
+typedef struct {
+  uint8_t render;       // count of renders, never 0 once there has been one
+  uint8_t kind;
+  uint8_t param;
+  int16_t numSteps;
+} cachekey_t;
+
+static cachekey_t cacheKey WARM;
+uint8_t frameCache[FRAME_CACHE_STEPS];
+
+// Steps of the cycle rendered so far, from step 0, and the effect
+// rendering the rest
+static int16_t rendered;
+static Effect renderer;
+#endif
+
+void Effect::init(uint8_t fxKind, int firstStep, int nSteps, uint8_t fxParam) {
+  kind = fxKind;
+  param = fxParam;
   stepNum = firstStep;
   numSteps = nSteps;
+  level = 0;
+#ifdef HAS_FRAME_CACHE
+  cached = 0;
+#endif
+
+  switch (kind) {
+    case FX_TWINKLE:
+    case FX_CANDLE:
+      // Different seed per channel, never zero
+      state = 0xace1 ^ (firstStep << 3) ^ param;
+      if (state == 0) {
+        state = 1;
+      }
+      if (kind == FX_CANDLE) {
+        level = param;
+      }
+      break;
+
+    case FX_BREATHE:
+      // Period is 2^param steps
+      numSteps = 1 << param;
+      stepNum &= numSteps - 1;
+      break;
+
+    case FX_CHASE:
+      // Number of steps the channel is lit for
+      state = ((uint32_t) numSteps * param) >> 8;
+      break;
+  }
 }
 
-void Effect::step() {
-  if (blackout) {
-    *level = 0;
-    return;
+uint8_t Effect::step() {
+  TRACE_ON(TRACE_STEP);
+
+#ifdef HAS_FRAME_CACHE
+  if (cached && cached == cacheKey.render && stepNum < rendered) {
+    level = frameCache[stepNum];
+  }
+  else {
+    level = generate();
   }
-  
+#else
+  level = generate();
+#endif
+
+  stepNum++;
+  if (stepNum >= numSteps) {
+    stepNum = 0;
+  }
+
+  TRACE_OFF(TRACE_STEP);
+  return level;
+}
+
+uint8_t Effect::generate() {
+  switch (kind) {
+    case FX_TWINKLE:
+      return stepTwinkle();
+    case FX_STROBE:
+      return stepStrobe();
+    case FX_BREATHE:
+      return stepBreathe();
+    case FX_CANDLE:
+      return stepCandle();
+    case FX_CHASE:
+      return stepChase();
+    case FX_GRAPH:
+      return stepGraph();
+    default:
+      return stepSineChase();
+  }
+}
+
+/*
+ * 16 bit xorshift, (7, 9, 8) triple. Period 65535, needs a non-zero seed.
+ */
+uint8_t Effect::random8() {
+  uint16_t x = state;
+
+  x ^= x << 7;
+  x ^= x >> 9;
+  x ^= x << 8;
+  state = x;
+
+  return (uint8_t) x;
+}
+
+/*
+ * The original effect: a sine shaped pulse at the start of every cycle,
+ * held at the top, then dark for the last 200 steps.
+ */
+uint8_t Effect::stepSineChase() {
   if (stepNum < 90) {
     // Ramp down
-    //*level = sineTable[90-stepNum]>>1;
-    *level = pgm_read_word_near(sineTable + (90 - stepNum));
+    return pgm_read_word_near(sineTable + (89 - stepNum));
   }
   else if (stepNum < 180) {
     // Ramp up
-    //*level = sineTable[stepNum-90]>>1;
-    *level = pgm_read_word_near(sineTable + (stepNum - 90));
+    return pgm_read_word_near(sineTable + (stepNum - 90));
   }
   else if (stepNum > (numSteps-200)) {
-    *level = 0;
+    return 0;
   }
 
-  stepNum++;
-  if (stepNum >= numSteps) {
-    stepNum = 0;
+  // From the table rather than the last level, so a channel that starts
+  // part way through the cycle is lit there too
+  return pgm_read_word_near(sineTable + 89);
+}
+
+/*
+ * param is the chance of a sparkle on each step, out of 256. A sparkle
+ * jumps to full brightness and then decays by 1/8th per step.
+ */
+uint8_t Effect::stepTwinkle() {
+  if (random8() < param) {
+    return MAX_LEVEL;
+  }
+
+  return level - ((level + 7) >> 3);
+}
+
+/*
+ * A burst of param flashes at the start of every cycle of numSteps
+ */
+uint8_t Effect::stepStrobe() {
+  if (stepNum < (int16_t) param * STROBE_PERIOD && (stepNum & (STROBE_PERIOD - 1)) < STROBE_ON) {
+    return MAX_LEVEL;
   }
+
+  return 0;
+}
+
+/*
+ * Slow in, slow out: a triangle wave squared, one cycle per 2^param steps
+ * (param must be at least 8).
+ */
+uint8_t Effect::stepBreathe() {
+  uint8_t t = stepNum >> (param - 8);
+
+  t = (t < 128) ? t << 1 : (255 - t) << 1;
+
+  return scale8(t, t) >> 1;
+}
+
+/*
+ * Random walk around param, with the odd dip when the "wind" blows
+ */
+uint8_t Effect::stepCandle() {
+  uint8_t r = random8();
+  int16_t l = level + (r & 7) - 4;
+
+  if (r > 250) {
+    l -= 24;
+  }
+
+  // Drift back towards the base level
+  if (l < param) {
+    l++;
+  }
+  else if (l > param) {
+    l--;
+  }
+
+  if (l < (param >> 1)) {
+    l = param >> 1;
+  }
+  else if (l > MAX_LEVEL) {
+    l = MAX_LEVEL;
+  }
+
+  return l;
+}
+
+/*
+ * Hard edged chase, lit for the first param/256ths of every cycle
+ */
+uint8_t Effect::stepChase() {
+  return (stepNum < (int16_t) state) ? MAX_LEVEL : 0;
+}
+
+/*
+ * Channel param of the modulation graph output, scaled to a PWM level
+ */
+uint8_t Effect::stepGraph() {
+  return (modOutput[param] + 1) >> 1;
 }
 
 int Effect::getNumSteps() {
   return numSteps;
 }
+
+uint8_t Effect::isGraph() {
+  return kind == FX_GRAPH;
+}
+
+/*
+ * Sine chase, strobe, breathe and chase: the level is a function of the
+ * step alone, so any step of the cycle can be worked out on its own
+ */
+uint8_t Effect::stepOnly() {
+  return kind != FX_TWINKLE && kind != FX_CANDLE && kind != FX_GRAPH;
+}
+
+/*
+ * How many steps this effect is ahead of e, 0 to numSteps - 1, if both
+ * run the same cycle of a step-only kind. 0 if they don't.
+ */
+int16_t Effect::stepsAhead(const Effect &e) {
+  if (!stepOnly() || kind != e.kind || param != e.param || numSteps != e.numSteps) {
+    return 0;
+  }
+
+  int16_t d = stepNum - e.stepNum;
+  return d < 0 ? d + numSteps : d;
+}
+
+/*
+ * The level ahead steps (0 to numSteps - 1) on from the one step() last
+ * returned, leaving the effect where it is. Only for a step-only kind,
+ * see stepsAhead().
+ */
+uint8_t Effect::peek(int16_t ahead) {
+  int16_t now = stepNum;
+  int16_t s = now - 1 + ahead;
+
+  if (s < 0) {
+    s += numSteps;
+  }
+  else if (s >= numSteps) {
+    s -= numSteps;
+  }
+
+#ifdef HAS_FRAME_CACHE
+  if (cached && cached == cacheKey.render && s < rendered) {
+    return frameCache[s];
+  }
+#endif
+
+  stepNum = s;
+  uint8_t l = generate();
+  stepNum = now;
+
+  return l;
+}
+
+#ifdef HAS_FRAME_CACHE
+/*
+ * Called by program_load() after init(): play this effect back from the
+ * cache if it can be, starting a render of its cycle there unless it's
+ * already the one the cache holds. Until frame_cache_render() has got to
+ * a step, the effect works it out as it would without the cache.
+ */
+void Effect::cache() {
+  cached = 0;
+
+  if (!stepOnly() || numSteps > FRAME_CACHE_STEPS) {
+    return;
+  }
+
+  if (!cacheKey.render || kind != cacheKey.kind || param != cacheKey.param || numSteps != cacheKey.numSteps) {
+    cacheKey.kind = kind;
+    cacheKey.param = param;
+    cacheKey.numSteps = numSteps;
+    if (++cacheKey.render == 0) {
+      cacheKey.render = 1;
+    }
+    frame_cache_restore();
+  }
+
+  cached = cacheKey.render;
+}
+
+/*
+ * Start rendering the cycle the cache holds again, from step 0. Called
+ * after a warm start, when the effects that play it back find it empty
+ * and fall back on their generators until it's done.
+ */
+void frame_cache_restore() {
+  rendered = 0;
+  if (cacheKey.render) {
+    renderer.init(cacheKey.kind, 0, cacheKey.numSteps, cacheKey.param);
+  }
+}
+
+/*
+ * Called once a frame: render the next FRAME_CACHE_SLICE steps of the
+ * cycle. Returns 0 once it's all there.
+ */
+uint8_t frame_cache_render() {
+  if (!cacheKey.render) {
+    return 0;
+  }
+
+  for (uint8_t i=0; i<FRAME_CACHE_SLICE && rendered < cacheKey.numSteps; i++) {
+    frameCache[rendered] = renderer.step();
+    rendered++;
+  }
+
+  return rendered < cacheKey.numSteps;
+}
+#endif
@@ -1,14 +1,84 @@
 #pragma once
 
+// Effect kinds, see Effect.cpp for what param means to each of them.
+//
+// Rough worst-case AVR cost of one step(), including the dispatch. Run
+// "sim bench" for the host timings we track between changes.
+//
+//   FX_SINE_CHASE  ~40 cycles   sine pulse chase (the original effect)
+//   FX_TWINKLE     ~60 cycles   random sparkles that decay
+//   FX_STROBE      ~35 cycles   bursts of short flashes
+//   FX_BREATHE     ~110 cycles  squared triangle, ATtiny (~50 with MUL)
+//   FX_CANDLE      ~75 cycles   random walk flicker
+//   FX_CHASE       ~30 cycles   on/off chase with a configurable duty
+//   FX_GRAPH       ~25 cycles   output of the modulation graph, see modgraph.h
+#define FX_SINE_CHASE 0
+#define FX_TWINKLE    1
+#define FX_STROBE     2
+#define FX_BREATHE    3
+#define FX_CANDLE     4
+#define FX_CHASE      5
+#define FX_GRAPH      6
+
+#define NUM_FX_KINDS  7
+
+// With HAS_FRAME_CACHE (-DFRAME_CACHE, UNO only), an effect whose level
+// is a function of the step alone (sine chase, strobe, breathe, chase)
+// and whose cycle is at most FRAME_CACHE_STEPS long is rendered once,
+// after a program loads it, and then played back from RAM: step() is one
+// array read. There is one cache, so the channels of a program that run
+// the same cycle at different offsets, the chase programs, share it.
+// Loading a program with another cycle renders that and leaves the
+// effects on the old one, the outgoing side of a crossfade, to their
+// generators.
+//
+// The render is FRAME_CACHE_SLICE steps a frame, so neither a program
+// change nor a warm start stalls the frame it happens in; a step that
+// isn't rendered yet is worked out by the generator as usual. 768 steps
+// take 48 frames, about 0.1s.
+#define FRAME_CACHE_STEPS 768
+#define FRAME_CACHE_SLICE 16
+
+// Every kind runs off the same few bytes of state, no allocation and no
+// virtual dispatch, so a bank of them is a plain array.
 class Effect {
   private:
-    volatile uint8_t *level;
+    uint8_t kind;
+    uint8_t param;
+    uint8_t level;
     int16_t stepNum;
-    int16_t numSteps = 720;
-    uint8_t blackout = 0;
+    int16_t numSteps;
+    uint16_t state;     // random seed or precomputed constant, per kind
+#ifdef HAS_FRAME_CACHE
+    uint8_t cached;     // the render it plays back, 0 for none
+#endif
+
+    uint8_t generate();
+    uint8_t stepOnly();
+    uint8_t stepSineChase();
+    uint8_t stepTwinkle();
+    uint8_t stepStrobe();
+    uint8_t stepBreathe();
+    uint8_t stepCandle();
+    uint8_t stepChase();
+    uint8_t stepGraph();
+    uint8_t random8();
 
   public:
-    Effect(volatile uint8_t *channelData, int firstStep, int nSteps);
-    void step();
+    void init(uint8_t fxKind, int firstStep, int nSteps, uint8_t fxParam);
+    uint8_t step();
     int getNumSteps();
-};
\ No newline at end of file
+    uint8_t isGraph();
+    int16_t stepsAhead(const Effect &e);
+    uint8_t peek(int16_t ahead);
+#ifdef HAS_FRAME_CACHE
+    void cache();
+#endif
+};
+
+#ifdef HAS_FRAME_CACHE
+extern uint8_t frameCache[FRAME_CACHE_STEPS];
+
+extern void frame_cache_restore();
+extern uint8_t frame_cache_render();
+#endif
@@ -0,0 +1,133 @@
+#include <Arduino.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "lights.h"
+#include "audio.h"
+#include "instrument.h"
+
+#ifdef HAS_AUDIO
+
+// Sums the ISR keeps for audio_frame(), over count samples
+typedef struct {
+  uint8_t count;
+  int16_t sum;          // samples, about the mid rail
+  uint16_t low;         // low band sizes, less the offset
+  uint16_t high;        // high band sizes
+} audiosums_t;
+
+uint8_t audioLevel[AUDIO_BANDS];
+
+static volatile audiosums_t sums;
+static volatile int8_t offset;  // what the input sits at, from the sums
+
+static int8_t ring[AUDIO_TAPS];
+static uint8_t ringPos;
+static int16_t lowSum;
+
+static int16_t offsetAvg;       // offset, 6 bits of fraction
+static uint16_t env[AUDIO_BANDS];       // 8 bits of fraction
+static uint16_t peak[AUDIO_BANDS];
+
+ISR(ADC_vect, ISR_NOBLOCK)
+{
+#ifdef SIM
+  SPEND(AUDIO_ISR_BLOCKED);
+  sei();
+#endif
+  INSTRUMENT_ADC_ENTER();
+
+  int8_t x = ADCH ^ 0x80;
+  uint8_t i = ringPos;
+
+  lowSum += x - ring[i];
+  ring[i] = x;
+  ringPos = (i + 1) & (AUDIO_TAPS - 1);
+
+  // The main loop is away (blink_number(), a long decode): keep the
+  // moving sum going and what we have so far
+  if (sums.count == 255) {
+    SPEND(AUDIO_ISR_IDLE_CYCLES - AUDIO_ISR_BLOCKED);
+    INSTRUMENT_ADC_EXIT();
+    return;
+  }
+
+  int8_t low = lowSum >> AUDIO_TAPS_SHIFT;
+  int16_t l = low - offset;
+  int16_t h = x - low;
+
+  sums.count++;
+  sums.sum += x;
+  sums.low += (uint8_t) (l < 0 ? -l : l);
+  sums.high += (uint8_t) (h < 0 ? -h : h);
+  SPEND(AUDIO_ISR_CYCLES - AUDIO_ISR_BLOCKED);
+  INSTRUMENT_ADC_EXIT();
+}
+
+void init_audio()
+{
+  // AVcc reference, A0, left adjusted; the digital input buffer off
+  ADMUX = _BV(REFS0) | _BV(ADLAR) | AUDIO_MUX;
+  DIDR0 |= _BV(ADC0D);
+
+  // Free running (ADTS = 0) at SYSCLOCK / 128, interrupt on each result
+  ADCSRB = 0;
+  ADCSRA = _BV(ADEN) | _BV(ADSC) | _BV(ADATE) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+}
+
+/*
+ * Called once a frame, before the effects: take the ISR's sums and move
+ * the envelopes and levels on
+ */
+void audio_frame()
+{
+  audiosums_t s;
+  uint8_t sreg = SREG;
+
+  cli();
+  s = *(audiosums_t *) &sums;
+  sums.count = 0;
+  sums.sum = 0;
+  sums.low = 0;
+  sums.high = 0;
+  SREG = sreg;
+
+  if (s.count == 0) {
+    return;
+  }
+
+  // The offset follows the average over ~128 frames, too slow to take
+  // anything off a bass note
+  int8_t mean = s.sum / s.count;
+  offsetAvg += ((mean << 6) - offsetAvg) >> 7;
+  offset = offsetAvg >> 6;
+
+  uint8_t avg[AUDIO_BANDS] = { (uint8_t) (s.low / s.count), (uint8_t) (s.high / s.count) };
+
+  for (uint8_t b=0; b<AUDIO_BANDS; b++) {
+    uint16_t in = avg[b] > AUDIO_GATE ? (uint16_t) avg[b] << 8 : 0;
+
+    if (in > env[b]) {
+      env[b] += (in - env[b]) >> AUDIO_ATTACK;
+    }
+    else {
+      env[b] -= (env[b] - in) >> AUDIO_RELEASE;
+    }
+
+    peak[b] -= peak[b] >> AUDIO_PEAK_FALL;
+    if (env[b] > peak[b]) {
+      peak[b] = env[b];
+    }
+
+    uint16_t ref = peak[b] >> 8;
+    if (ref < AUDIO_FLOOR) {
+      ref = AUDIO_FLOOR;
+    }
+
+    uint16_t level = (env[b] >> 8) * 255U / ref;
+    audioLevel[b] = level > 255 ? 255 : level;
+  }
+}
+
+#endif /* HAS_AUDIO */
@@ -0,0 +1,63 @@
+#pragma once
+
+#ifdef HAS_AUDIO
+
+// Lights that pulse with music, built with -DAUDIO (the uno_audio
+// PlatformIO environment).
+//
+// A microphone module or a line input, biased to half the supply as the
+// usual electret preamp boards are, goes to A0. The ADC free runs on it
+// with its clock at SYSCLOCK / 128, a conversion every 13 clocks of that
+// (9615 samples a second), left adjusted so the ISR only reads ADCH.
+//
+// The ADC ISR splits each sample into two bands: low is a moving sum of
+// the last AUDIO_TAPS samples (down 3dB at ~270Hz, kick drum and bass),
+// high is the sample less that (everything above). It adds up each
+// band's size, and the samples for the mid rail offset, and no more;
+// audio_frame() takes the sums once a frame and does the rest:
+//
+//  - an envelope per band, quick to rise and slower to fall
+//  - a gain that follows the loudest it has been lately, so a quiet room
+//    and a loud one both swing the lights through their range
+//  - audioLevel[], 0 to 255, which MOD_AUDIO nodes feed into a patch
+//
+// The ISR is ISR_NOBLOCK: it turns interrupts straight back on, so the
+// Timer 0 PWM ISR is held off by a handful of clocks at most rather than
+// the whole ADC ISR. At the ~170 clocks a sample estimated below (counted
+// from the generated code) that is ~10% of the CPU. sim audio charges the
+// ISRs those clocks, so its figure is the same estimate; what it checks
+// is what they do to the PWM ISR. The uno_audio_instrument environment
+// measures the ISR on the board, see instrument.h.
+
+#if !defined(UNO) && !defined(SIM)
+# error Audio needs a free ADC pin, A0 on the UNO
+#endif
+
+#define AUDIO_MUX 0             // ADC0, A0
+
+#define AUDIO_TAPS 16           // moving sum length for the low band
+#define AUDIO_TAPS_SHIFT 4
+
+#define AUDIO_ATTACK 1          // envelope rise, 1/2 of the way a frame
+#define AUDIO_RELEASE 5         // and fall, 1/32 (~60ms)
+#define AUDIO_PEAK_FALL 9       // the gain's reference falls 1/512 a frame
+#define AUDIO_FLOOR 24          // least reference, so silence stays dark
+#define AUDIO_GATE 2            // band averages at or below this are noise
+
+#define AUDIO_LOW 0
+#define AUDIO_HIGH 1
+#define AUDIO_BANDS 2
+
+// ADC ISR clocks: to its sei(), the whole of it, and the whole of it when
+// the main loop hasn't taken the sums for 255 samples and it just keeps
+// the low band going
+#define AUDIO_ISR_BLOCKED 8
+#define AUDIO_ISR_CYCLES 170
+#define AUDIO_ISR_IDLE_CYCLES 110
+
+extern uint8_t audioLevel[AUDIO_BANDS];
+
+extern void init_audio();
+extern void audio_frame();
+
+#endif
@@ -0,0 +1,210 @@
+#include <Arduino.h>
+#include <string.h>
+
+#include <avr/sleep.h>
+
+#include "lights.h"
+#include "h-bridge.h"
+#include "frame.h"
+#include "irsample.h"
+#include "instrument.h"
+#include "trace.h"
+#include "warm.h"
+
+#ifdef HAS_MULTI_BRIDGE
+
+static uint8_t pwmTicks = 127;
+static uint8_t phase = PHI_2;
+volatile uint8_t running WARM;
+
+// PWM ticks since idleFor() started its wait, as in h-bridge.cpp
+volatile int16_t systemTicks = 0;
+
+#ifdef HAS_IR_ON_PWM
+static uint8_t irDivider;
+#endif
+
+// Edge lists, [set][phase][edge], one set shown and one being built. The
+// ISR swaps them at the start of a phase once output_frame() says so.
+static hbedge_t edges[2][2][HB_EDGES];
+static volatile uint8_t shown = 0;
+static volatile uint8_t pending = 0;
+
+static const hbedge_t *edge = edges[0][PHI_1];
+static uint8_t blanked = 0;
+
+// Each bridge's port (0 B, 1 D, 2 C) and its A and B pins, see h-bridge.h
+static const uint8_t bridgePort[8] = { 0, 0, 1, 1, 1, 2, 2, 2 };
+static const uint8_t bridgePin[2][8] = {
+  { _BV(4), _BV(2), _BV(7), _BV(5), _BV(3), _BV(0), _BV(2), _BV(4) },
+  { _BV(3), _BV(1), _BV(6), _BV(4), _BV(2), _BV(1), _BV(3), _BV(5) }
+};
+
+/*
+ * One write to each port with bridges on it. The other pins on a port
+ * (IR, LED, serial) are read back as they are.
+ */
+static inline void write_ports(const uint8_t *image)
+{
+  PORTB = (PORTB & ~HB_PINS_B) | image[0];
+#if HB_PORTS > 1
+  PORTD = (PORTD & ~HB_PINS_D) | image[1];
+#endif
+#if HB_PORTS > 2
+  PORTC = (PORTC & ~HB_PINS_C) | image[2];
+#endif
+}
+
+ISR(TIMER0_COMPA_vect) {
+  TRACE_ON(TRACE_PWM);
+  INSTRUMENT_T0_ENTER();
+  sleep_disable();
+
+  systemTicks++;
+
+  // Reset counter
+  INSTRUMENT_T0_RESET();
+  TCNT0 = 0;
+
+#ifdef HAS_IR_ON_PWM
+  // The IR sample Timer 1 would have taken, lights on or off
+  if (++irDivider >= IR_PWM_TICKS) {
+    irDivider = 0;
+    TRACE_ON(TRACE_IR);
+    ir_sample();
+    TRACE_OFF(TRACE_IR);
+  }
+#endif
+
+  if (running == 0) {
+    // All the pins low once, and start on a new phase when it's back on
+    if (!blanked) {
+      static const uint8_t dark[HB_PORTS] = { 0 };
+      write_ports(dark);
+      pwmTicks = 127;
+      blanked = 1;
+    }
+    INSTRUMENT_T0_EXIT();
+    TRACE_OFF(TRACE_PWM);
+    return;
+  }
+  blanked = 0;
+
+  if (++pwmTicks >= 128) {
+    // Time to switch phase
+    TRACE_ON(TRACE_PHASE);
+
+    pwmTicks = 0;
+    phase ^= 1;
+
+    if (pending) {
+      shown ^= 1;
+      pending = 0;
+    }
+    edge = edges[shown][phase];
+
+    TRACE_OFF(TRACE_PHASE);
+  }
+
+  // The list ends with HB_NEVER, which pwmTicks never gets to
+  if (pwmTicks == edge->tick) {
+    write_ports(edge->port);
+    edge++;
+  }
+
+  INSTRUMENT_T0_EXIT();
+  TRACE_OFF(TRACE_PWM);
+}
+
+/*
+ * Timer zero is used for the H-Bridge PWM, as in h-bridge.cpp
+ */
+static void setup_timer0()
+{
+  TCCR0A = 0;
+  TCCR0B = _BV(CS00);
+  TCNT0 = 0;
+  OCR0A = PWM_OCR;
+
+#ifdef ATTINY
+  TIMSK = _BV(OCIE0A);
+#else
+  TIMSK0 = _BV(OCIE0A);
+#endif
+}
+
+void init_hbridge()
+{
+  static const uint8_t dark[HB_PORTS] = { 0 };
+
+  // All outputs off, then the schedule for the levels frame[] was left
+  // at, so after a warm start the PWM carries on from its first tick
+  write_ports(dark);
+  DDRB |= HB_PINS_B;
+#if HB_PORTS > 1
+  DDRD |= HB_PINS_D;
+#endif
+#if HB_PORTS > 2
+  DDRC |= HB_PINS_C;
+#endif
+
+  output_frame(frame);
+  setup_timer0();
+}
+
+/*
+ * Turn a frame into each phase's edge list for the PWM ISR: all of the
+ * phase's pins high at tick 0, then each output low from the tick after
+ * its level, the lowest first. Levels of 127 and up stay on the whole
+ * phase, as they do in h-bridge.cpp.
+ */
+void output_frame(const uint8_t *frame)
+{
+  // Don't let the ISR swap in a half built set. Once pending is clear
+  // 'shown' can't change under us.
+  pending = 0;
+  hbedge_t (*build)[HB_EDGES] = edges[shown ^ 1];
+
+  for (uint8_t p=0; p<2; p++) {
+    hbedge_t *e = build[p];
+    uint8_t level[BRIDGES];
+    uint8_t on = 0;             // bridges still to go low, a bit each
+
+    memset(e->port, 0, HB_PORTS);
+    for (uint8_t b=0; b<BRIDGES; b++) {
+      level[b] = frame[b + p * BRIDGES];
+      e->port[bridgePort[b]] |= bridgePin[p][b];
+      if (level[b] < MAX_LEVEL - 1) {
+        on |= 1 << b;
+      }
+    }
+    e->tick = 0;
+
+    while (on) {
+      // The lowest level left, and every output at it in one edge
+      uint8_t lowest = 0xff;
+      for (uint8_t b=0; b<BRIDGES; b++) {
+        if ((on & (1 << b)) && level[b] < lowest) {
+          lowest = level[b];
+        }
+      }
+
+      hbedge_t *n = e + 1;
+      memcpy(n->port, e->port, HB_PORTS);
+      for (uint8_t b=0; b<BRIDGES; b++) {
+        if ((on & (1 << b)) && level[b] == lowest) {
+          n->port[bridgePort[b]] &= ~bridgePin[p][b];
+          on &= ~(1 << b);
+        }
+      }
+      n->tick = lowest + 1;
+      e = n;
+    }
+
+    (e + 1)->tick = HB_NEVER;
+  }
+
+  pending = 1;
+}
+
+#endif /* HAS_MULTI_BRIDGE */
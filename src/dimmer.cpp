@@ -0,0 +1,93 @@
+#include <Arduino.h>
+
+#include "lights.h"
+#include "dimmer.h"
+#include "frame.h"
+#include "fixed.h"
+#include "warm.h"
+
+uint8_t masterLevel WARM;
+uint8_t channelTrim[NUM_CHANNELS] WARM;
+
+static uint8_t gain[NUM_CHANNELS] WARM;
+static uint8_t target WARM;
+
+static void update_gains()
+{
+  for (uint8_t i=0; i<NUM_CHANNELS; i++) {
+    gain[i] = scale8(channelTrim[i], masterLevel);
+  }
+}
+
+void dimmer_init()
+{
+  masterLevel = 255;
+  target = DIM_MASTER;
+  for (uint8_t i=0; i<NUM_CHANNELS; i++) {
+    channelTrim[i] = 255;
+  }
+
+  update_gains();
+}
+
+/*
+ * Choose what the up/down keys adjust: DIM_MASTER or a channel number
+ */
+void dimmer_select(uint8_t t)
+{
+  if (t == DIM_MASTER || t < NUM_CHANNELS) {
+    target = t;
+  }
+}
+
+/*
+ * Set the master level or a channel trim directly
+ */
+void dimmer_set(uint8_t t, uint8_t v)
+{
+  if (t == DIM_MASTER) {
+    masterLevel = v;
+  }
+  else if (t < NUM_CHANNELS) {
+    channelTrim[t] = v;
+  }
+
+  update_gains();
+}
+
+/*
+ * Step the selected level up (dir > 0) or down. The step grows with the
+ * number of NEC repeat codes seen since the key went down, so holding the
+ * key sweeps the whole range in a second or two.
+ */
+void dimmer_adjust(int8_t dir, uint8_t repeats)
+{
+  uint8_t shift = repeats / DIM_ACCEL_REPEATS;
+  uint8_t *value = (target == DIM_MASTER) ? &masterLevel : &channelTrim[target];
+
+  if (shift > DIM_MAX_SHIFT) {
+    shift = DIM_MAX_SHIFT;
+  }
+
+  uint8_t step = DIM_STEP << shift;
+
+  if (dir > 0) {
+    *value = (*value > 255 - step) ? 255 : *value + step;
+  }
+  else {
+    *value = (*value < step) ? 0 : *value - step;
+  }
+
+  update_gains();
+}
+
+/*
+ * Apply the combined gains to a freshly produced frame, in place. An
+ * output takes the gain of the channel whose run it's in.
+ */
+void dimmer_apply(uint8_t *frame)
+{
+  for (uint8_t i=0; i<NUM_OUTPUTS; i++) {
+    frame[i] = scale8(frame[i], gain[spread_channel(i, NUM_OUTPUTS, NUM_CHANNELS)]);
+  }
+}
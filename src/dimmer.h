@@ -0,0 +1,21 @@
+#pragma once
+
+// Master brightness and per-channel trim.
+//
+// Both are 8 bit gains where 255 is full brightness. They are folded into
+// one gain per channel whenever they change, so applying them to a frame
+// costs a single scale8() per channel and nothing at all in the PWM ISR.
+
+#define DIM_MASTER 0xff   // dimmer_select() target for the master level
+
+// Step per key press, doubled every DIM_ACCEL_REPEATS NEC repeat codes
+// up to DIM_STEP << DIM_MAX_SHIFT
+#define DIM_STEP 4
+#define DIM_ACCEL_REPEATS 4
+#define DIM_MAX_SHIFT 3
+
+extern void dimmer_init();
+extern void dimmer_select(uint8_t target);
+extern void dimmer_set(uint8_t target, uint8_t value);
+extern void dimmer_adjust(int8_t dir, uint8_t repeats);
+extern void dimmer_apply(uint8_t *frame);
@@ -0,0 +1,66 @@
+#pragma once
+
+// Small fixed point helpers shared by the frame stages. None of these are
+// meant to be called from an ISR.
+
+// Scale v by (g + 1) / 256, so g = 255 passes v through unchanged and
+// g = 0 gives 0.
+static inline uint8_t scale8(uint8_t v, uint8_t g)
+{
+#ifdef __AVR_HAVE_MUL__
+  return ((uint16_t) v * (g + 1)) >> 8;
+#else
+  // No hardware multiplier on the ATtiny, shift and add instead. Unrolled:
+  // a loop costs a counter, a mask and a branch on top of each add.
+  uint16_t acc = v;
+  uint16_t x = v;
+
+  if (g & 0x01) acc += x;
+  x <<= 1;
+  if (g & 0x02) acc += x;
+  x <<= 1;
+  if (g & 0x04) acc += x;
+  x <<= 1;
+  if (g & 0x08) acc += x;
+  x <<= 1;
+  if (g & 0x10) acc += x;
+  x <<= 1;
+  if (g & 0x20) acc += x;
+  x <<= 1;
+  if (g & 0x40) acc += x;
+  x <<= 1;
+  if (g & 0x80) acc += x;
+
+  return acc >> 8;
+#endif
+}
+
+// Crossfade from a to b. mix = 0 gives a, mix = 255 gives b.
+//
+// Without a multiplier the mix is taken in sixteenths, so a channel costs
+// four shift and adds rather than eight: a fade moves in 16 steps of at
+// most 8 levels, and mix 0 and 255 are still exactly a and b.
+static inline uint8_t blend8(uint8_t a, uint8_t b, uint8_t mix)
+{
+#ifdef __AVR_HAVE_MUL__
+  if (b >= a) {
+    return a + scale8(b - a, mix);
+  }
+
+  return a - scale8(a - b, mix);
+#else
+  uint8_t m = (mix + 8) >> 4;   // 0 to 16
+  uint8_t d = b >= a ? b - a : a - b;
+  uint16_t acc = 0;
+
+  if (m & 16) {
+    return b;
+  }
+  if (m & 1) acc += d;
+  if (m & 2) acc += (uint16_t) d << 1;
+  if (m & 4) acc += (uint16_t) d << 2;
+  if (m & 8) acc += (uint16_t) d << 3;
+
+  return b >= a ? a + (acc >> 4) : a - (acc >> 4);
+#endif
+}
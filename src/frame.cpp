@@ -0,0 +1,183 @@
+#include <Arduino.h>
+
+#include "lights.h"
+#include "frame.h"
+#include "fixed.h"
+#include "dimmer.h"
+#include "power.h"
+#include "programs.h"
+#include "modgraph.h"
+#include "sync.h"
+#include "trace.h"
+#include "warm.h"
+
+uint8_t frame[NUM_OUTPUTS] WARM;
+uint8_t program WARM;
+uint16_t fadeFrames = FADE_FRAMES;
+
+// Two banks of effects: the live program and, while a crossfade is
+// running, the program we are fading to.
+static Effect bank[2][NUM_CHANNELS] WARM;
+static uint8_t live WARM;
+static uint8_t fading WARM;
+static uint16_t fade WARM;       // crossfade position, 0 to 0xffff
+static uint16_t fadeRate WARM;   // added to fade every frame
+
+/*
+ * Stop running the modulation graph once no channel of either bank reads
+ * it: program_load() only replaces the graph, so after a fade from a graph
+ * program to a plain one it would otherwise be evaluated every frame for
+ * nothing.
+ */
+static void graph_release()
+{
+  for (uint8_t i=0; i<NUM_CHANNELS; i++) {
+    if (bank[live][i].isGraph() || (fading && bank[live ^ 1][i].isGraph())) {
+      return;
+    }
+  }
+  mod_load(MOD_NONE);
+}
+
+#if NUM_OUTPUTS > NUM_CHANNELS
+/*
+ * Spread a bank's channel levels, levels[0] to levels[NUM_CHANNELS - 1],
+ * over the outputs, see frame.h. When the outputs don't divide evenly,
+ * as with an odd number of H-bridges, some runs are one shorter.
+ * The offsets step along the run without a divide, and the channels go
+ * from the last back so each level is read before its run overwrites it.
+ */
+static void spread(Effect *bank, uint8_t *levels)
+{
+  uint8_t end = NUM_OUTPUTS;
+
+  for (int8_t c=NUM_CHANNELS - 1; c>=0; c--) {
+    uint8_t start = (c * NUM_OUTPUTS + NUM_CHANNELS - 1) / NUM_CHANNELS;
+    uint8_t copies = end - start;
+    uint8_t *run = levels + start;
+    uint16_t spacing = bank[c == NUM_CHANNELS - 1 ? 0 : c + 1].stepsAhead(bank[c]);
+    uint16_t stride = spacing / copies;
+    uint8_t rest = spacing % copies;
+    uint16_t ahead = 0;
+    uint8_t error = 0;
+
+    run[0] = levels[c];
+    for (uint8_t k=1; k<copies; k++) {
+      ahead += stride;
+      error += rest;
+      if (error >= copies) {
+        error -= copies;
+        ahead++;
+      }
+      run[k] = ahead ? bank[c].peek(ahead) : run[0];
+    }
+    end = start;
+  }
+}
+#endif
+
+/*
+ * One step of every effect in a bank, as a level per output
+ */
+static void bank_step(Effect *bank, uint8_t *levels)
+{
+  for (uint8_t i=0; i<NUM_CHANNELS; i++) {
+    levels[i] = bank[i].step();
+  }
+#if NUM_OUTPUTS > NUM_CHANNELS
+  spread(bank, levels);
+#endif
+}
+
+void frame_init(uint8_t n)
+{
+  program = n;
+  live = 0;
+  fading = 0;
+  program_load(bank[live], n);
+  graph_release();
+#ifdef HAS_SYNC
+  sync_select();
+#endif
+}
+
+/*
+ * Start a crossfade to program n. If we are already fading, the fade in
+ * progress is cut short and the new one starts from its target.
+ */
+void frame_select(uint8_t n)
+{
+  if (fading) {
+    live ^= 1;
+  }
+
+  program = n;
+  program_load(bank[live ^ 1], n);
+
+  fade = 0;
+  fadeRate = 0xffff / (fadeFrames ? fadeFrames : 1);
+  fading = 1;
+#ifdef HAS_SYNC
+  sync_select();
+#endif
+}
+
+/*
+ * Produce the next frame and hand it to the output stage. Normally that's
+ * one step of every effect; sync can ask for two, to catch up, or none, in
+ * which case the output keeps the last frame.
+ */
+void frame_next()
+{
+#ifdef HAS_SYNC
+  uint8_t steps = sync_steps();
+#else
+  const uint8_t steps = 1;
+#endif
+
+  if (steps == 0) {
+    return;
+  }
+
+  TRACE_ON(TRACE_FRAME);
+  for (uint8_t s=0; s<steps; s++) {
+    Effect *a = bank[live];
+
+    mod_eval();
+    bank_step(a, frame);
+
+    if (fading) {
+      Effect *b = bank[live ^ 1];
+      uint8_t to[NUM_OUTPUTS];
+      uint8_t mix;
+
+      if (fade > 0xffff - fadeRate) {
+        // Fade complete, the new program takes over
+        mix = 0xff;
+        fading = 0;
+        live ^= 1;
+        graph_release();
+      }
+      else {
+        fade += fadeRate;
+        mix = fade >> 8;
+      }
+
+      bank_step(b, to);
+      for (uint8_t i=0; i<NUM_OUTPUTS; i++) {
+        frame[i] = blend8(frame[i], to[i], mix);
+      }
+    }
+  }
+
+  dimmer_apply(frame);
+#ifdef HAS_POWER_LIMIT
+  power_limit(frame);
+#endif
+  output_frame(frame);
+#ifdef HAS_FRAME_CACHE
+  // The next slice of the cache, once this frame is out
+  frame_cache_render();
+#endif
+  TRACE_OFF(TRACE_FRAME);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+// Time the main loop idles between frames, see idleFor()
+#define FRAME_MS 6
+
+// Default crossfade time between programs, in frames
+#define FADE_FRAMES 1000
+
+// With more outputs than channels, n outputs showing m channels, channel c
+// drives outputs (c * n) / m rounded up to the next channel's. Each copy
+// in the run shows the channel's effect that far along the step offset
+// to the next channel, round to channel 0 from the last: a quarter offset
+// chase on 4 channels is a sixteenth offset one on 16 outputs. Effects
+// whose level isn't a function of the step (twinkle, candle, graph) or
+// that run a different cycle to the next channel's show the same level
+// across the run.
+static inline uint8_t spread_channel(uint8_t o, uint8_t n, uint8_t m)
+{
+  return (uint16_t) o * m / n;
+}
+
+extern uint8_t frame[NUM_OUTPUTS];
+extern uint8_t program;
+extern uint16_t fadeFrames;
+
+extern void frame_init(uint8_t n);
+extern void frame_select(uint8_t n);
+extern void frame_next();
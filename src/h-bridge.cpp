@@ -1,29 +1,59 @@
 #include <Arduino.h>
 
+#include <avr/sleep.h>
+
 #include "lights.h"
 #include "h-bridge.h"
+#include "irsample.h"
+#include "instrument.h"
+#include "trace.h"
+#include "warm.h"
+
+// The two bridges on port B; with -DBRIDGES see bridges.cpp
+#if defined(HAS_HBRIDGE) && !defined(HAS_MULTI_BRIDGE)
 
 int pwmTicks = 128;
 uint8_t phase = PHI_1;
-volatile uint8_t running = 1;
+volatile uint8_t running WARM;
 
-volatile int systemTicks = 0;
+// PWM ticks since idleFor() started its wait. 16 bits, as an int is on
+// the AVR, so no wait can be longer than 32767 ticks (1092ms).
+volatile int16_t systemTicks = 0;
+
+#ifdef HAS_IR_ON_PWM
+static uint8_t irDivider;
+#endif
 
-volatile uint8_t level1 = 0;
-volatile uint8_t level2 = 0;
-volatile uint8_t level3 = 0;
-volatile uint8_t level4 = 0;
+volatile uint8_t level1 WARM;
+volatile uint8_t level2 WARM;
+volatile uint8_t level3 WARM;
+volatile uint8_t level4 WARM;
 //volatile int counter;
 
 ISR(TIMER0_COMPA_vect) {
-  MCUCR &= ~(_BV(SE));    // Disable sleep mode
+  TRACE_ON(TRACE_PWM);
+  INSTRUMENT_T0_ENTER();
+  sleep_disable();
 
   systemTicks++;
 
   // Reset counter
+  INSTRUMENT_T0_RESET();
   TCNT0 = 0;
 
+#ifdef HAS_IR_ON_PWM
+  // The IR sample Timer 1 would have taken, lights on or off
+  if (++irDivider >= IR_PWM_TICKS) {
+    irDivider = 0;
+    TRACE_ON(TRACE_IR);
+    ir_sample();
+    TRACE_OFF(TRACE_IR);
+  }
+#endif
+
   if (running == 0) {
+    INSTRUMENT_T0_EXIT();
+    TRACE_OFF(TRACE_PWM);
     return;
   }
 
@@ -31,6 +61,7 @@ ISR(TIMER0_COMPA_vect) {
 
   if (pwmTicks >= 128) {
     // Time to switch phase
+    TRACE_ON(TRACE_PHASE);
 
     pwmTicks = 0;
 
@@ -48,6 +79,8 @@ ISR(TIMER0_COMPA_vect) {
       PORTB |= CHANNEL1_PIN_A_MASK | CHANNEL2_PIN_A_MASK;
       PORTB &= ~(CHANNEL1_PIN_B_MASK | CHANNEL2_PIN_B_MASK);
     }
+
+    TRACE_OFF(TRACE_PHASE);
   }
 
   if (phase == PHI_1) {
@@ -74,6 +107,9 @@ ISR(TIMER0_COMPA_vect) {
       PORTB &= ~CHANNEL2_PIN_B_MASK;
     }
   }
+
+  INSTRUMENT_T0_EXIT();
+  TRACE_OFF(TRACE_PWM);
 }
 
 /*
@@ -92,7 +128,7 @@ void setup_timer0()
   TCNT0 = 0;
   
   // Set up the timer compare registers for about 51.2KHz
-  OCR0A = 160;
+  OCR0A = PWM_OCR;
 
 #ifdef ATTINY
   // Enable timer 0 compare interrupt A
@@ -104,16 +140,26 @@ void setup_timer0()
 
 void init_hbridge()
 {
-  pinMode(CHANNEL1_PIN_A, OUTPUT);
-  pinMode(CHANNEL1_PIN_B, OUTPUT);
-  pinMode(CHANNEL2_PIN_A, OUTPUT);
-  pinMode(CHANNEL2_PIN_B, OUTPUT);
+  const uint8_t pins = CHANNEL1_PIN_A_MASK | CHANNEL1_PIN_B_MASK | CHANNEL2_PIN_A_MASK | CHANNEL2_PIN_B_MASK;
 
-  // All outputs off
-  digitalWrite(CHANNEL1_PIN_A, LOW);
-  digitalWrite(CHANNEL1_PIN_B, LOW);
-  digitalWrite(CHANNEL2_PIN_A, LOW);
-  digitalWrite(CHANNEL2_PIN_B, LOW);
+  // All outputs off. The channel pins are all on port B on both boards, so
+  // straight to the registers rather than a pinMode() and digitalWrite()
+  // apiece: this is on the warm start path.
+  PORTB &= ~pins;
+  DDRB |= pins;
 
   setup_timer0();
 }
+
+/*
+ * Hand a finished frame to the PWM ISR
+ */
+void output_frame(const uint8_t *frame)
+{
+  level1 = frame[0];
+  level2 = frame[1];
+  level3 = frame[2];
+  level4 = frame[3];
+}
+
+#endif /* HAS_HBRIDGE */
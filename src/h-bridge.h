@@ -1,6 +1,82 @@
 #pragma once
 
+#ifdef HAS_HBRIDGE
+
 // H-Bridge states
 #define PHI_1 0
 #define PHI_2 1
 
+// Timer 0 compare value, the PWM ISR runs every PWM_OCR + 1 clocks
+#define PWM_OCR 160
+
+// PWM ticks idleFor() counts as a millisecond
+#define TICKS_PER_MS 30
+
+#ifdef HAS_MULTI_BRIDGE
+
+// Several H-bridges on the ATmega328, built with -DBRIDGES=n, 1 to 8.
+//
+// Each bridge has an A and a B input, as the two the UNO env drives: in
+// phase 1 the A sides are pulsed, in phase 2 the B sides, so each bridge
+// runs two anti-parallel strings. Output n is bridge n's A side for n <
+// BRIDGES, bridge n - BRIDGES's B side after that, and shows frame[n].
+// With 2 bridges that's the UNO env's layout. Past 2, as with the shift
+// registers, each of the NUM_CHANNELS effects drives a run of outputs
+// along its step offset to the next channel's, see frame.h.
+//
+//   bridge    1    2    3    4    5    6    7    8
+//   A        12   10    7    5    3   A0   A2   A4
+//   B        11    9    6    4    2   A1   A3   A5
+//
+// PB0 stays the IR input, PB5 the LED and PD0/PD1 the serial port, so
+// past 5 bridges the last three go on port C.
+//
+// The PWM ISR doesn't compare levels. output_frame() turns each frame
+// into a list of edges per phase, sorted by tick, each with the whole
+// image of the bridge pins on every port from that tick on; outputs with
+// the same level share an edge. The ISR swaps the list in at the start of
+// a phase and, on the tick of the next edge, writes each port once. So
+// its cost doesn't grow with the bridges, only output_frame()'s does, in
+// the main loop.
+
+#if BRIDGES < 1 || BRIDGES > 8
+# error BRIDGES must be 1 to 8
+#endif
+#if defined(UNO) && defined(TRACE) && BRIDGES > 2
+# error TRACE uses pins 2 to 7, which bridges 3 to 5 need
+#endif
+#if defined(SYNC_LEADER) && BRIDGES > 4
+# error The sync leader needs pin 3, which bridge 5 uses
+#endif
+#if defined(AUDIO) && BRIDGES > 5
+# error Audio needs A0, which bridge 6 uses
+#endif
+
+#define HB_OUTPUTS (BRIDGES * 2)
+
+// Ports with bridges on them, B then D then C
+#if BRIDGES > 5
+# define HB_PORTS 3
+#elif BRIDGES > 2
+# define HB_PORTS 2
+#else
+# define HB_PORTS 1
+#endif
+
+// Every bridge pin on each port
+#define HB_PINS_B (BRIDGES > 1 ? 0b00011110 : 0b00011000)
+#define HB_PINS_D (0b11111100 & (0xff << (2 * (5 - (BRIDGES > 5 ? 5 : BRIDGES)) + 2)))
+#define HB_PINS_C (0b00111111 >> (2 * (8 - BRIDGES)))
+
+// A phase's edges: at most one per output, the start and an end marker
+#define HB_EDGES (BRIDGES + 2)
+#define HB_NEVER 0xff           // the end marker's tick
+
+typedef struct {
+  uint8_t tick;                 // pwmTicks this image is written on
+  uint8_t port[HB_PORTS];       // bridge pins high, B, D, C
+} hbedge_t;
+
+#endif
+
+#endif
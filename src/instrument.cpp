@@ -0,0 +1,122 @@
+#include <Arduino.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "lights.h"
+#include "instrument.h"
+
+#ifdef INSTRUMENT
+
+volatile isrstats_t isrStats;
+volatile uint8_t t0Late;
+
+extern volatile int16_t systemTicks;
+
+static uint16_t frames;
+
+void instrument_init()
+{
+  T0_FLAGS = _BV(TOV0);
+  memset((void *) &isrStats, 0, sizeof(isrStats));
+
+#ifdef HAS_AUDIO
+  // Timer 2 free running at SYSCLOCK / 8, the ADC ISR's stopwatch
+  TCCR2A = 0;
+  TCCR2B = _BV(CS21);
+#endif
+
+#ifdef ATTINY
+  pinMode(INSTRUMENT_PIN, OUTPUT);
+  digitalWrite(INSTRUMENT_PIN, LOW);
+#endif
+}
+
+#ifdef ATTINY
+/*
+ * Hold the instrument pin at 'level' for 'ticks' PWM ticks, sleeping
+ * meanwhile so the idle count still means something
+ */
+static void hold(uint8_t level, uint8_t ticks)
+{
+  uint8_t start = systemTicks;
+
+  if (level) {
+    PORTB |= INSTRUMENT_PIN_MASK;
+  }
+  else {
+    PORTB &= ~INSTRUMENT_PIN_MASK;
+  }
+
+  while ((uint8_t) (systemTicks - start) < ticks) {
+    sleep_enable();
+    sleep_cpu();
+  }
+}
+
+static void pulse(uint8_t value)
+{
+  hold(1, value + 1);
+  hold(0, 2);
+}
+#endif
+
+/*
+ * Called once a frame from the main loop: every INSTRUMENT_FRAMES take a
+ * snapshot, start a new one and report it
+ */
+void instrument_frame()
+{
+  isrstats_t s;
+
+  if (++frames < INSTRUMENT_FRAMES) {
+    return;
+  }
+  frames = 0;
+
+  cli();
+  s = *(isrstats_t *) &isrStats;
+  memset((void *) &isrStats, 0, sizeof(isrStats));
+  sei();
+
+  uint8_t t0Avg = s.t0Count ? s.t0Sum / s.t0Count : 0;
+  uint8_t t1Avg = s.t1Count ? s.t1Sum / s.t1Count : 0;
+  uint8_t idlePct = s.t0Count ? (uint32_t) s.idle * 100 / s.t0Count : 0;
+
+#ifdef UNO
+  Serial.print("T0 avg "); Serial.print(t0Avg);
+  Serial.print(" max "); Serial.print(s.t0Max);
+  Serial.print(" late "); Serial.print(s.t0LateMax);
+  Serial.print(" missed "); Serial.print(s.t0Missed);
+  Serial.print(" clk, T1 avg "); Serial.print(t1Avg * 8);
+  Serial.print(" max "); Serial.print(s.t1Max * 8);
+  Serial.print(" late "); Serial.print(s.t1LateMax * 8);
+  Serial.print(" clk, idle "); Serial.print(idlePct);
+# ifdef HAS_AUDIO
+  // The snapshot's clocks are its Timer 0 ticks, OCR0A + 1 each
+  uint16_t adcAvg = s.adcCount ? s.adcSum * 8 / s.adcCount : 0;
+  uint16_t adcPermille = s.t0Count ? s.adcSum * 8000 / ((uint32_t) s.t0Count * (OCR0A + 1)) : 0;
+
+  Serial.print("%, ADC avg "); Serial.print(adcAvg);
+  Serial.print(" max "); Serial.print(s.adcMax * 8);
+  Serial.print(" clk, "); Serial.print(adcPermille / 10);
+  Serial.print("."); Serial.print(adcPermille % 10);
+  Serial.println("% of the CPU");
+# else
+  Serial.println("%");
+# endif
+#else
+  hold(1, INSTRUMENT_START);
+  hold(0, 2);
+  pulse(t0Avg);
+  pulse(s.t0Max);
+  pulse(s.t0LateMax);
+  pulse(s.t0Missed > 255 ? 255 : s.t0Missed);
+  pulse(t1Avg);
+  pulse(s.t1Max);
+  pulse(idlePct);
+#endif
+}
+
+#endif /* INSTRUMENT */
@@ -0,0 +1,171 @@
+#pragma once
+
+// ISR timing instrumentation, built with -DINSTRUMENT (the *_instrument
+// PlatformIO environments). Without it every hook below is empty.
+//
+// Both ISRs time themselves from their own timer counter:
+//
+//  - Timer 0 runs at the CPU clock, so TCNT0 just before the ISR resets it
+//    is the number of clocks since the compare ("late"). Late plus TCNT0
+//    at exit is the whole ISR in clocks, less the epilogue. If the ISR
+//    starts more than 255 - PWM_OCR clocks late the counter wraps and
+//    TOV0 is set, but the tick is only late: the ISR resets the counter.
+//    It's lost, a missed compare, when the counter has also come round to
+//    OCR0A again, 256 clocks late, while the first compare was pending.
+//  - Timer 1 counts 8 clocks a step. TCNT1 at entry is the time since the
+//    overflow, TCNT1 - INIT_TIMER_COUNT1 at exit the time since the reload.
+//
+// The Timer 0 ISR also notes whether the main loop was asleep in idle()
+// when it fired, which gives the idle fraction.
+//
+// With AUDIO, the ADC ISR times itself on Timer 2, free running at 8
+// clocks a step (so not with SYNC_LEADER, which has Timer 2). It lets the
+// Timer 0 ISR in, so the clocks that ISR added to t0Sum meanwhile are
+// taken off; what's left is the ADC ISR less its prologue and epilogue.
+// The UNO prints its average and worst, and its share of the CPU against
+// the Timer 0 ticks in the snapshot.
+//
+// Every INSTRUMENT_FRAMES frames the main loop takes a snapshot and starts
+// again. The UNO prints it over Serial. The ATtiny has no spare pins, so
+// it sends it as a burst of pulses on INSTRUMENT_PIN (PB5, which needs
+// the RSTDISBL fuse, see README): a start pulse INSTRUMENT_START PWM ticks
+// long, then one pulse per value, value + 1 PWM ticks (~10us) wide:
+// Timer 0 average, max and late max (clocks), missed compares (capped at
+// 255), Timer 1 average and max (steps), idle percent.
+
+#ifdef INSTRUMENT
+
+#define INSTRUMENT_FRAMES 256   // ~0.46s, keeps the counts in 16 bits
+#define INSTRUMENT_START 200
+
+#ifdef ATTINY
+# define INSTRUMENT_PIN 5
+# define INSTRUMENT_PIN_MASK (0b00100000)
+#endif
+
+#ifdef SMCR
+# define SLEEP_CONTROL SMCR     // ATmega328
+#else
+# define SLEEP_CONTROL MCUCR    // ATtiny85
+#endif
+
+#if defined(HAS_AUDIO) && defined(SYNC_LEADER)
+# error INSTRUMENT times the ADC ISR on Timer 2, which the sync leader uses
+#endif
+
+#ifdef ATTINY
+# define T0_FLAGS TIFR
+# define T1_COUNT TCNT1
+#else
+# define T0_FLAGS TIFR0
+# define T1_COUNT TCNT1L
+#endif
+
+typedef struct {
+  uint16_t t0Count;     // Timer 0 interrupts
+  uint16_t t0Missed;    // compares lost to an ISR 256 clocks late
+  uint8_t t0LateMax;    // clocks from compare to counter reset
+  uint8_t t0Max;        // clocks from compare to exit
+  uint32_t t0Sum;
+  uint16_t t1Count;     // Timer 1 interrupts
+  uint8_t t1LateMax;    // Timer 1 steps from overflow to reload
+  uint8_t t1Max;        // Timer 1 steps from overflow to exit
+  uint32_t t1Sum;
+  uint16_t idle;        // Timer 0 interrupts that found the loop in idle()
+#ifdef HAS_AUDIO
+  uint16_t adcCount;    // ADC interrupts
+  uint8_t adcMax;       // Timer 2 steps, less the Timer 0 ISRs inside
+  uint32_t adcSum;
+#endif
+} isrstats_t;
+
+extern volatile isrstats_t isrStats;
+extern volatile uint8_t t0Late;
+
+extern void instrument_init();
+extern void instrument_frame();
+
+#define INSTRUMENT_T0_ENTER() do { \
+    isrStats.t0Count++; \
+    if (SLEEP_CONTROL & _BV(SE)) { \
+      isrStats.idle++; \
+    } \
+    if (T0_FLAGS & _BV(TOV0)) { \
+      T0_FLAGS = _BV(TOV0); \
+      if (TCNT0 >= OCR0A) { \
+        isrStats.t0Missed++; \
+      } \
+    } \
+  } while (0)
+
+#define INSTRUMENT_T0_RESET() (t0Late = TCNT0 - OCR0A)
+
+#define INSTRUMENT_T0_EXIT() do { \
+    uint8_t late = t0Late; \
+    uint8_t total = late + TCNT0; \
+    if (late > isrStats.t0LateMax) { \
+      isrStats.t0LateMax = late; \
+    } \
+    if (total > isrStats.t0Max) { \
+      isrStats.t0Max = total; \
+    } \
+    isrStats.t0Sum += total; \
+  } while (0)
+
+#define INSTRUMENT_T1_ENTER() uint8_t t1Late = T1_COUNT
+
+#define INSTRUMENT_T1_EXIT() do { \
+    uint8_t total = t1Late + (uint8_t) (T1_COUNT - (uint8_t) INIT_TIMER_COUNT1); \
+    isrStats.t1Count++; \
+    if (t1Late > isrStats.t1LateMax) { \
+      isrStats.t1LateMax = t1Late; \
+    } \
+    if (total > isrStats.t1Max) { \
+      isrStats.t1Max = total; \
+    } \
+    isrStats.t1Sum += total; \
+  } while (0)
+
+#ifdef HAS_AUDIO
+// After the ISR's sei(): Timer 0 may come in between the two reads, but
+// then its clocks are in the t0Sum taken
+#define INSTRUMENT_ADC_ENTER() \
+  uint8_t adcStart = TCNT2; \
+  cli(); \
+  uint32_t adcT0 = isrStats.t0Sum; \
+  sei()
+
+#define INSTRUMENT_ADC_EXIT() do { \
+    cli(); \
+    uint8_t steps = TCNT2 - adcStart; \
+    uint8_t inside = (isrStats.t0Sum - adcT0 + 4) >> 3; \
+    steps = steps > inside ? steps - inside : 0; \
+    isrStats.adcCount++; \
+    if (steps > isrStats.adcMax) { \
+      isrStats.adcMax = steps; \
+    } \
+    isrStats.adcSum += steps; \
+  } while (0)
+#endif
+
+#else
+
+#define INSTRUMENT_T0_ENTER()
+#define INSTRUMENT_T0_RESET()
+#define INSTRUMENT_T0_EXIT()
+#define INSTRUMENT_T1_ENTER()
+#define INSTRUMENT_T1_EXIT()
+#define INSTRUMENT_ADC_ENTER()
+#define INSTRUMENT_ADC_EXIT()
+
+#endif
+
+// On the host sim code takes no time unless it says so, see sim/machine.h:
+// SPEND(cycles) charges the AVR clocks a stretch of work would take. It's
+// there whether or not INSTRUMENT is, and empty in the firmware.
+#ifdef SIM
+extern void sim_spend(uint32_t cycles);
+# define SPEND(cycles) sim_spend(cycles)
+#else
+# define SPEND(cycles)
+#endif
@@ -5,17 +5,26 @@
 
 #include "lights.h"
 #include "ir.h"
+#include "irsample.h"
+#include "sync.h"
+#include "instrument.h"
+#include "trace.h"
 
 #ifdef HAS_IR
 
 volatile irparams_t irparams;
+irstats_t irstats;
 
+#ifndef HAS_IR_ON_PWM
 #ifdef ATTINY
 ISR(TIM1_OVF_vect)
 #else
 ISR(TIMER1_OVF_vect)
 #endif
 {
+  TRACE_ON(TRACE_IR);
+  INSTRUMENT_T1_ENTER();
+
   // Reset Timer 1
 #ifdef ATTINY
   TCNT1 = INIT_TIMER_COUNT1;
@@ -24,70 +33,16 @@ ISR(TIMER1_OVF_vect)
   TCNT1L = (uint8_t) INIT_TIMER_COUNT1;
 #endif
 
-  uint8_t irdata = (uint8_t)digitalRead(IR_PIN);
-
-  irparams.timer++; // One more 25us tick
-  if (irparams.rawlen >= RAWBUF) {
-    // Buffer overflow
-    irparams.rcvstate = STATE_STOP;
-  }
-  switch(irparams.rcvstate) {
-  case STATE_IDLE: // In the middle of a gap
-    if (irdata == MARK) {
-      if (irparams.timer < GAP_TICKS) {
-        // Not big enough to be a gap.
-        irparams.timer = 0;
-      } 
-      else {
-        // gap just ended, record duration and start recording transmission
-        irparams.rawlen = 0;
-        irparams.rawbuf[irparams.rawlen++] = irparams.timer;
-        irparams.timer = 0;
-        irparams.rcvstate = STATE_MARK;
-      }
-    }
-    break;
-    
-  case STATE_MARK: // timing MARK
-    if (irdata == SPACE) {   // MARK ended, record time
-      irparams.rawbuf[irparams.rawlen++] = irparams.timer;
-      irparams.timer = 0;
-      irparams.rcvstate = STATE_SPACE;
-    }
-    break;
+  ir_sample();
 
-  case STATE_SPACE: // timing SPACE
-    if (irdata == MARK) { // SPACE just ended, record it
-      irparams.rawbuf[irparams.rawlen++] = irparams.timer;
-      irparams.timer = 0;
-      irparams.rcvstate = STATE_MARK;
-    } 
-    else { // SPACE
-      if (irparams.timer > GAP_TICKS) {
-        // big SPACE, indicates gap between codes
-        // Mark current code as ready for processing
-        // Switch to STOP
-        // Don't reset timer; keep counting space width
-        irparams.rcvstate = STATE_STOP;
-      } 
-    }
-    break;
-
-  case STATE_STOP: // waiting, measuring gap
-    if (irdata == MARK) { // reset gap timer
-      irparams.timer = 0;
-    }
-    break;
-  }
+  INSTRUMENT_T1_EXIT();
+  TRACE_OFF(TRACE_IR);
 }
+#endif
 
+#ifndef HAS_IR_ON_PWM
 void init_timer1()
 {
-  // Initialise state
-  irparams.rcvstate = STATE_IDLE;
-  irparams.timer = 0;
-  irparams.rawlen=0;
-
   /*
    * Setup Timer 1
    *   on the ATTiny, this is an 8-bit timer
@@ -122,57 +77,86 @@ void init_timer1()
   TCNT1L = (uint8_t) INIT_TIMER_COUNT1;
 #endif
 }
+#endif
 
 void init_ir()
 {
   pinMode(IR_PIN, INPUT);
 
+  // Initialise state
+  irparams.rcvstate = STATE_IDLE;
+  irparams.timer = 0;
+  irparams.rawlen=0;
+  irparams.level = SPACE;
+  irparams.pending = 0;
+
+#ifdef HAS_IR_ON_PWM
+  // The PWM ISR samples the pin, Timer 1 is left alone
+#else
   init_timer1();
+#endif
 }
 
+// Every window decodeNEC() matches, at the firmware's tolerance and mark
+// excess, has to end below IR_RAW_LONG, or a capture's "255 ticks or
+// more" would be taken for it. The sim's sweep goes wider than this, and
+// relies on MATCH() turning IR_RAW_LONG down.
+#define IR_MARK_FITS(us) (TICKS_HIGH_AT((us) + MARK_EXCESS_DEFAULT, TOLERANCE_DEFAULT) < IR_RAW_LONG)
+#define IR_SPACE_FITS(us) (TICKS_HIGH_AT((us) - MARK_EXCESS_DEFAULT, TOLERANCE_DEFAULT) < IR_RAW_LONG)
+
+static_assert(IR_MARK_FITS(NEC_HDR_MARK) && IR_MARK_FITS(NEC_BIT_MARK),
+              "an NEC mark window reaches IR_RAW_LONG at this tick");
+static_assert(IR_SPACE_FITS(NEC_HDR_SPACE) && IR_SPACE_FITS(NEC_RPT_SPACE) &&
+              IR_SPACE_FITS(NEC_ONE_SPACE) && IR_SPACE_FITS(NEC_ZERO_SPACE),
+              "an NEC space window reaches IR_RAW_LONG at this tick");
+
 long decodeNEC(decode_results_t *results) {
   long data = 0;
   int offset = 1; // Skip first space
+  // Shortest frame is a repeat: gap, mark, space, mark
+  if (results->rawlen < 4) {
+    return ERR;
+  }
   // Initial mark
-  if (!MATCH_MARK(results->rawbuf[offset], NEC_HDR_MARK)) {
+  if (!MATCH_MARK(ir_raw(results, offset), NEC_HDR_MARK)) {
     //Serial.println("Initial MARK missing");
     return ERR;
   }
   offset++;
   // Check for repeat
-  if (irparams.rawlen == 4 &&
-    MATCH_SPACE(results->rawbuf[offset], NEC_RPT_SPACE) &&
-    MATCH_MARK(results->rawbuf[offset+1], NEC_BIT_MARK)) {
+  if (results->rawlen == 4 &&
+    MATCH_SPACE(ir_raw(results, offset), NEC_RPT_SPACE) &&
+    MATCH_MARK(ir_raw(results, offset+1), NEC_BIT_MARK)) {
     results->bits = 0;
     results->value = REPEAT;
     results->decode_type = NEC;
     //Serial.println("NEC Repeat");
     return DECODED;
   }
-  if (irparams.rawlen < 2 * NEC_BITS + 4) {
+  if (results->rawlen < 2 * NEC_BITS + 4) {
     //Serial.println("Not enough raw data");
     return ERR;
   }
   // Initial space  
-  if (!MATCH_SPACE(results->rawbuf[offset], NEC_HDR_SPACE)) {
+  if (!MATCH_SPACE(ir_raw(results, offset), NEC_HDR_SPACE)) {
     //Serial.println("Initial SPACE missing");
     return ERR;
   }
   offset++;
   for (int i = 0; i < NEC_BITS; i++) {
-    if (!MATCH_MARK(results->rawbuf[offset], NEC_BIT_MARK)) {
-      //Serial.print("NEC Bit #"); Serial.print(i); Serial.print(" - "); Serial.print(results->rawbuf[offset]); Serial.println(" - MATCH_MARK failed");
+    if (!MATCH_MARK(ir_raw(results, offset), NEC_BIT_MARK)) {
+      //Serial.print("NEC Bit #"); Serial.print(i); Serial.print(" - "); Serial.print(ir_raw(results, offset)); Serial.println(" - MATCH_MARK failed");
       return ERR;
     }
     offset++;
-    if (MATCH_SPACE(results->rawbuf[offset], NEC_ONE_SPACE)) {
+    if (MATCH_SPACE(ir_raw(results, offset), NEC_ONE_SPACE)) {
       data = (data << 1) | 1;
     } 
-    else if (MATCH_SPACE(results->rawbuf[offset], NEC_ZERO_SPACE)) {
+    else if (MATCH_SPACE(ir_raw(results, offset), NEC_ZERO_SPACE)) {
       data <<= 1;
     } 
     else {
-      //Serial.print("NEC Bit #"); Serial.print(i); Serial.print(" - "); Serial.print(results->rawbuf[offset]); Serial.println(" - MATCH_SPACE failed");
+      //Serial.print("NEC Bit #"); Serial.print(i); Serial.print(" - "); Serial.print(ir_raw(results, offset)); Serial.println(" - MATCH_SPACE failed");
       return ERR;
     }
     offset++;
@@ -194,8 +178,13 @@ int decode(decode_results_t *results) {
   }
 
   if (decodeNEC(results)) {
+    irstats.decoded++;
     return DECODED;
   }
+  irstats.failed++;
+#ifdef HAS_RECORDER
+  recorder_add(REC_FAILED, 1, results->rawlen);
+#endif
 
   if (results->rawlen >= 6) {
     // Only return raw buffer if at least 6 bits
@@ -244,7 +233,7 @@ void dump_ir(decode_results_t *results)
     else { 
       Serial.print("  ");
     }
-    Serial.print(results->rawbuf[i]);
+    Serial.print(ir_raw(results, i));
   }
   Serial.println("");
 
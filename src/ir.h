@@ -8,7 +8,14 @@
 #define STATE_SPACE    4
 #define STATE_STOP     5
 
-#define RAWBUF 76         // Length of raw duration buffer
+#define RAWBUF 76         // Length of raw duration buffer, a byte an entry
+
+// Captured intervals are kept a byte each: at 50us a tick everything NEC
+// sends fits, the 9ms header mark (180 ticks) included. Anything longer,
+// in practice only the gap before a frame, is stored as IR_RAW_LONG, "255
+// ticks or more", which no decode window may take, see MATCH(). Decoders
+// read them through ir_raw(), so the format can change in one place.
+#define IR_RAW_LONG 0xff
 
 // Timer related
 #define CLKFUDGE 5        // fudge factor for clock interrupt overhead
@@ -21,7 +28,19 @@
 #define PRESCALE 8        // TIMER1 clock prescale
 
 // microseconds per clock interrupt tick
-#define USEC_PER_TICK 50
+#ifdef HAS_IR_ON_PWM
+// Sampled by the PWM ISR every IR_PWM_TICKS of its ticks instead, see
+// lights.h. Each of those is PWM_OCR + 1 clocks plus the ISR's latency
+// to its counter reset, IR_PWM_LATENCY, 185 clocks in all, so the tick
+// is 46.25us. It's a fraction, but everything made from it below is
+// worked out at compile time.
+# include "h-bridge.h"
+# define IR_PWM_TICKS 4
+# define IR_PWM_LATENCY 24
+# define USEC_PER_TICK (IR_PWM_TICKS * (PWM_OCR + 1 + IR_PWM_LATENCY) / (SYSCLOCK / 1e6))
+#else
+# define USEC_PER_TICK 50
+#endif
 
 // timer clocks per microsecond
 #define CLKS_PER_USEC (SYSCLOCK/PRESCALE/1000000)   
@@ -34,7 +53,21 @@
 #define SPACE 1
 
 #define _GAP 5000 // Minimum gap between transmissions
-#define GAP_TICKS (_GAP/USEC_PER_TICK)
+#define GAP_TICKS ((uint16_t) (_GAP/USEC_PER_TICK))
+
+// Noise from LED lighting and the like turns up on the receiver output as
+// short pulses. The ISR only takes a change of level once it has lasted
+// IR_GLITCH_TICKS samples (1 turns the filter off); every edge is seen
+// that much late, so the durations between them are unchanged. A frame
+// that still has a mark or space under IR_MIN_PULSE, or ends before it
+// could be even a repeat code, is thrown away in the ISR, and loop()
+// never sees it.
+#ifndef IR_GLITCH_TICKS
+# define IR_GLITCH_TICKS 3        // pulses under 100us go, over 150us stay
+#endif
+#define IR_MIN_PULSE 250          // us, NEC's shortest is 560
+#define IR_MIN_TICKS ((uint16_t) (IR_MIN_PULSE / USEC_PER_TICK))
+#define IR_MIN_RAWLEN 4           // gap, mark, space, mark: a repeat code
 
 #define ERR 0
 #define DECODED 1
@@ -53,17 +86,48 @@
 #define NEC_ZERO_SPACE 560
 #define NEC_RPT_SPACE	2250
 
-#define LTOL (1.0 - TOLERANCE/100.) 
-#define UTOL (1.0 + TOLERANCE/100.) 
-
-#define TOLERANCE 30  // percent tolerance in measurements
-#define TICKS_LOW(us) (int) (((us)*LTOL/USEC_PER_TICK))
-#define TICKS_HIGH(us) (int) (((us)*UTOL/USEC_PER_TICK + 1))
+#define LTOL_AT(tol) (1.0 - (tol)/100.)
+#define UTOL_AT(tol) (1.0 + (tol)/100.)
+#define LTOL LTOL_AT(TOLERANCE)
+#define UTOL UTOL_AT(TOLERANCE)
+
+#define TOLERANCE_DEFAULT 30  // percent tolerance in measurements
+
+// The windows are the ones the 50us tick gives, which the tolerance and
+// mark excess were tuned at: from the tick at or below us less the
+// tolerance, to the tick after the one at or below us plus it. At any
+// other tick they're rounded out to whole ticks, so a one timer build
+// accepts what the two timer build does, except for a tick that only
+// starts in the last WINDOW_SLACK us: that adds nothing to the tolerance,
+// and at the 46.25us tick the 9ms header's would be its 255th, which is
+// IR_RAW_LONG, "255 or more". ir.cpp checks the firmware's windows all
+// end below that, and MATCH() never accepts it.
+#define WINDOW_USEC 50
+#define WINDOW_SLACK 5
+#define USEC_LOW(us, tol) ((int) ((us)*LTOL_AT(tol)/WINDOW_USEC) * WINDOW_USEC)
+#define USEC_HIGH(us, tol) ((int) ((us)*UTOL_AT(tol)/WINDOW_USEC + 1) * WINDOW_USEC)
+
+#define TICKS_LOW_AT(us, tol) (int) (USEC_LOW(us, tol) / USEC_PER_TICK)
+#define TICKS_HIGH_AT(us, tol) (int) ((USEC_HIGH(us, tol) - WINDOW_SLACK) / USEC_PER_TICK + 1)
+#define TICKS_LOW(us) TICKS_LOW_AT(us, TOLERANCE)
+#define TICKS_HIGH(us) TICKS_HIGH_AT(us, TOLERANCE)
 
 // Marks tend to be 100us too long, and spaces 100us too short
 // when received due to sensor lag.
-#define MARK_EXCESS 0 //100
-#define MATCH(measured_ticks, desired_us) ((measured_ticks) >= TICKS_LOW(desired_us) && (measured_ticks) <= TICKS_HIGH(desired_us))
+#define MARK_EXCESS_DEFAULT 0 //100
+
+#ifdef SIM
+// The host sim sweeps these, see sim/ircorpus.cpp
+extern int irTolerance;
+extern int irMarkExcess;
+#define TOLERANCE irTolerance
+#define MARK_EXCESS irMarkExcess
+#else
+#define TOLERANCE TOLERANCE_DEFAULT
+#define MARK_EXCESS MARK_EXCESS_DEFAULT
+#endif
+
+#define MATCH(measured_ticks, desired_us) ((measured_ticks) != IR_RAW_LONG && (measured_ticks) >= TICKS_LOW(desired_us) && (measured_ticks) <= TICKS_HIGH(desired_us))
 
 #define MATCH_MARK(measured_ticks, desired_us) MATCH(measured_ticks, (desired_us) + MARK_EXCESS)
 #define MATCH_SPACE(measured_ticks, desired_us) MATCH((measured_ticks), (desired_us) - MARK_EXCESS)
@@ -74,17 +138,39 @@
 // information for the interrupt handler
 typedef struct {
   uint8_t rcvstate;          // state machine
-  unsigned int timer;     // state timer, counts 50uS ticks.
-  unsigned int rawbuf[RAWBUF]; // raw data
+  uint16_t timer;         // state timer, counts 50uS ticks, stops at 0xffff
+  uint8_t rawbuf[RAWBUF]; // raw data, see IR_RAW_LONG
   uint8_t rawlen;         // counter of entries in rawbuf
+  uint8_t level;          // input after the glitch filter
+  uint8_t pending;        // samples the input has differed from it
+  uint16_t glitches;      // pulses the filter took out
+  uint16_t noise;         // frames thrown away as noise
 } irparams_t;
 
+// Frames seen by decode() since reset, for diagnostics
+typedef struct {
+  uint16_t decoded;       // NEC frames and repeat codes
+  uint16_t failed;        // anything else
+} irstats_t;
+
 typedef struct {
   int decode_type; // NEC, SONY, RC5, UNKNOWN
   unsigned long value; // Decoded value
   int bits; // Number of bits in decoded value
-  volatile unsigned int *rawbuf; // Raw intervals in .5 us ticks
+  volatile uint8_t *rawbuf; // Raw intervals in 50us ticks, see IR_RAW_LONG
   int rawlen; // Number of records in rawbuf.
 } decode_results_t;
 
+// An interval as the ISR stores it
+static inline uint8_t ir_raw_pack(uint16_t ticks)
+{
+  return ticks < IR_RAW_LONG ? ticks : IR_RAW_LONG;
+}
+
+// Interval i of a capture in ticks, IR_RAW_LONG for 255 or more
+static inline uint8_t ir_raw(const decode_results_t *results, uint8_t i)
+{
+  return results->rawbuf[i];
+}
+
 #endif
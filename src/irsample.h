@@ -0,0 +1,133 @@
+#pragma once
+
+#ifdef HAS_IR
+
+#include "sync.h"
+#include "recorder.h"
+
+// One sample of the IR receiver, every USEC_PER_TICK: the glitch filter
+// and the capture state machine. Shared by the Timer 1 ISR and, with
+// -DONE_TIMER, the PWM ISR, so it's inline to keep a call (and the
+// registers a call makes an ISR save) out of both.
+
+/*
+ * Throw away the frame being captured as noise, and wait for the next gap
+ */
+static inline void discard_frame()
+{
+  irparams.noise++;
+#ifdef HAS_RECORDER
+  recorder_isr(REC_NOISE, irparams.rawlen);
+#endif
+  irparams.rawlen = 0;
+  irparams.rcvstate = STATE_IDLE;
+}
+
+/*
+ * Take one sample from IR_PIN and move the capture on
+ */
+static inline void ir_sample()
+{
+  // Straight from the port: digitalRead() is a call, and slow
+  uint8_t irdata = (PINB & IR_PIN_MASK) ? SPACE : MARK;
+
+  // One more tick. It stops at the top rather than wrap: after a gap of
+  // 3.3s a wrapped count could be under GAP_TICKS, and the next mark
+  // wouldn't be taken as the start of a frame.
+  if (irparams.timer != 0xffff) {
+    irparams.timer++;
+  }
+
+  // A new level has to last IR_GLITCH_TICKS samples
+  if (irdata != irparams.level) {
+    if (++irparams.pending < IR_GLITCH_TICKS) {
+      irdata = irparams.level;
+    }
+    else {
+      irparams.level = irdata;
+      irparams.pending = 0;
+    }
+  }
+  else if (irparams.pending) {
+    irparams.pending = 0;
+    irparams.glitches++;
+  }
+
+  if (irparams.rawlen >= RAWBUF) {
+    // Buffer overflow
+    irparams.rcvstate = STATE_STOP;
+  }
+  switch(irparams.rcvstate) {
+  case STATE_IDLE: // In the middle of a gap
+    if (irdata == MARK) {
+      if (irparams.timer < GAP_TICKS) {
+        // Not big enough to be a gap.
+        irparams.timer = 0;
+      } 
+      else {
+        // gap just ended, record duration and start recording transmission
+#ifdef HAS_SYNC
+        syncStamp = syncState.phase;
+#endif
+        irparams.rawlen = 0;
+        irparams.rawbuf[irparams.rawlen++] = ir_raw_pack(irparams.timer);
+        irparams.timer = 0;
+        irparams.rcvstate = STATE_MARK;
+      }
+    }
+    break;
+    
+  case STATE_MARK: // timing MARK
+    if (irdata == SPACE) {   // MARK ended, record time
+      if (irparams.timer < IR_MIN_TICKS) {
+        discard_frame();
+        irparams.timer = 0;
+        break;
+      }
+      irparams.rawbuf[irparams.rawlen++] = ir_raw_pack(irparams.timer);
+      irparams.timer = 0;
+      irparams.rcvstate = STATE_SPACE;
+    }
+    break;
+
+  case STATE_SPACE: // timing SPACE
+    if (irdata == MARK) { // SPACE just ended, record it
+      if (irparams.timer < IR_MIN_TICKS) {
+        discard_frame();
+        irparams.timer = 0;
+        break;
+      }
+      irparams.rawbuf[irparams.rawlen++] = ir_raw_pack(irparams.timer);
+      irparams.timer = 0;
+      irparams.rcvstate = STATE_MARK;
+    } 
+    else { // SPACE
+      if (irparams.timer > GAP_TICKS) {
+        // big SPACE, indicates gap between codes
+        // Mark current code as ready for processing
+        // Switch to STOP
+        // Don't reset timer; keep counting space width
+        irparams.rcvstate = STATE_STOP;
+        if (irparams.rawlen < IR_MIN_RAWLEN) {
+          // A lone pulse: the gap has been timed, so the next mark can
+          // start a frame
+          discard_frame();
+        }
+      } 
+    }
+    break;
+
+  case STATE_STOP: // waiting, measuring gap
+    if (irdata == MARK) { // reset gap timer
+      irparams.timer = 0;
+    }
+    break;
+  }
+
+#ifdef HAS_SYNC
+  SYNC_TX();
+#endif
+
+}
+
+#endif
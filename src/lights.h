@@ -14,9 +14,15 @@
 # define CHANNEL2_PIN_B_MASK (0b00000010)
 
 # define IR_PIN 8
-
-# define DBGMSG(msg) Serial.print(msg)
-# define DBGNL DBGMSG("\n")
+# define IR_PIN_MASK (0b00000001)  // PB0
+
+# ifdef STREAM
+#  define DBGMSG(msg)
+#  define DBGNL
+# else
+#  define DBGMSG(msg) Serial.print(msg)
+#  define DBGNL DBGMSG("\n")
+# endif
 #elif defined(ATTINY)
 # define SYSCLOCK 16000000L  // Using internal PLL - see README for notes on fuses
 
@@ -31,6 +37,7 @@
 # define CHANNEL2_PIN_B_MASK (0b00000010)
 
 # define IR_PIN 0
+# define IR_PIN_MASK (0b00000001)  // PB0
 
 # define DBGMSG(msg) 
 # define DBGNL
@@ -38,9 +45,112 @@
 # error Unsupported board
 #endif
 
-#define HAS_HBRIDGE
+// Output backend: the two H-bridges, or with -DSHIFTREG a chain of
+// 74HC595s on the ATtiny's USI (see shiftreg.h)
+#ifdef SHIFTREG
+# ifndef ATTINY
+#  error The shift register backend needs the ATtiny USI
+# endif
+# define HAS_SHIFTREG
+#else
+# define HAS_HBRIDGE
+#endif
+
+// With -DBRIDGES=n, up to 8 H-bridges on the ATmega328's ports, see
+// h-bridge.h
+#ifdef BRIDGES
+# if !defined(UNO) && !defined(SIM)
+#  error BRIDGES needs the ATmega328 ports
+# endif
+# ifdef SHIFTREG
+#  error BRIDGES and SHIFTREG are both output backends
+# endif
+# define HAS_MULTI_BRIDGE
+#endif
 #define HAS_IR
 
+// With -DONE_TIMER the H-bridge PWM ISR samples the IR receiver as well,
+// and Timer 1 is free for other things, see ir.h
+#ifdef ONE_TIMER
+# ifndef HAS_HBRIDGE
+#  error ONE_TIMER samples IR from the H-bridge PWM ISR
+# endif
+# ifdef SYNC_LEADER
+#  error The sync leader beacon would add a call to the PWM ISR, build it with both timers
+# endif
+# define HAS_IR_ON_PWM
+#endif
+
+// Effects, dimmer and frame pipeline, whichever backend shows them
+#if defined(HAS_HBRIDGE) || defined(HAS_SHIFTREG)
+# define HAS_FRAMES
+#endif
+
+// Level frames streamed over the serial port, see stream.h
+#if defined(STREAM) && defined(HAS_FRAMES)
+# define HAS_STREAM
+#endif
+
+// Lights that follow music from a microphone on the ADC, see audio.h
+#if defined(AUDIO) && defined(HAS_FRAMES)
+# define HAS_AUDIO
+#endif
+
+// Warm start from state kept in RAM over a reset, see warm.h
+#ifdef HAS_FRAMES
+# define HAS_WARM
+#endif
+
+// Settings saved in the EEPROM over a power cycle, see persist.h
+#ifdef HAS_FRAMES
+# define HAS_PERSIST
+#endif
+
+// Periodic effect cycles played back from RAM, built with -DFRAME_CACHE,
+// see Effect.h. It takes 768 bytes, which only the UNO has to spare.
+#if defined(FRAME_CACHE) && defined(HAS_FRAMES)
+# if !defined(UNO) && !defined(SIM)
+#  error FRAME_CACHE needs the RAM of the UNO
+# endif
+# define HAS_FRAME_CACHE
+#endif
+
+// Flight recorder of IR and mode changes, see recorder.h. The UNO always
+// has it; on the ATtiny it takes ~120 of the 512 bytes, so it's built with
+// -DRECORDER there.
+#if defined(HAS_FRAMES) && defined(HAS_IR) && (defined(UNO) || defined(RECORDER))
+# define HAS_RECORDER
+#endif
+
+// A limit on the levels' total, for the supply, with -DPOWER_BUDGET=...
+// in build_flags, see power.h
+#if defined(POWER_BUDGET) && defined(HAS_FRAMES)
+# define HAS_POWER_LIMIT
+#endif
+
+// Effect phase sync between boards over IR, see sync.h
+#if defined(HAS_FRAMES) && defined(HAS_IR)
+# define HAS_SYNC
+#endif
+
+#define NUM_CHANNELS 4
+
+// Levels in a frame, one per output. The shift register chain and three
+// or more H-bridges have more outputs than there are effect channels;
+// each channel drives a run of them, see frame.h.
+#ifdef HAS_SHIFTREG
+# ifndef SR_OUTPUTS
+#  define SR_OUTPUTS 16     // 8 to 32, a multiple of 8
+# endif
+# define NUM_OUTPUTS SR_OUTPUTS
+#elif defined(HAS_MULTI_BRIDGE) && BRIDGES > 2
+# define NUM_OUTPUTS (BRIDGES * 2)
+#else
+# define NUM_OUTPUTS NUM_CHANNELS
+#endif
+
+#define MAX_LEVEL 128     // full brightness, one PWM phase is 128 ticks
+
 
 // ATtiny85 Pin map
 //                        +-\/-+
@@ -64,6 +174,7 @@
 #include "ir.h"
 
 extern volatile irparams_t irparams;
+extern irstats_t irstats;
 
 extern void init_ir();
 extern int decode(decode_results_t *results);
@@ -75,3 +186,15 @@ extern void dump_ir(decode_results_t *results);
 extern void init_hbridge();
 #endif
 
+#ifdef HAS_SHIFTREG
+extern void init_shiftreg();
+#endif
+
+#ifdef HAS_FRAMES
+extern void output_frame(const uint8_t *frame);
+#endif
+
+#ifdef HAS_SYNC
+extern void init_sync();
+#endif
+
@@ -1,61 +1,96 @@
 #include <Arduino.h>
+#include <string.h>
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/sleep.h>
+#include <avr/wdt.h>
 
 #include "lights.h"
+#include "h-bridge.h"
+#include "shiftreg.h"
 #include "ir.h"
-#include "Effect.h"
+#include "remote.h"
+#include "dimmer.h"
+#include "frame.h"
+#include "programs.h"
+#include "instrument.h"
+#include "trace.h"
+#include "memory.h"
+#include "sync.h"
+#include "stream.h"
+#include "persist.h"
+#include "audio.h"
+#include "warm.h"
+#include "recorder.h"
 
-#ifdef HAS_HBRIDGE
-extern volatile int systemTicks;
-extern volatile int pwmTicks;
-extern volatile int running;
-
-extern volatile uint8_t level1;
-extern volatile uint8_t level2;
-extern volatile uint8_t level3;
-extern volatile uint8_t level4;
-
-Effect *fx[4];
+#ifdef HAS_FRAMES
+extern volatile int16_t systemTicks;
+extern volatile uint8_t running;
 #endif
 
 inline void idle() {
-  MCUCR |= _BV(SE);
-  __asm__ __volatile__ ( "sleep" "\n\t" :: );
+  sleep_enable();
+  sleep_cpu();
 }
 
 void setup()
 {
-#ifdef HAS_HBRIDGE
-  const int numSteps = 750;
-  const int quarterStep = numSteps/4;
+#ifdef HAS_WARM
+  // After a watchdog or brown-out reset, carry on from where we were
+  uint8_t warm = warm_start();
+#else
+  const uint8_t warm = 0;
 #endif
 
-#ifdef UNO
+#ifdef HAS_RECORDER
+# ifdef HAS_WARM
+  recorder_start(warm, warm_reset_cause());
+# else
+  recorder_start(0, 0);
+# endif
+#endif
+
+#if defined(UNO) && !defined(STREAM)
   Serial.begin(115200);
-  DBGMSG("Starting Wedding Lights controller");
+  DBGMSG(warm ? "Warm start" : "Starting Wedding Lights controller");
 #endif
 
-#ifdef HAS_HBRIDGE
-  fx[0] = new Effect(&level1, 0, numSteps);
-  fx[1] = new Effect(&level2, quarterStep, numSteps);
-  fx[2] = new Effect(&level3, quarterStep*2, numSteps);
-  fx[3] = new Effect(&level4, quarterStep*3, numSteps);
+#ifdef HAS_FRAMES
+  if (!warm) {
+    running = 1;
+    frame_init(0);
+    dimmer_init();
+  }
+# ifdef HAS_FRAME_CACHE
+  else {
+    // Renders over the next frames, the cache isn't kept over a reset
+    frame_cache_restore();
+  }
+# endif
+#endif
+#ifdef HAS_PERSIST
+  persist_init();
+  if (!warm) {
+    persist_restore();
+  }
 #endif
 #ifdef UNO
   pinMode(LED_BUILTIN, OUTPUT);
+# ifdef HAS_FRAMES
+  digitalWrite(LED_BUILTIN, running ? HIGH : LOW);
+# else
   digitalWrite(LED_BUILTIN, HIGH);
+# endif
 #endif
 
   // Disable interrupts while we set things up
   cli();
 
- // Disable sleeping, set sleep mode to IDLE
-  MCUCR &= ~(_BV(SE));
-  MCUCR &= ~(_BV(SM0));
-  MCUCR &= ~(_BV(SM1));
+ // Disable sleeping, set sleep mode to IDLE. The sleep bits are in MCUCR
+ // on the ATtiny but SMCR on the UNO, let avr-libc pick.
+  sleep_disable();
+  set_sleep_mode(SLEEP_MODE_IDLE);
 
   /*
    * Setup timer 0:
@@ -73,53 +108,140 @@ void setup()
   init_hbridge();
 #endif
 
+#ifdef HAS_SHIFTREG
+  init_shiftreg();
+#endif
+
 #ifdef HAS_IR
   init_ir();
 #endif
 
+#ifdef HAS_SYNC
+  init_sync();
+#endif
+
+#ifdef HAS_STREAM
+  init_stream();
+#endif
+
+#ifdef HAS_AUDIO
+  init_audio();
+#endif
+
+#ifdef INSTRUMENT
+  instrument_init();
+#endif
+  TRACE_INIT();
+
   // Allow interrupts
   sei();
 }
 
-void idleFor(int mS) {
-#ifdef HAS_HBRIDGE
-  register int ticksToWait = mS * 30;
+void idleFor(int16_t mS) {
+#ifdef HAS_FRAMES
+  int16_t ticksToWait = mS * TICKS_PER_MS;
 
   systemTicks = 0;
-  while (systemTicks < ticksToWait)
+  while (systemTicks < ticksToWait) {
+#ifdef HAS_WARM
+    wdt_reset();
+#endif
     idle(); 
+  }
 #else
   delay(mS);
 #endif
 }
 
+#if defined(HAS_FRAMES) && !defined(UNO)
+/*
+ * Show a number on the lights, most significant digit first: a short
+ * flash per unit, one long flash for a zero, and a pause between digits.
+ * Blocks for a few seconds; the next frame puts the program back.
+ */
+void blink_number(uint16_t n)
+{
+  uint8_t full[NUM_OUTPUTS], dark[NUM_OUTPUTS];
+  uint16_t place = 10000;
+
+  memset(full, MAX_LEVEL, NUM_OUTPUTS);
+  memset(dark, 0, NUM_OUTPUTS);
+
+  while (place > 1 && place > n) {
+    place /= 10;
+  }
+
+  output_frame(dark);
+  idleFor(1000);
+
+  for (; place; place /= 10) {
+    uint8_t digit = (n / place) % 10;
+
+    for (uint8_t i = digit ? digit : 1; i; i--) {
+      output_frame(full);
+      idleFor(digit ? 200 : 800);
+      output_frame(dark);
+      idleFor(300);
+    }
+    idleFor(1000);
+  }
+}
+#endif
+
 void loop() {
   unsigned long button = 0;
+  uint8_t repeats = 0;
   DBGMSG("Entering main loop\n");
 
   while (1) {  
-#ifdef HAS_HBRIDGE
-    for (int i=0; i<4; i++) {
-      fx[i]->step();
-    }
+#ifdef HAS_AUDIO
+    audio_frame();
+#endif
 
+#ifdef HAS_STREAM
+    // Frames from the PC, while they keep coming
+    if (!stream_next())
+#endif
+#ifdef HAS_FRAMES
+    frame_next();
+#endif
+
+#ifdef INSTRUMENT
+    instrument_frame();
 #endif
 
 #ifdef HAS_IR
     if (irparams.rcvstate == STATE_STOP) {
       decode_results_t ir;
 
+      TRACE_ON(TRACE_DECODE);
       if (decode(&ir) == DECODED) {
+#ifdef HAS_SYNC
+        // A beacon from the sync leader, not a key: leave the held key alone
+        if (ir.decode_type == NEC && SYNC_BEACON(ir.value)) {
+#ifdef HAS_RECORDER
+          recorder_add(REC_BEACON, 0, ir.value);
+#endif
+          sync_beacon(ir.value);
+        }
+        else
+#endif
         if (ir.decode_type == NEC) {
+#ifdef HAS_RECORDER
+          recorder_key(ir.value);
+#endif
           if (ir.value != REPEAT) {
             button = ir.value;
+            repeats = 0;
+          }
+          else if (repeats < 255) {
+            repeats++;
           }
 
           DBGNL;
           switch (button) {
-            // ON button
-            case 1086259455:
-            case 16753245:
+            case BTN_ON_ALT:
+            case BTN_ON:
               running = 1;
               DBGMSG("ON"); DBGNL;
 #ifdef UNO
@@ -127,12 +249,11 @@ void loop() {
 #endif
               break;
 
-            // OFF button
-            case 1086275775:
-            case 16769565:
+            case BTN_OFF_ALT:
+            case BTN_OFF:
               running = 0;
               DBGMSG("OFF\n");
-#ifdef HAS_HBRIDGE
+#if defined(HAS_HBRIDGE) && !defined(HAS_MULTI_BRIDGE)
               digitalWrite(CHANNEL1_PIN_A, LOW);
               digitalWrite(CHANNEL1_PIN_B, LOW);
               digitalWrite(CHANNEL2_PIN_A, LOW);
@@ -143,6 +264,80 @@ void loop() {
 #endif
               break;
 
+#ifdef HAS_FRAMES
+            case BTN_UP:
+              dimmer_adjust(1, repeats);
+              break;
+
+            case BTN_DOWN:
+              dimmer_adjust(-1, repeats);
+              break;
+
+            // Change program, crossfading from the current one. Held
+            // keys are ignored so we don't race through the list.
+            case BTN_NEXT:
+              if (repeats == 0) {
+                frame_select(program + 1 < numPrograms ? program + 1 : 0);
+              }
+              break;
+
+            case BTN_PREV:
+              if (repeats == 0) {
+                frame_select(program > 0 ? program - 1 : numPrograms - 1);
+              }
+              break;
+
+            // Pick what UP/DOWN adjust: 0 for master, 1-4 for a channel trim
+            case BTN_0:
+              dimmer_select(DIM_MASTER);
+              break;
+
+            case BTN_1:
+              dimmer_select(0);
+              break;
+
+            case BTN_2:
+              dimmer_select(1);
+              break;
+
+            case BTN_3:
+              dimmer_select(2);
+              break;
+
+            case BTN_4:
+              dimmer_select(3);
+              break;
+
+            // How close the stack has come to the static data
+            case BTN_DIAG:
+              if (repeats == 0) {
+#ifdef UNO
+                DBGMSG("Static RAM "); DBGMSG(static_ram());
+                DBGMSG(", stack never used "); DBGMSG(stack_free()); DBGNL;
+#else
+                if (running) {
+                  blink_number(stack_free());
+                }
+#endif
+              }
+              break;
+#endif
+
+#ifdef HAS_RECORDER
+            // What we've heard and done lately
+            case BTN_REC:
+              if (repeats == 0) {
+# ifdef UNO
+                recorder_dump();
+# else
+                if (running) {
+                  recorder_dump();
+                }
+# endif
+              }
+              break;
+#endif
+
             default:
               DBGMSG("Button value: "); DBGMSG(button); DBGNL;
               break;
@@ -153,9 +348,22 @@ void loop() {
 
       irparams.rcvstate = STATE_IDLE;
       irparams.rawlen = 0;
+      TRACE_OFF(TRACE_DECODE);
     }
 #endif
 
-    idleFor(6);
+#ifdef HAS_PERSIST
+    persist_frame();
+#endif
+
+#ifdef HAS_RECORDER
+    recorder_frame();
+#endif
+
+#ifdef HAS_WARM
+    warm_frame();
+#endif
+
+    idleFor(FRAME_MS);
   }
 }
@@ -0,0 +1,65 @@
+#include <Arduino.h>
+
+#include "lights.h"
+#include "memory.h"
+
+#ifndef SIM
+
+extern uint8_t __data_start;
+extern uint8_t _end;
+extern uint8_t __stack;
+
+/*
+ * Runs in .init1, before the stack pointer and r1 are set up, so it has
+ * to be naked and can't use either
+ */
+void paint_stack() __attribute__ ((naked, used, section(".init1")));
+
+void paint_stack()
+{
+  __asm__ __volatile__ (
+    "    ldi r30, lo8(_end)\n"
+    "    ldi r31, hi8(_end)\n"
+    "    ldi r24, %0\n"
+    "    ldi r25, hi8(__stack)\n"
+    "    rjmp 2f\n"
+    "1:  st Z+, r24\n"
+    "2:  cpi r30, lo8(__stack)\n"
+    "    cpc r31, r25\n"
+    "    brlo 1b\n"
+    "    breq 1b\n"
+    :: "M" (STACK_PAINT));
+}
+
+uint16_t static_ram()
+{
+  return &_end - &__data_start;
+}
+
+uint16_t stack_free()
+{
+  const uint8_t *p = &_end;
+  uint16_t n = 0;
+
+  while (p <= &__stack && *p == STACK_PAINT) {
+    p++;
+    n++;
+  }
+
+  return n;
+}
+
+#else
+
+// The host sim has no AVR stack to measure
+uint16_t static_ram()
+{
+  return 0;
+}
+
+uint16_t stack_free()
+{
+  return 0;
+}
+
+#endif
@@ -0,0 +1,14 @@
+#pragma once
+
+// RAM high water mark.
+//
+// At reset, before the C runtime sets up the stack, everything from the
+// end of the static data (_end) to the top of RAM is painted with
+// STACK_PAINT. Nothing uses the heap, so that whole gap belongs to the
+// stack, and the painted bytes still intact at the bottom of it are the
+// ones the stack has never reached.
+
+#define STACK_PAINT 0xc5
+
+extern uint16_t static_ram();   // .data, .bss and .noinit, bytes
+extern uint16_t stack_free();   // bytes the stack has never touched
@@ -0,0 +1,234 @@
+#include <Arduino.h>
+
+#include "lights.h"
+#include "fixed.h"
+#include "modgraph.h"
+#include "audio.h"
+#include "warm.h"
+
+// Slow sine on channels 1 and 2. Channels 3 and 4 get the same sine with
+// a faster LFO modulating 40% of its depth.
+const static PROGMEM mod_node_t tremolo[] = {
+  { MOD_SINE,   MOD_RATE(48),  0 },     // 0: slow sine
+  { MOD_OUT,    0, 0x03,       0 },
+  { MOD_SINE,   MOD_RATE(640), 0 },     // 2: fast LFO
+  { MOD_CONST,  100, 0,        0 },     // 3: depth
+  { MOD_MUL,    2, 3,          0 },
+  { MOD_INV,    4, 0,          0 },     // 5: 155 - 255
+  { MOD_MUL,    0, 5,          0 },
+  { MOD_OUT,    6, 0x0c,       0 }
+};
+
+// The top eighth of a saw gates an envelope: a sharp attack and a long
+// tail on every cycle. Half the channels are offset by half a cycle.
+const static PROGMEM mod_node_t pulse[] = {
+  { MOD_SAW,    MOD_RATE(160), 0 },     // 0
+  { MOD_ADD,    0, (uint8_t) -96, 0 },  // 1: >= 128 for the top eighth
+  { MOD_ENV,    40, 3,         1 },     // 2
+  { MOD_CLAMP,  2, 10,         255 },
+  { MOD_OUT,    3, 0x05,       0 },
+  { MOD_SAW,    MOD_RATE(160), 128 },   // 5
+  { MOD_ADD,    5, (uint8_t) -96, 0 },
+  { MOD_ENV,    40, 3,         6 },
+  { MOD_CLAMP,  7, 10,         255 },
+  { MOD_OUT,    8, 0x0a,       0 }
+};
+
+#ifdef HAS_AUDIO
+// Bass on channels 1 and 3, treble on 2 and 4, each over a dim glow
+const static PROGMEM mod_node_t music[] = {
+  { MOD_AUDIO,  AUDIO_LOW, 0,  0 },     // 0
+  { MOD_CLAMP,  0, 8,          255 },
+  { MOD_OUT,    1, 0x05,       0 },
+  { MOD_AUDIO,  AUDIO_HIGH, 0, 0 },     // 3
+  { MOD_CLAMP,  3, 8,          255 },
+  { MOD_OUT,    4, 0x0a,       0 }
+};
+#endif
+
+const static PROGMEM uint8_t quarterSine[] = {
+  2, 5, 8, 11, 14, 17, 20, 23, 26, 29, 32, 35, 38, 41, 44, 47,
+  50, 53, 56, 58, 61, 64, 67, 69, 72, 74, 77, 79, 82, 84, 86, 89,
+  91, 93, 95, 97, 99, 101, 103, 105, 106, 108, 110, 111, 113, 114, 115, 117,
+  118, 119, 120, 121, 122, 123, 124, 124, 125, 125, 126, 126, 127, 127, 127, 127
+};
+
+const static struct {
+  const mod_node_t *nodes;
+  uint8_t numNodes;
+} patches[] = {
+  { tremolo, sizeof(tremolo) / sizeof(mod_node_t) },
+  { pulse, sizeof(pulse) / sizeof(mod_node_t) },
+#ifdef HAS_AUDIO
+  { music, sizeof(music) / sizeof(mod_node_t) },
+#endif
+};
+
+const uint8_t numPatches = sizeof(patches) / sizeof(patches[0]);
+
+uint8_t modOutput[NUM_CHANNELS] WARM;
+
+// The loaded patch, copied out of flash so evaluation is plain loads
+static mod_node_t node[MOD_MAX_NODES] WARM;
+static uint8_t numNodes WARM;
+
+static uint8_t value[MOD_MAX_NODES] WARM;
+static uint16_t phase[MOD_MAX_NODES] WARM;
+
+static uint8_t sine8(uint8_t p)
+{
+  uint8_t i = p & 0x3f;
+
+  switch (p >> 6) {
+    case 0:
+      return 128 + pgm_read_byte(quarterSine + i);
+    case 1:
+      return 128 + pgm_read_byte(quarterSine + (63 - i));
+    case 2:
+      return 127 - pgm_read_byte(quarterSine + i);
+    default:
+      return 127 - pgm_read_byte(quarterSine + (63 - i));
+  }
+}
+
+void mod_load(uint8_t patch)
+{
+  numNodes = 0;
+
+  if (patch >= numPatches) {
+    return;
+  }
+
+  numNodes = patches[patch].numNodes;
+  memcpy_P(node, patches[patch].nodes, numNodes * sizeof(mod_node_t));
+
+  for (uint8_t i=0; i<numNodes; i++) {
+    value[i] = 0;
+    phase[i] = (uint16_t) node[i].c << 8;
+  }
+}
+
+/*
+ * Steps after which a patch's oscillators all come round together. An
+ * oscillator's period is 65536 steps over the largest power of two its
+ * rate divides by, so that's the longest of them. 0 if it's the whole 16
+ * bits or the patch never repeats (it follows the audio).
+ */
+uint16_t mod_cycle(uint8_t patch)
+{
+  uint16_t cycle = 1;
+
+  if (patch >= numPatches) {
+    return cycle;
+  }
+
+  for (uint8_t i=0; i<patches[patch].numNodes; i++) {
+    mod_node_t n;
+    memcpy_P(&n, patches[patch].nodes + i, sizeof(n));
+
+    if (n.op == MOD_AUDIO) {
+      return 0;
+    }
+    if (n.op == MOD_SINE || n.op == MOD_TRI || n.op == MOD_SAW) {
+      uint16_t rate = n.a | (n.b << 8);
+      uint16_t period = 0;      // 65536
+
+      if (rate == 0) {
+        continue;
+      }
+      while (!(rate & 1)) {
+        rate >>= 1;
+        period = period ? period >> 1 : 0x8000;
+      }
+      if (period == 0) {
+        return 0;
+      }
+      if (period > cycle) {
+        cycle = period;
+      }
+    }
+  }
+
+  return cycle;
+}
+
+/*
+ * Run every node once, in order
+ */
+void mod_eval()
+{
+  for (uint8_t i=0; i<numNodes; i++) {
+    const mod_node_t *n = &node[i];
+    uint8_t v;
+
+    switch (n->op) {
+      case MOD_SINE:
+      case MOD_TRI:
+      case MOD_SAW:
+        phase[i] += n->a | (n->b << 8);
+        v = phase[i] >> 8;
+        if (n->op == MOD_SINE) {
+          v = sine8(v);
+        }
+        else if (n->op == MOD_TRI) {
+          v = (v < 128) ? v << 1 : (255 - v) << 1;
+        }
+        break;
+
+      case MOD_ENV:
+        v = value[i];
+        if (value[n->c] >= 128) {
+          v = (v > 255 - n->a) ? 255 : v + n->a;
+        }
+        else {
+          v = (v < n->b) ? 0 : v - n->b;
+        }
+        break;
+
+      case MOD_MUL:
+        v = scale8(value[n->a], value[n->b]);
+        break;
+
+      case MOD_ADD: {
+        int16_t o = value[n->a] + (int8_t) n->b;
+        v = (o < 0) ? 0 : (o > 255) ? 255 : o;
+        break;
+      }
+
+      case MOD_CLAMP:
+        v = value[n->a];
+        if (v < n->b) {
+          v = n->b;
+        }
+        else if (v > n->c) {
+          v = n->c;
+        }
+        break;
+
+      case MOD_INV:
+        v = 255 - value[n->a];
+        break;
+
+      case MOD_OUT:
+        v = value[n->a];
+        for (uint8_t ch=0; ch<NUM_CHANNELS; ch++) {
+          if (n->b & (1 << ch)) {
+            modOutput[ch] = v;
+          }
+        }
+        break;
+
+#ifdef HAS_AUDIO
+      case MOD_AUDIO:
+        v = audioLevel[n->a];
+        break;
+#endif
+
+      default:
+        v = n->a;
+        break;
+    }
+
+    value[i] = v;
+  }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+// Modulation graph: a short list of fixed point nodes evaluated in order
+// once per frame, for looks that would otherwise need a new Effect kind.
+//
+// Every node produces an 8 bit value (0 - 255). Inputs name earlier nodes
+// by their index in the patch, so array order is evaluation order. A patch
+// is a PROGMEM array of mod_node_t; channels pick up the result through
+// MOD_OUT nodes and FX_GRAPH effects.
+
+// Node operations              a           b            c
+#define MOD_CONST   0  // value      -            -
+#define MOD_SINE    1  // rate lo    rate hi      phase
+#define MOD_TRI     2  // rate lo    rate hi      phase
+#define MOD_SAW     3  // rate lo    rate hi      phase
+#define MOD_ENV     4  // attack     release      gate node (>= 128 is on)
+#define MOD_MUL     5  // node       node         -
+#define MOD_ADD     6  // node       signed delta -
+#define MOD_CLAMP   7  // node       min          max
+#define MOD_INV     8  // node       -            -
+#define MOD_OUT     9  // node       channel mask -
+#define MOD_AUDIO  10  // band       -            -   (audio builds, see audio.h)
+
+// Oscillator rate is the phase step per frame out of 65536, so a rate of
+// 64 has a period of 1024 frames.
+#define MOD_RATE(r) ((r) & 0xff), ((r) >> 8)
+
+#define MOD_MAX_NODES 12
+
+// Program has no patch
+#define MOD_NONE 0xff
+
+typedef struct {
+  uint8_t op;
+  uint8_t a;
+  uint8_t b;
+  uint8_t c;
+} mod_node_t;
+
+extern uint8_t modOutput[NUM_CHANNELS];
+extern const uint8_t numPatches;
+
+extern void mod_load(uint8_t patch);
+extern uint16_t mod_cycle(uint8_t patch);
+extern void mod_eval();
@@ -0,0 +1,170 @@
+#include <Arduino.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+
+#include "lights.h"
+#include "frame.h"
+#include "dimmer.h"
+#include "programs.h"
+#include "persist.h"
+#include "instrument.h"
+
+#ifdef HAS_PERSIST
+
+// AVR clocks for a byte of record_crc(), avr-libc's crc8 is straight line
+#define CRC_BYTE_CYCLES 20
+
+extern volatile uint8_t running;
+extern uint8_t masterLevel;
+extern uint8_t channelTrim[NUM_CHANNELS];
+
+// The settings part of a record, everything before the CRC
+#define SETTINGS_SIZE offsetof(persistrec_t, crc)
+
+static persistrec_t seen;       // settings as of the last frame
+static persistrec_t saved;      // the last record, being written until written == sizeof
+static uint8_t slot;            // where saved is
+static uint8_t written;
+static uint16_t quiet;          // frames the settings have stayed as seen
+
+static void read_record(uint8_t n, persistrec_t *r)
+{
+  eeprom_read_block(r, (const void *) (n * sizeof(persistrec_t)), sizeof(persistrec_t));
+}
+
+static uint8_t record_crc(const persistrec_t *r)
+{
+  const uint8_t *p = (const uint8_t *) r;
+  uint8_t crc = PERSIST_MAGIC;
+
+  for (uint8_t i=0; i<sizeof(persistrec_t); i++) {
+    if (i != offsetof(persistrec_t, crc)) {
+      crc = _crc8_ccitt_update(crc, p[i]);
+      SPEND(CRC_BYTE_CYCLES);
+    }
+  }
+
+  return crc;
+}
+
+static void get_settings(persistrec_t *r)
+{
+  r->running = running;
+  r->program = program;
+  r->master = masterLevel;
+  for (uint8_t i=0; i<NUM_CHANNELS; i++) {
+    r->trim[i] = channelTrim[i];
+  }
+}
+
+static uint8_t same_settings(const persistrec_t *a, const persistrec_t *b)
+{
+  return memcmp(a, b, SETTINGS_SIZE) == 0;
+}
+
+/*
+ * Find the newest record, ready for persist_restore() and the next save.
+ * Called from setup() on every start, warm or cold.
+ */
+void persist_init()
+{
+  persistrec_t first, r;
+
+  read_record(0, &first);
+  if (first.crc == record_crc(&first)) {
+    // Slot lo is known to be this lap's, slot hi the first known not to be
+    uint8_t lo = 0, hi = PERSIST_SLOTS;
+
+    while (hi - lo > 1) {
+      uint8_t mid = (lo + hi) / 2;
+
+      read_record(mid, &r);
+      if (r.crc == record_crc(&r) && r.seq == (uint16_t) (first.seq + mid)) {
+        lo = mid;
+      }
+      else {
+        hi = mid;
+      }
+    }
+    slot = lo;
+    read_record(slot, &saved);
+  }
+  else {
+    // Nothing saved yet, or slot 0 was cut short and the newest is the
+    // last slot of the lap before
+    slot = PERSIST_SLOTS - 1;
+    read_record(slot, &saved);
+    if (saved.crc != record_crc(&saved)) {
+      // Nothing to write until something changes
+      get_settings(&saved);
+      saved.seq = 0xffff;
+    }
+  }
+
+  // On a warm start the settings carry on as they were, and are saved
+  // straight away if they have moved on from the record
+  get_settings(&seen);
+  written = sizeof(persistrec_t);
+  quiet = PERSIST_QUIET;
+}
+
+/*
+ * Put the saved settings back, on a cold start after frame_init() and
+ * dimmer_init()
+ */
+void persist_restore()
+{
+  running = saved.running;
+  dimmer_set(DIM_MASTER, saved.master);
+  for (uint8_t i=0; i<NUM_CHANNELS; i++) {
+    dimmer_set(i, saved.trim[i]);
+  }
+  if (saved.program < numPrograms) {
+    frame_init(saved.program);
+  }
+
+  get_settings(&seen);
+}
+
+/*
+ * Called once a frame from the main loop
+ */
+void persist_frame()
+{
+  persistrec_t now;
+
+  if (written < sizeof(persistrec_t)) {
+    if (eeprom_is_ready()) {
+      uint8_t *addr = (uint8_t *) (slot * sizeof(persistrec_t)) + written;
+      eeprom_update_byte(addr, ((const uint8_t *) &saved)[written]);
+      written++;
+    }
+    return;
+  }
+
+  get_settings(&now);
+  if (!same_settings(&now, &seen)) {
+    seen = now;
+    quiet = 0;
+    return;
+  }
+  if (quiet < PERSIST_QUIET) {
+    quiet++;
+    return;
+  }
+  if (same_settings(&now, &saved)) {
+    return;
+  }
+
+  now.seq = saved.seq + 1;
+  now.crc = record_crc(&now);
+  saved = now;
+  slot = (slot + 1 < PERSIST_SLOTS) ? slot + 1 : 0;
+  written = 0;
+}
+
+#endif /* HAS_PERSIST */
@@ -0,0 +1,44 @@
+#pragma once
+
+#ifdef HAS_PERSIST
+
+// Settings kept over a power cycle: on/off, the program, the master level
+// and the channel trims.
+//
+// persist_frame() runs once a frame and notes when the settings last
+// changed. Once they have stayed put for PERSIST_QUIET frames, and differ
+// from the last record saved, a new record goes out a byte per frame as
+// the EEPROM finishes the one before, so the main loop never waits out the
+// 3.4ms each byte takes. Holding UP or stepping through the programs costs
+// one record at the end, not one per press.
+//
+// The records go round a log filling the whole EEPROM, 51 slots on the
+// ATtiny85 and 102 on the UNO, so a cell sees one write per PERSIST_SLOTS
+// saves: 5 million saves on the ATtiny before the rated 100000 cycles.
+// Each record has a sequence number one on from the last and a CRC.
+//
+// At boot the slots from 0 up to the newest hold sequence numbers counting
+// up from slot 0's, and the ones after it are a lap older, so the newest
+// is found by binary search, 8 record reads on the ATtiny. The sequence
+// number is written last: a record cut short by a power cut still reads
+// as last lap's, or fails its CRC, and the one before it is used.
+
+#define PERSIST_QUIET 2048      // frames, 4 to 12s depending on the outputs
+#define PERSIST_MAGIC 0xa7      // CRC starting value, change with the layout
+
+typedef struct {
+  uint8_t running;
+  uint8_t program;
+  uint8_t master;
+  uint8_t trim[NUM_CHANNELS];
+  uint8_t crc;                  // over the rest, seq included
+  uint16_t seq;                 // written last
+} persistrec_t;
+
+#define PERSIST_SLOTS ((uint8_t) ((E2END + 1) / sizeof(persistrec_t)))
+
+extern void persist_init();
+extern void persist_restore();
+extern void persist_frame();
+
+#endif
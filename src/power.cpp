@@ -0,0 +1,51 @@
+#include <Arduino.h>
+
+#include "lights.h"
+#include "power.h"
+#include "fixed.h"
+
+#ifdef HAS_POWER_LIMIT
+
+// 256 * POWER_BUDGET / m, for m from 64 to 127
+#define POWER_GAIN(m) (uint16_t) (256UL * POWER_BUDGET / (m))
+#define POWER_GAIN8(m) POWER_GAIN(m), POWER_GAIN(m + 1), POWER_GAIN(m + 2), POWER_GAIN(m + 3), \
+                       POWER_GAIN(m + 4), POWER_GAIN(m + 5), POWER_GAIN(m + 6), POWER_GAIN(m + 7)
+
+const static PROGMEM uint16_t powerGain[64] = {
+  POWER_GAIN8(64), POWER_GAIN8(72), POWER_GAIN8(80), POWER_GAIN8(88),
+  POWER_GAIN8(96), POWER_GAIN8(104), POWER_GAIN8(112), POWER_GAIN8(120)
+};
+
+/*
+ * Called once a frame, after dimmer_apply(): scale the frame down, in
+ * place, if its levels add up to more than POWER_BUDGET
+ */
+void power_limit(uint8_t *frame)
+{
+  uint16_t total = 0;
+
+  for (uint8_t i=0; i<NUM_OUTPUTS; i++) {
+    total += frame[i] < MAX_LEVEL ? frame[i] : MAX_LEVEL;
+  }
+
+  if (total <= POWER_BUDGET) {
+    return;
+  }
+
+  // The total as m << shift, m 64 to 127, rounded up at every halving.
+  // It's over POWER_BUDGET, so at least 65 to start with.
+  uint8_t shift = 0;
+  while (total >= 128) {
+    total = (total + 1) >> 1;
+    shift++;
+  }
+
+  // Under 256, as the total is over the budget
+  uint8_t gain = (pgm_read_word_near(powerGain + (total - 64)) >> shift) - 1;
+
+  for (uint8_t i=0; i<NUM_OUTPUTS; i++) {
+    frame[i] = scale8(frame[i] < MAX_LEVEL ? frame[i] : MAX_LEVEL, gain);
+  }
+}
+
+#endif /* HAS_POWER_LIMIT */
@@ -0,0 +1,28 @@
+#pragma once
+
+#ifdef HAS_POWER_LIMIT
+
+// Supply current limit across all the outputs.
+//
+// The current the LED strings draw goes with the sum of their levels, so
+// with long strings the supply can sag, and reset the board, when several
+// channels are near full at once. Built with -DPOWER_BUDGET=n, power_limit()
+// runs once a frame after the dimmer and adds up the levels, each counted
+// up to MAX_LEVEL. If the sum is over n, every output is scaled by the
+// same gain so it's n or just under: the levels keep their proportions,
+// only dimmer. Full on across the board is NUM_OUTPUTS * MAX_LEVEL (512
+// with the H-bridges' 4).
+//
+// There's no divide, the ATtiny has none. The sum is rounded up to 7 bits
+// and an exponent, and a table of POWER_BUDGET / sum for each 7 bit value,
+// worked out by the compiler, gives the gain after a shift. Rounding the
+// sum up and the gain down means the limit is never exceeded; the levels
+// come out a level or two under their exact share. sim power checks that.
+
+#if POWER_BUDGET < 64 || POWER_BUDGET >= NUM_OUTPUTS * MAX_LEVEL
+# error POWER_BUDGET is a total level, from 64 up to NUM_OUTPUTS * MAX_LEVEL
+#endif
+
+extern void power_limit(uint8_t *frame);
+
+#endif
@@ -0,0 +1,141 @@
+#include <Arduino.h>
+
+#include "lights.h"
+#include "programs.h"
+#include "modgraph.h"
+
+const static PROGMEM program_t programs[] = {
+  // Quarter offset chase, the original pattern
+  { MOD_NONE, { {FX_SINE_CHASE, 0, 0, 750}, {FX_SINE_CHASE, 0, 187, 750},
+                {FX_SINE_CHASE, 0, 374, 750}, {FX_SINE_CHASE, 0, 561, 750} } },
+
+  // Slow chase
+  { MOD_NONE, { {FX_SINE_CHASE, 0, 0, 1500}, {FX_SINE_CHASE, 0, 375, 1500},
+                {FX_SINE_CHASE, 0, 750, 1500}, {FX_SINE_CHASE, 0, 1125, 1500} } },
+
+  // Opposite pairs
+  { MOD_NONE, { {FX_SINE_CHASE, 0, 0, 750}, {FX_SINE_CHASE, 0, 375, 750},
+                {FX_SINE_CHASE, 0, 0, 750}, {FX_SINE_CHASE, 0, 375, 750} } },
+
+  // Everything together
+  { MOD_NONE, { {FX_SINE_CHASE, 0, 0, 750}, {FX_SINE_CHASE, 0, 0, 750},
+                {FX_SINE_CHASE, 0, 0, 750}, {FX_SINE_CHASE, 0, 0, 750} } },
+
+  // Breathing, each channel a quarter cycle behind the last
+  { MOD_NONE, { {FX_BREATHE, 11, 0, 0}, {FX_BREATHE, 11, 512, 0},
+                {FX_BREATHE, 11, 1024, 0}, {FX_BREATHE, 11, 1536, 0} } },
+
+  // Candles
+  { MOD_NONE, { {FX_CANDLE, 90, 0, 0}, {FX_CANDLE, 90, 1, 0},
+                {FX_CANDLE, 90, 2, 0}, {FX_CANDLE, 90, 3, 0} } },
+
+  // Twinkle
+  { MOD_NONE, { {FX_TWINKLE, 4, 0, 0}, {FX_TWINKLE, 4, 1, 0},
+                {FX_TWINKLE, 4, 2, 0}, {FX_TWINKLE, 4, 3, 0} } },
+
+  // Hard edged chase, each channel lit a quarter of the time
+  { MOD_NONE, { {FX_CHASE, 64, 0, 400}, {FX_CHASE, 64, 100, 400},
+                {FX_CHASE, 64, 200, 400}, {FX_CHASE, 64, 300, 400} } },
+
+  // Candles on one bridge, breathing and strobe bursts on the other
+  { MOD_NONE, { {FX_CANDLE, 100, 0, 0}, {FX_CANDLE, 100, 1, 0},
+                {FX_BREATHE, 12, 0, 0}, {FX_STROBE, 3, 0, 1100} } },
+
+  // Slow sine with a faster tremolo on channels 3 and 4
+  { 0,        { {FX_GRAPH, 0, 0, 0}, {FX_GRAPH, 1, 0, 0},
+                {FX_GRAPH, 2, 0, 0}, {FX_GRAPH, 3, 0, 0} } },
+
+  // Gated envelope pulses, alternating pairs
+  { 1,        { {FX_GRAPH, 0, 0, 0}, {FX_GRAPH, 1, 0, 0},
+                {FX_GRAPH, 2, 0, 0}, {FX_GRAPH, 3, 0, 0} } },
+
+#ifdef HAS_AUDIO
+  // Music: bass on channels 1 and 3, treble on 2 and 4
+  { 2,        { {FX_GRAPH, 0, 0, 0}, {FX_GRAPH, 1, 0, 0},
+                {FX_GRAPH, 2, 0, 0}, {FX_GRAPH, 3, 0, 0} } },
+#endif
+};
+
+const uint8_t numPrograms = sizeof(programs) / sizeof(programs[0]);
+
+/*
+ * Set up a bank of effects to run program n from its first step. A
+ * program with a patch replaces whatever graph was running, which also
+ * feeds any graph channels we are fading away from.
+ */
+void program_load(Effect *bank, uint8_t n)
+{
+  const program_t *p = &programs[n];
+  uint8_t patch = pgm_read_byte(&p->patch);
+
+  if (patch != MOD_NONE) {
+    mod_load(patch);
+  }
+
+  for (uint8_t i=0; i<NUM_CHANNELS; i++) {
+    const channel_spec_t *c = &p->channel[i];
+
+    bank[i].init(pgm_read_byte(&c->kind),
+                 pgm_read_word(&c->firstStep),
+                 pgm_read_word(&c->numSteps),
+                 pgm_read_byte(&c->param));
+#ifdef HAS_FRAME_CACHE
+    bank[i].cache();
+#endif
+  }
+}
+
+static uint16_t gcd(uint16_t a, uint16_t b)
+{
+  while (b) {
+    uint16_t r = a % b;
+    a = b;
+    b = r;
+  }
+  return a;
+}
+
+/*
+ * Steps after which every channel of program n is back where it started,
+ * the LCM of their cycles. 0 if a channel never repeats (twinkle, candle,
+ * audio) or the LCM doesn't fit in 16 bits.
+ */
+uint16_t program_cycle(uint8_t n)
+{
+  const program_t *p = &programs[n];
+  uint16_t cycle = 1;
+
+  for (uint8_t i=0; i<NUM_CHANNELS; i++) {
+    const channel_spec_t *c = &p->channel[i];
+    uint8_t param = pgm_read_byte(&c->param);
+    uint16_t steps;
+
+    switch (pgm_read_byte(&c->kind)) {
+      case FX_TWINKLE:
+      case FX_CANDLE:
+        return 0;
+      case FX_BREATHE:
+        steps = 1 << param;
+        break;
+      case FX_GRAPH:
+        steps = mod_cycle(pgm_read_byte(&p->patch));
+        break;
+      default:
+        steps = pgm_read_word(&c->numSteps);
+        break;
+    }
+
+    if (steps == 0) {
+      return 0;
+    }
+    if (cycle % steps) {
+      uint32_t lcm = (uint32_t) (cycle / gcd(cycle, steps)) * steps;
+      if (lcm > 0xffff) {
+        return 0;
+      }
+      cycle = lcm;
+    }
+  }
+
+  return cycle;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "Effect.h"
+
+// A light program is one effect set-up per channel
+typedef struct {
+  uint8_t kind;
+  uint8_t param;
+  int16_t firstStep;
+  int16_t numSteps;
+} channel_spec_t;
+
+typedef struct {
+  uint8_t patch;    // modulation graph for FX_GRAPH channels, or MOD_NONE
+  channel_spec_t channel[NUM_CHANNELS];
+} program_t;
+
+extern const uint8_t numPrograms;
+
+extern void program_load(Effect *bank, uint8_t n);
+extern uint16_t program_cycle(uint8_t n);
@@ -0,0 +1,212 @@
+#include <Arduino.h>
+
+#include "lights.h"
+#include "frame.h"
+#include "recorder.h"
+#include "warm.h"
+
+#ifdef HAS_RECORDER
+
+extern volatile uint8_t running;
+extern uint8_t masterLevel;
+
+#if !defined(UNO)
+extern void blink_number(uint16_t n);
+#endif
+
+// What the last entries said, so changes can be spotted once a frame
+typedef struct {
+  uint32_t frame;
+  uint8_t head;         // next entry to write
+  uint8_t count;
+  uint8_t lastKey;      // the entry of the last key, for its repeats
+  uint8_t running;
+  uint8_t program;
+  uint8_t master;
+  uint16_t glitches;    // irparams.glitches and irstats.failed at the last entry
+  uint16_t failed;
+} recstate_t;
+
+static recentry_t entries[RECORDER_ENTRIES] WARM;
+static recstate_t state WARM;
+
+recisrentry_t recIsr[RECORDER_ISR_ENTRIES];
+volatile uint8_t recIsrHead;
+volatile uint8_t recIsrTail;
+
+/*
+ * The ISR's glitch count. It's 16 bits, so read it until two reads agree
+ * rather than turn interrupts off.
+ */
+static uint16_t glitches()
+{
+  uint16_t g;
+
+  do {
+    g = irparams.glitches;
+  } while (g != irparams.glitches);
+
+  return g;
+}
+
+static uint8_t upto255(uint16_t n)
+{
+  return n > 255 ? 255 : n;
+}
+
+/*
+ * Called by setup() after warm_start(). A cold start has cleared the
+ * block; what was last recorded is set to nothing any frame can show, so
+ * the first frame records how things were started.
+ */
+void recorder_start(uint8_t warm, uint8_t resetFlags)
+{
+  if (!warm) {
+    state.running = 0xff;
+    state.program = 0xff;
+    state.master = 0;
+  }
+
+  recorder_add(REC_START, warm, resetFlags);
+}
+
+void recorder_add(uint8_t kind, uint8_t arg, uint32_t value)
+{
+  recentry_t *e = &entries[(state.head - 1) & (RECORDER_ENTRIES - 1)];
+
+  // Runs of the same thing go in one entry
+  if (state.count && e->kind == kind && (kind == REC_FAILED || kind == REC_NOISE || kind == REC_MASTER)) {
+    e->arg = (kind == REC_MASTER) ? arg : upto255(e->arg + arg);
+    e->value = value;
+    return;
+  }
+
+  uint16_t g = glitches();
+
+  e = &entries[state.head];
+  e->frame = state.frame;
+  e->value = value;
+  e->kind = kind;
+  e->arg = arg;
+  e->glitches = upto255(g - state.glitches);
+  e->failed = upto255(irstats.failed - state.failed);
+
+  state.glitches = g;
+  state.failed = irstats.failed;
+  if (kind == REC_KEY) {
+    state.lastKey = state.head;
+  }
+  state.head = (state.head + 1) & (RECORDER_ENTRIES - 1);
+  if (state.count < RECORDER_ENTRIES) {
+    state.count++;
+  }
+}
+
+/*
+ * A NEC repeat code: counted on the key it repeats, unless the ring has
+ * gone round over it
+ */
+static void add_repeat()
+{
+  recentry_t *e = &entries[state.lastKey];
+
+  if (state.count && e->kind == REC_KEY && e->arg < 255) {
+    e->arg++;
+  }
+}
+
+/*
+ * Once a frame, before warm_frame(): move the frame count on, record what
+ * the ISR noted, and any change to on/off, the program or the master
+ * level since the last frame
+ */
+void recorder_frame()
+{
+  state.frame++;
+
+  while (recIsrTail != recIsrHead) {
+    uint8_t t = recIsrTail;
+
+    recorder_add(recIsr[t].kind, 1, recIsr[t].value);
+    recIsrTail = (t + 1) & (RECORDER_ISR_ENTRIES - 1);
+  }
+
+  if (running != state.running) {
+    state.running = running;
+    recorder_add(REC_ON, running, 0);
+  }
+  if (program != state.program) {
+    state.program = program;
+    recorder_add(REC_PROGRAM, program, 0);
+  }
+  if (masterLevel != state.master) {
+    state.master = masterLevel;
+    recorder_add(REC_MASTER, masterLevel, 0);
+  }
+}
+
+/*
+ * A NEC code loop() acted on, REPEAT for a repeat code
+ */
+void recorder_key(uint32_t value)
+{
+  if (value == REPEAT) {
+    add_repeat();
+  }
+  else {
+    recorder_add(REC_KEY, 0, value);
+  }
+}
+
+uint8_t recorder_count()
+{
+  return state.count;
+}
+
+const recentry_t *recorder_entry(uint8_t n)
+{
+  return &entries[(state.head - state.count + n) & (RECORDER_ENTRIES - 1)];
+}
+
+#if defined(UNO) && !defined(STREAM)
+static const char *const kindNames[] = {
+  "", "start", "key", "beacon", "failed", "noise", "on", "program", "master"
+};
+#endif
+
+/*
+ * Show the log: printed on the UNO, blinked on the ATtiny. Blocks for
+ * the length of it.
+ */
+void recorder_dump()
+{
+#if defined(UNO) && !defined(STREAM)
+  Serial.print("Flight recorder at frame ");
+  Serial.println(state.frame);
+
+  for (uint8_t n=0; n<state.count; n++) {
+    const recentry_t *e = recorder_entry(n);
+
+    Serial.print(e->frame);
+    Serial.print(' ');
+    Serial.print(kindNames[e->kind]);
+    Serial.print(' ');
+    Serial.print(e->arg);
+    Serial.print(" 0x");
+    Serial.print(e->value, HEX);
+    Serial.print(" glitches ");
+    Serial.print(e->glitches);
+    Serial.print(" failed ");
+    Serial.println(e->failed);
+  }
+#elif !defined(UNO)
+  for (uint8_t n=state.count; n--; ) {
+    const recentry_t *e = recorder_entry(n);
+
+    blink_number(e->kind);
+    blink_number(e->kind == REC_KEY ? (uint8_t) (e->value >> 8) : e->arg);
+  }
+#endif
+}
+
+#endif /* HAS_RECORDER */
@@ -0,0 +1,98 @@
+#pragma once
+
+// Flight recorder: the last RECORDER_ENTRIES things the controller heard
+// and did, so "the lights went off by themselves" can be looked into.
+//
+// Each entry has the frame it happened in (counted from the last cold
+// start), what it was, and the IR glitches the ISR's filter took out and
+// the frames that failed to decode since the entry before. Recorded:
+//
+//  - every start, cold or warm, with the reset flags
+//  - every NEC code decoded, a key or a sync beacon; repeat codes count up
+//    on the key's entry rather than taking one each
+//  - frames that didn't decode, and frames the ISR threw away as noise, a
+//    run of them in one entry
+//  - on and off, program changes and the master level, whatever did them
+//    (the remote, a sync beacon, the settings put back at power up)
+//
+// The entries go round a ring in the WARM block, so they survive the
+// watchdog and brown-out resets they might explain. Adding one is a few
+// stores with no loop, and nothing turns interrupts off. The ISR has a
+// ring of its own that loop() empties once a frame, so neither ever
+// writes the other's; both sizes must be powers of 2.
+//
+// On the UNO the REC key prints the log on the serial monitor, oldest
+// first. The ATtiny only has it with -DRECORDER (the digispark_recorder
+// PlatformIO environment), and blinks it, newest first (see blink_number() for
+// reading the flashes): for each entry its kind, then its detail, the
+// command byte of a key or the arg of anything else, then a pause.
+
+#ifdef HAS_RECORDER
+
+#ifndef RECORDER_ENTRIES
+# ifdef UNO
+#  define RECORDER_ENTRIES 16
+# else
+#  define RECORDER_ENTRIES 8
+# endif
+#endif
+#ifndef RECORDER_ISR_ENTRIES
+# define RECORDER_ISR_ENTRIES 4
+#endif
+
+// Entry kinds, and what's in value and arg
+#define REC_START   1   // arg: 1 for a warm start, value: the reset flags
+#define REC_KEY     2   // value: the NEC code, arg: repeat codes after it
+#define REC_BEACON  3   // value: the sync beacon
+#define REC_FAILED  4   // arg: frames in a row that didn't decode, value: the last one's length
+#define REC_NOISE   5   // arg: frames in a row the ISR threw away, value: the last one's length
+#define REC_ON      6   // running, arg: 1 on, 0 off
+#define REC_PROGRAM 7   // arg: the program
+#define REC_MASTER  8   // arg: the master level, runs of changes in one entry
+
+typedef struct {
+  uint32_t frame;       // frames since the last cold start
+  uint32_t value;
+  uint8_t kind;
+  uint8_t arg;
+  uint8_t glitches;     // since the entry before, up to 255
+  uint8_t failed;
+} recentry_t;
+
+// Written by the ISR, emptied by recorder_frame()
+typedef struct {
+  uint8_t kind;
+  uint8_t value;
+} recisrentry_t;
+
+extern recisrentry_t recIsr[RECORDER_ISR_ENTRIES];
+extern volatile uint8_t recIsrHead;
+extern volatile uint8_t recIsrTail;
+
+/*
+ * From an ISR: note an event for loop() to record. If loop() is
+ * RECORDER_ISR_ENTRIES behind, it's dropped; the counters still have it.
+ */
+static inline void recorder_isr(uint8_t kind, uint8_t value)
+{
+  uint8_t h = recIsrHead;
+  uint8_t next = (h + 1) & (RECORDER_ISR_ENTRIES - 1);
+
+  if (next != recIsrTail) {
+    recIsr[h].kind = kind;
+    recIsr[h].value = value;
+    recIsrHead = next;
+  }
+}
+
+extern void recorder_start(uint8_t warm, uint8_t resetFlags);
+extern void recorder_add(uint8_t kind, uint8_t arg, uint32_t value);
+extern void recorder_key(uint32_t value);
+extern void recorder_frame();
+extern void recorder_dump();
+
+// Entry n, 0 the oldest, of recorder_count()
+extern uint8_t recorder_count();
+extern const recentry_t *recorder_entry(uint8_t n);
+
+#endif
@@ -0,0 +1,25 @@
+#pragma once
+
+// NEC codes for the remotes we use.
+//
+// The 21 key "Car MP3" remote (address 0x00) provides most of the buttons,
+// the second remote only has ON and OFF mapped.
+
+#define BTN_ON        0x00FFA25DUL  // CH-
+#define BTN_OFF       0x00FFE21DUL  // CH+
+#define BTN_ON_ALT    0x40BF00FFUL
+#define BTN_OFF_ALT   0x40BF40BFUL
+
+#define BTN_UP        0x00FFA857UL  // +
+#define BTN_DOWN      0x00FFE01FUL  // -
+#define BTN_NEXT      0x00FF02FDUL  // >>|
+#define BTN_PREV      0x00FF22DDUL  // |<<
+
+#define BTN_0         0x00FF6897UL
+#define BTN_1         0x00FF30CFUL
+#define BTN_2         0x00FF18E7UL
+#define BTN_3         0x00FF7A85UL
+#define BTN_4         0x00FF10EFUL
+
+#define BTN_DIAG      0x00FF906FUL  // EQ, memory report
+#define BTN_REC       0x00FFC23DUL  // >||, flight recorder
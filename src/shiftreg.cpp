@@ -0,0 +1,159 @@
+#include <Arduino.h>
+
+#include <avr/sleep.h>
+
+#include "lights.h"
+#include "shiftreg.h"
+#include "trace.h"
+#include "warm.h"
+
+#ifdef HAS_SHIFTREG
+
+volatile uint8_t running WARM;
+volatile int16_t systemTicks = 0;
+
+// Bit planes, [plane][register], one set shown and one being built. The
+// ISR swaps them at the start of a cycle once output_frame() says so.
+static uint8_t planes[2][BAM_BITS][SR_BYTES];
+static volatile uint8_t shown = 0;
+static volatile uint8_t pending = 0;
+
+static uint8_t slot = 0;
+static uint8_t blanked = 0;
+
+// Slot lengths in timer ticks and in BAM units, and the plane each shows
+static const uint8_t slotTicks[BAM_SLOTS] = {
+  BAM_UNIT, BAM_UNIT << 1, BAM_UNIT << 2, BAM_UNIT << 3,
+  BAM_UNIT << 4, BAM_UNIT << 5, BAM_UNIT << 6, BAM_UNIT << 6, BAM_UNIT << 6
+};
+static const uint8_t slotUnits[BAM_SLOTS] = { 1, 2, 4, 8, 16, 32, 64, 64, 64 };
+static const uint8_t slotPlane[BAM_SLOTS] = { 0, 1, 2, 3, 4, 5, 6, 7, 7 };
+
+/*
+ * Clock one plane into the chain, the far register first, MSB first.
+ * Each pair of USICR writes is one rising and one falling USCK edge,
+ * shifting USIDR along on the falling one. Unrolled, that's 16 OUTs and
+ * about 20 clocks a register, which is what lets BAM_UNIT be so short.
+ */
+static inline void shift_out(const uint8_t *plane)
+{
+  const uint8_t rise = _BV(USIWM0) | _BV(USITC);
+  const uint8_t fall = _BV(USIWM0) | _BV(USITC) | _BV(USICLK);
+
+  for (uint8_t i = SR_BYTES; i; i--) {
+    USIDR = plane[i - 1];
+    USICR = rise; USICR = fall;
+    USICR = rise; USICR = fall;
+    USICR = rise; USICR = fall;
+    USICR = rise; USICR = fall;
+    USICR = rise; USICR = fall;
+    USICR = rise; USICR = fall;
+    USICR = rise; USICR = fall;
+    USICR = rise; USICR = fall;
+  }
+}
+
+static inline void latch()
+{
+  PORTB |= SR_LATCH_MASK;
+  PORTB &= ~SR_LATCH_MASK;
+}
+
+ISR(TIMER0_COMPA_vect) {
+  TRACE_ON(TRACE_PWM);
+  sleep_disable();
+
+  uint8_t s = slot;
+
+  // Show what was shifted out during the last slot, and time this one.
+  // OCR0A first: the shortest slot is only a few ticks.
+  latch();
+  OCR0A = slotTicks[s] - 1;
+  systemTicks += slotUnits[s];
+
+  uint8_t next = s + 1;
+  if (next == BAM_SLOTS) {
+    next = 0;
+
+    if (pending) {
+      shown ^= 1;
+      pending = 0;
+    }
+  }
+  slot = next;
+
+  if (running == 0) {
+    // Clear the chain once, latching zeros from the next slot on
+    if (!blanked) {
+      static const uint8_t zeros[SR_BYTES] = { 0 };
+      shift_out(zeros);
+      blanked = 1;
+    }
+  }
+  else if (blanked || slotPlane[next] != slotPlane[s]) {
+    shift_out(planes[shown][slotPlane[next]]);
+    blanked = 0;
+  }
+
+  TRACE_OFF(TRACE_PWM);
+}
+
+void init_shiftreg()
+{
+  pinMode(1, OUTPUT);   // DO
+  pinMode(2, OUTPUT);   // USCK
+  pinMode(3, OUTPUT);   // latch
+  pinMode(4, OUTPUT);   // /OE
+  PORTB &= ~(SR_LATCH_MASK | SR_OE_MASK);
+
+  // Three wire mode, clocked by software strobes
+  USICR = _BV(USIWM0);
+
+  // All outputs off before /OE lets them through
+  static const uint8_t zeros[SR_BYTES] = { 0 };
+  shift_out(zeros);
+  latch();
+
+  // Timer 0 in CTC mode at clock / 64, one compare per BAM slot
+  TCCR0A = _BV(WGM01);
+  TCCR0B = _BV(CS01) | _BV(CS00);
+  TCNT0 = 0;
+  slot = 0;
+  OCR0A = slotTicks[0] - 1;
+  TIMSK = _BV(OCIE0A);
+}
+
+/*
+ * Turn a frame into bit planes for the next cycle. Levels run to
+ * MAX_LEVEL (128, the H-bridge's full phase), so they're doubled to fill
+ * the 8 bit BAM range, with MAX_LEVEL as fully on.
+ */
+void output_frame(const uint8_t *frame)
+{
+  uint8_t value[SR_OUTPUTS];
+
+  for (uint8_t i=0; i<SR_OUTPUTS; i++) {
+    value[i] = (frame[i] >= MAX_LEVEL) ? 255 : frame[i] << 1;
+  }
+
+  // Don't let the ISR swap in a half built set. Once pending is clear
+  // 'shown' can't change under us.
+  pending = 0;
+  uint8_t (*build)[SR_BYTES] = planes[shown ^ 1];
+
+  for (uint8_t b=0; b<BAM_BITS; b++) {
+    for (uint8_t r=0; r<SR_BYTES; r++) {
+      uint8_t bits = 0;
+      for (uint8_t q=0; q<8; q++) {
+        if (value[r * 8 + q] & (1 << b)) {
+          bits |= 1 << q;
+        }
+      }
+      build[b][r] = bits;
+    }
+  }
+
+  pending = 1;
+}
+
+#endif /* HAS_SHIFTREG */
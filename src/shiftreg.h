@@ -0,0 +1,60 @@
+#pragma once
+
+#ifdef HAS_SHIFTREG
+
+// Shift register output backend, built with -DSHIFTREG (ATtiny only).
+//
+// A chain of SR_OUTPUTS / 8 74HC595s (or TPIC6B595s for more current)
+// hangs off the USI in three wire mode:
+//
+//   PB1 (DO)   -> SER of the first register, QH' on to the next SER
+//   PB2 (USCK) -> SRCLK of all of them
+//   PB3        -> RCLK of all of them (latch)
+//   PB4        -> /OE, held low
+//
+// Brightness is bit angle modulation: each BAM cycle shows the 8 bit
+// planes of the levels for 1, 2, 4 ... 128 time units. The Timer 0 ISR
+// only runs at plane boundaries, latches the plane that was shifted out
+// during the previous slot, then shifts out the next one. So it runs 9
+// times a cycle whatever the output count, and only the shifting, 16 USI
+// strobes per register, grows with more outputs.
+//
+// There isn't RAM for an Effect per output on the ATtiny, so there are
+// still NUM_CHANNELS of them, and frame[] has a level per output: each
+// channel drives a run of SR_OUTPUTS / NUM_CHANNELS outputs, spread over
+// its step offset to the next channel (see frame.h), so a chase runs
+// along the whole chain.
+
+#if defined(INSTRUMENT)
+# error INSTRUMENT times the H-bridge ISR, not the shift register one
+#endif
+
+// SR_OUTPUTS, 16 by default, is in lights.h
+#define SR_BYTES (SR_OUTPUTS / 8)
+
+#if SR_OUTPUTS < 8 || SR_OUTPUTS > 32 || SR_OUTPUTS % 8
+# error SR_OUTPUTS must be 8, 16, 24 or 32
+#endif
+
+#define SR_LATCH_MASK (0b00001000)  // PB3
+#define SR_OE_MASK    (0b00010000)  // PB4
+
+#define BAM_BITS 8
+
+// Timer 0 runs in CTC mode at clock / 64, 4us a tick. The shortest slot
+// has to fit the ISR and a 32 output shift. The longest, 128 units, is
+// past 8 bits so it's shown as two slots of 64.
+#define BAM_UNIT 3                  // ticks, 12us
+#define BAM_UNIT_USEC (BAM_UNIT * 4)
+#define BAM_SLOTS 9
+#define BAM_CYCLE_USEC (255 * BAM_UNIT_USEC)
+
+// systemTicks goes up by each slot's length in BAM units. idleFor()'s
+// "millisecond" is 26 of them, not 1ms: with the wait running on to the
+// end of a slot that gives the frame period the H-bridge PWM gives, ~2.1ms
+// (its 30 ticks take ~350us with the ISR stretching them), so effects,
+// fades, the sync period and timeouts in frames run at the same speed on
+// either backend. sim-sr sr checks it.
+#define TICKS_PER_MS 26
+
+#endif
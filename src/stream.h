@@ -0,0 +1,52 @@
+#pragma once
+
+#ifdef HAS_STREAM
+
+// Live level frames from a PC, built with -DSTREAM (the uno_stream
+// PlatformIO environment). The serial port is then all ours, so there are
+// no debug prints.
+//
+// Each frame on the wire, 115200 8N1:
+//
+//   STREAM_SYNC  level 1  level 2  ...  level NUM_OUTPUTS  CRC
+//
+// A level per output, 4, or 2 per bridge with -DBRIDGES past 2. Levels are
+// 0 to MAX_LEVEL, so STREAM_SYNC (0xff) never appears in one and a
+// receiver that lost its place picks up at the next frame. CRC is CRC-8,
+// polynomial 0x07 from 0 (avr-libc's _crc8_ccitt_update), over the
+// levels. With 4 outputs that's 6 bytes, so the link carries up to 1920
+// frames a second; the main loop takes them at its frame rate.
+//
+// The USART RX ISR parses each byte as it arrives, straight into the back
+// half of a double buffer, and hands it over on a good CRC. loop() shows a
+// handed over frame in place of the effects' one, through the dimmer, so
+// the remote's OFF and dimming still work. If no good frame turns up for
+// STREAM_TIMEOUT frames the effects take over again, from where they were.
+
+#if !defined(UNO) && !defined(SIM)
+# error Streaming needs the USART on the UNO
+#endif
+#ifdef INSTRUMENT
+# error INSTRUMENT reports over the serial port, which streaming takes over
+#endif
+
+#define STREAM_BAUD 115200
+#define STREAM_SYNC 0xff
+#define STREAM_FRAME (NUM_OUTPUTS + 2)    // bytes on the wire
+
+// Main loop frames without a streamed frame before the effects come back,
+// about half a second
+#define STREAM_TIMEOUT 256
+
+typedef struct {
+  uint16_t frames;        // good frames received
+  uint16_t badCrc;        // frames thrown away for their CRC
+  uint16_t dropped;       // good frames that arrived before the last was shown
+} streamstats_t;
+
+extern volatile streamstats_t streamStats;
+
+extern void init_stream();
+extern uint8_t stream_next();
+
+#endif
@@ -0,0 +1,199 @@
+#include <Arduino.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "lights.h"
+#include "ir.h"
+#include "frame.h"
+#include "programs.h"
+#include "sync.h"
+#include "warm.h"
+
+#ifdef HAS_SYNC
+
+syncstate_t syncState WARM;
+volatile uint16_t syncStamp;
+
+#ifdef SYNC_LEADER
+#define TX_IDLE 0xff
+#define TX_STOP (2 + 2 * NEC_BITS)     // the mark after the last bit
+
+// Beacon on air: txEdge is the mark or space being sent, header first
+static volatile uint8_t txEdge = TX_IDLE;
+static uint8_t txLeft;                  // IR ticks until the next edge
+static uint32_t txBits;
+static uint16_t untilBeacon = SYNC_PERIOD;
+
+/*
+ * Called from the IR ISR every tick: turn the 38kHz carrier on for marks
+ * and off for spaces
+ */
+void sync_tx()
+{
+  uint8_t edge = txEdge;
+  uint8_t ticks;
+
+  if (edge == TX_IDLE || --txLeft) {
+    return;
+  }
+
+  if (edge == 0) {
+    // The followers stamp their phase as this header mark starts
+    txBits |= syncState.phase;
+    ticks = NEC_HDR_MARK / USEC_PER_TICK;
+  }
+  else if (edge == 1) {
+    ticks = NEC_HDR_SPACE / USEC_PER_TICK;
+  }
+  else if (edge > TX_STOP) {
+    TCCR2A = _BV(WGM21);
+    txEdge = TX_IDLE;
+    return;
+  }
+  else if ((edge & 1) == 0) {
+    ticks = NEC_BIT_MARK / USEC_PER_TICK;
+  }
+  else {
+    ticks = (txBits & 0x80000000UL ? NEC_ONE_SPACE : NEC_ZERO_SPACE) / USEC_PER_TICK;
+    txBits <<= 1;
+  }
+
+  // Carrier on OC2B for marks, the even edges
+  TCCR2A = (edge & 1) ? _BV(WGM21) : _BV(WGM21) | _BV(COM2B0);
+  txLeft = ticks;
+  txEdge = edge + 1;
+}
+
+/*
+ * Start a beacon at the next IR tick, unless the receiver is busy with a
+ * remote (ours would be lost in it and so would the key press)
+ */
+static void send_beacon()
+{
+  if (txEdge != TX_IDLE || irparams.rcvstate != STATE_IDLE) {
+    return;
+  }
+
+  untilBeacon = SYNC_PERIOD;
+  txBits = ((uint32_t) SYNC_ADDR << 24) | ((uint32_t) program << 16);
+  txLeft = 1;
+  txEdge = 0;
+}
+#endif /* SYNC_LEADER */
+
+void init_sync()
+{
+#ifdef SYNC_LEADER
+  // Timer 2 toggles OC2B at twice the carrier frequency, when connected
+  pinMode(SYNC_LED_PIN, OUTPUT);
+  digitalWrite(SYNC_LED_PIN, LOW);
+  TCCR2A = _BV(WGM21);
+  TCCR2B = _BV(CS20);
+  OCR2A = SYSCLOCK / (2 * SYNC_CARRIER) - 1;
+  OCR2B = 0;
+#endif
+}
+
+/*
+ * A program was selected, its effects start again from step 0
+ */
+void sync_select()
+{
+  uint8_t sreg = SREG;
+  uint16_t cycle = program_cycle(program);
+
+  cli();
+  syncState.phase = 0;
+  syncState.cycle = cycle;
+  syncState.wrap = cycle ? 65536UL / cycle * cycle : 0;
+  SREG = sreg;
+  syncState.owed = 0;
+  syncState.slew = 0;
+}
+
+/*
+ * Called once a frame by frame_next(): how many steps to run, normally 1.
+ * While a correction is owed it's 2 or 0 every SYNC_SLEW frames. No
+ * nudges while an IR frame is coming in, as it may be a beacon measured
+ * against the phase before the nudge.
+ */
+uint8_t sync_steps()
+{
+  uint8_t steps = 1;
+  uint8_t sreg = SREG;
+
+#ifdef SYNC_LEADER
+  if (untilBeacon) {
+    untilBeacon--;
+  }
+  if (untilBeacon == 0) {
+    send_beacon();
+  }
+#else
+  if (syncState.owed && irparams.rcvstate == STATE_IDLE && ++syncState.slew >= SYNC_SLEW) {
+    syncState.slew = 0;
+    if (syncState.owed > 0) {
+      syncState.owed--;
+      steps = 2;
+    }
+    else {
+      syncState.owed++;
+      steps = 0;
+    }
+  }
+#endif
+
+  // The IR ISR reads it
+  uint16_t phase = syncState.phase + steps;
+  if (syncState.wrap && (phase >= syncState.wrap || phase < steps)) {
+    phase -= syncState.wrap;
+  }
+  cli();
+  syncState.phase = phase;
+  SREG = sreg;
+
+  return steps;
+}
+
+/*
+ * A beacon has been decoded: work out how far behind (or ahead of) the
+ * leader we are, as of the start of the frame
+ */
+void sync_beacon(uint32_t value)
+{
+#ifndef SYNC_LEADER
+  uint8_t leaderProgram = value >> 16;
+  uint16_t leaderPhase = value;
+  int16_t error = leaderPhase - syncStamp;
+
+  syncState.beacons++;
+
+  if (leaderProgram != program) {
+    // Missed a key press. The new program starts from step 0 and the next
+    // beacon puts it right.
+    if (leaderProgram < numPrograms) {
+      frame_select(leaderProgram);
+    }
+    return;
+  }
+
+  if (syncState.cycle) {
+    // Both phases count round the same wrap, a whole number of cycles;
+    // the error is the short way round the cycle
+    uint16_t ahead = leaderPhase - syncStamp;
+    if (leaderPhase < syncStamp) {
+      ahead += syncState.wrap;
+    }
+    ahead %= syncState.cycle;
+    error = ahead > syncState.cycle / 2 ? (int16_t) (ahead - syncState.cycle) : (int16_t) ahead;
+  }
+
+  if (error >= -SYNC_DEADBAND && error <= SYNC_DEADBAND) {
+    error = 0;
+  }
+  syncState.owed = error;
+#endif
+}
+
+#endif /* HAS_SYNC */
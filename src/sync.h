@@ -0,0 +1,74 @@
+#pragma once
+
+#ifdef HAS_SYNC
+
+// Effect phase sync between controllers.
+//
+// Every effect and the modulation graph move on one step a frame, so how
+// far a program has got is just the number of steps since it was selected,
+// syncState.phase. Boards free running off their own clocks drift apart by
+// up to a few percent of that. The phase counts round the largest multiple
+// of the program's cycle (program_cycle(), 750 steps for the chase) that
+// fits in 16 bits, or all 16 bits for a program that never repeats, so it
+// says where every board is in the cycle however long it has been running.
+//
+// One board, built with -DSYNC_LEADER (UNO, the uno_sync_leader
+// environment), sends a beacon every SYNC_PERIOD frames: an NEC frame from
+// an IR LED on pin 3, so every board's existing receiver picks it up. Its
+// 32 bits are SYNC_ADDR, the program and the leader's phase at the moment
+// the header mark started. The followers note their own phase at the start
+// of every IR frame (syncStamp, set by the IR ISR), so the difference is
+// the error whatever the frame took to send and decode.
+//
+// The error isn't fixed in one go: every SYNC_SLEW frames a follower that
+// is behind runs two steps in a frame, and one that is ahead holds a
+// frame, until it has made up the difference. That's at most a 1 in
+// SYNC_SLEW change of speed, and no jumps. The error is taken the short
+// way round the cycle, so it's at most half of it: 375 steps, ~6s of
+// nudges, for a board that powers up into the chase long after the leader
+// did. A follower on the wrong program (it missed a key press) crossfades
+// to the leader's and slews onto its phase from there. Twinkle and candle
+// programs have no cycle, and can owe up to 32767 steps, but nobody can
+// see their phase.
+
+#define SYNC_ADDR 0xa5          // top byte of a beacon, no remote key uses it
+#define SYNC_PERIOD 512         // frames between beacons, ~1s
+#define SYNC_SLEW 8             // frames between nudges while correcting
+#define SYNC_DEADBAND 1         // steps of error left alone, beacon jitter
+
+#define SYNC_BEACON(value) (((value) >> 24) == SYNC_ADDR)
+
+typedef struct {
+  uint16_t phase;       // steps since the program was selected, mod wrap
+  uint16_t cycle;       // the program's, 0 for none
+  uint16_t wrap;        // where phase goes back to 0, 0 for 65536
+  int16_t owed;         // steps to make up (+) or hold back (-)
+  uint8_t slew;         // frames since the last nudge
+  uint8_t beacons;      // beacons heard, wraps
+} syncstate_t;
+
+extern syncstate_t syncState;
+extern volatile uint16_t syncStamp;
+
+extern void sync_select();
+extern uint8_t sync_steps();
+extern void sync_beacon(uint32_t value);
+
+#ifdef SYNC_LEADER
+# ifndef UNO
+#  error The sync leader needs Timer 2 and pin 3 for the IR LED, UNO only
+# endif
+# ifdef TRACE
+#  error TRACE uses pin 3, which the sync leader needs for the IR LED
+# endif
+
+# define SYNC_LED_PIN 3         // OC2B
+# define SYNC_CARRIER 38000
+
+extern void sync_tx();
+# define SYNC_TX() sync_tx()
+#else
+# define SYNC_TX()
+#endif
+
+#endif
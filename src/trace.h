@@ -0,0 +1,54 @@
+#pragma once
+
+// Logic analyser trace, built with -DTRACE (the *_trace PlatformIO
+// environments). Each marker drives a pin high for as long as its code
+// runs, so a cheap logic analyser shows the ISRs, phase swaps, IR decodes
+// and effect steps on one timeline. Without TRACE the markers are empty.
+//
+// The UNO has a pin per marker, Arduino pins 2 to 7 (PD2 to PD7) in the
+// order below. The ATtiny only has PB5 (RSTDISBL fuse, see README), shared
+// by the markers in TRACE_SELECT; pick ones that don't nest, or the inner
+// one ends the pulse early.
+//
+// The host sim (make sim-trace) writes the same markers to a VCD file, see
+// sim/trace.cpp.
+
+#define TRACE_PWM     0   // Timer 0 ISR
+#define TRACE_IR      1   // Timer 1 ISR
+#define TRACE_PHASE   2   // H-bridge phase swap, inside the Timer 0 ISR
+#define TRACE_DECODE  3   // decode() and dispatch of an IR frame
+#define TRACE_STEP    4   // one Effect::step()
+#define TRACE_FRAME   5   // frame_next(), steps included
+#define NUM_TRACE     6
+
+#ifdef TRACE
+
+#if defined(INSTRUMENT) && defined(ATTINY)
+# error INSTRUMENT and TRACE both need PB5 on the ATtiny
+#endif
+
+#if defined(SIM)
+extern void sim_trace(uint8_t marker, uint8_t level);
+# define TRACE_INIT()
+# define TRACE_ON(m) sim_trace(m, 1)
+# define TRACE_OFF(m) sim_trace(m, 0)
+#elif defined(UNO)
+# define TRACE_INIT() (DDRD |= 0xfc)
+# define TRACE_ON(m) (PORTD |= _BV((m) + 2))
+# define TRACE_OFF(m) (PORTD &= ~_BV((m) + 2))
+#else
+# ifndef TRACE_SELECT
+#  define TRACE_SELECT (_BV(TRACE_PWM) | _BV(TRACE_IR))
+# endif
+# define TRACE_INIT() (DDRB |= _BV(5))
+# define TRACE_ON(m) do { if (TRACE_SELECT & _BV(m)) PORTB |= _BV(5); } while (0)
+# define TRACE_OFF(m) do { if (TRACE_SELECT & _BV(m)) PORTB &= ~_BV(5); } while (0)
+#endif
+
+#else
+
+#define TRACE_INIT()
+#define TRACE_ON(m)
+#define TRACE_OFF(m)
+
+#endif
@@ -0,0 +1,134 @@
+#include <Arduino.h>
+
+#include <avr/io.h>
+#include <avr/wdt.h>
+
+#include "lights.h"
+#include "warm.h"
+#include "instrument.h"
+
+#ifdef HAS_WARM
+
+#ifdef SIM
+// The linker's bounds for the "warm" section. Reading between the
+// variables in it is deliberate, so no AddressSanitizer checks.
+extern uint8_t __start_warm[], __stop_warm[];
+# define BLOCK_START __start_warm
+# define BLOCK_END __stop_warm
+# define NO_ASAN __attribute__ ((no_sanitize_address))
+#else
+extern uint8_t __noinit_start[], __noinit_end[];
+# define BLOCK_START __noinit_start
+# define BLOCK_END __noinit_end
+# define NO_ASAN
+#endif
+
+// AVR clocks a byte of the block for sum_range() (load, 16 bit rotate and
+// add, loop) and block_clear(). The sim charges setup() for them, for the
+// time a warm start takes; warm_frame()'s sum is part of the frame's work,
+// which it doesn't.
+#define SUM_BYTE_CYCLES 11
+#define CLEAR_BYTE_CYCLES 6
+
+typedef struct {
+  uint16_t sum;
+  uint8_t resetFlags;   // MCUSR as the reset left it
+  uint8_t retries;      // warm starts since WARM_SETTLE good frames
+  uint16_t settle;      // good frames since the last warm start
+} warmctl_t;
+
+// In the block, but left out of the sum
+static warmctl_t ctl WARM;
+
+// ctl.resetFlags for after the block has been cleared
+static uint8_t resetCause;
+
+NO_ASAN static uint16_t sum_range(uint16_t sum, const uint8_t *p, const uint8_t *end)
+{
+  while (p < end) {
+    sum = ((sum << 1) | (sum >> 15)) + *p++;
+  }
+
+  return sum;
+}
+
+static uint16_t block_sum()
+{
+  uint16_t sum = sum_range(WARM_MAGIC, BLOCK_START, (const uint8_t *) &ctl);
+
+  return sum_range(sum, (const uint8_t *) (&ctl + 1), BLOCK_END);
+}
+
+NO_ASAN static void block_clear()
+{
+  for (uint8_t *p = BLOCK_START; p < BLOCK_END; p++) {
+    *p = 0;
+  }
+}
+
+#ifndef SIM
+/*
+ * Straight after reset, before the C runtime: note why, and stop the
+ * watchdog, which stays on at its shortest timeout once it has fired
+ */
+void warm_reset_flags() __attribute__ ((naked, used, section(".init3")));
+
+void warm_reset_flags()
+{
+  ctl.resetFlags = MCUSR;
+  MCUSR = 0;
+  wdt_disable();
+}
+#endif
+
+/*
+ * Called first thing in setup(). Returns 1 if the WARM state is good to
+ * carry on from, otherwise clears it and returns 0 for a cold start.
+ * Starts the watchdog either way.
+ */
+uint8_t warm_start()
+{
+#ifdef SIM
+  ctl.resetFlags = MCUSR;
+  MCUSR = 0;
+#endif
+  resetCause = ctl.resetFlags;
+
+  uint8_t warm = !(ctl.resetFlags & (_BV(PORF) | _BV(EXTRF))) &&
+                 ctl.retries < WARM_RETRIES && ctl.sum == block_sum();
+  SPEND((BLOCK_END - BLOCK_START) * SUM_BYTE_CYCLES);
+
+  if (warm) {
+    ctl.retries++;
+  }
+  else {
+    block_clear();
+    SPEND((BLOCK_END - BLOCK_START) * CLEAR_BYTE_CYCLES);
+  }
+  ctl.settle = 0;
+
+  wdt_enable(WARM_TIMEOUT);
+  return warm;
+}
+
+/*
+ * MCUSR as the last reset left it
+ */
+uint8_t warm_reset_cause()
+{
+  return resetCause;
+}
+
+/*
+ * Called at the end of every frame, once everything in it has changed
+ */
+void warm_frame()
+{
+  if (ctl.retries && ++ctl.settle >= WARM_SETTLE) {
+    ctl.retries = 0;
+  }
+
+  ctl.sum = block_sum();
+}
+
+#endif /* HAS_WARM */
@@ -0,0 +1,43 @@
+#pragma once
+
+// Warm start after a watchdog or brown-out reset.
+//
+// The state the lights are made from (effects, modulation graph, dimmer,
+// sync phase, on/off and the PWM levels) is marked WARM, which puts it in
+// .noinit where the C runtime leaves it alone at reset. warm_frame() keeps
+// a checksum of it up to date at the end of every frame.
+//
+// warm_start() is the first thing setup() does. After any reset but power
+// on or the reset pin, if the checksum still matches, setup() skips
+// loading the program, the dimmer and the EEPROM settings: only the
+// hardware is set up again, and the PWM carries on at the levels it had
+// from its first tick, the effects from the next frame. Otherwise the
+// block is cleared, as .bss would have been, and it's a normal cold start.
+// So is a reset in the middle of a frame, when the sum no longer matches,
+// and a fault that keeps recurring: after WARM_RETRIES warm starts without
+// WARM_SETTLE good frames in between, the next start is cold.
+//
+// The watchdog is kicked in idleFor(), so it fires if the main loop stops
+// going back to sleep for WARM_TIMEOUT. Brown-out resets need the BOD
+// fuse, see the README. On the UNO, Optiboot clears MCUSR before the
+// sketch starts, so there every reset counts and the checksum alone keeps
+// power on cold.
+
+#ifdef HAS_WARM
+# ifdef SIM
+#  define WARM __attribute__ ((section("warm")))
+# else
+#  define WARM __attribute__ ((section(".noinit")))
+# endif
+
+# define WARM_TIMEOUT WDTO_120MS
+# define WARM_SETTLE 512        // frames, 1 to 3s depending on the outputs
+# define WARM_RETRIES 3
+# define WARM_MAGIC 0x5741      // checksum starting value
+
+extern uint8_t warm_start();
+extern uint8_t warm_reset_cause();
+extern void warm_frame();
+#else
+# define WARM
+#endif